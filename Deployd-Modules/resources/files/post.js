@@ -1,2 +1,6 @@
 this.fileName = this.id;
-this.uploadedAt = new Date().getTime();
\ No newline at end of file
+this.uploadedAt = new Date().getTime();
+//Content hashes are only recorded by the server once verified
+if (!internal) {
+    protect('contentHash');
+}
\ No newline at end of file
@@ -0,0 +1,4 @@
+//Only the server updates files, e.g. to record content hashes
+if (!internal) {
+    cancel("Unauthorized operation", 401);
+}
\ No newline at end of file
@@ -1,4 +1 @@
-dpd.files.post({
-  fileName: fileName
- ,fileSize: fileSize
-});
\ No newline at end of file
+//Files are recorded by the bucket once stored, with their size
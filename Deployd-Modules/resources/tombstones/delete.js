@@ -0,0 +1,4 @@
+//Only tracked collections prune tombstones
+if (!internal) {
+    cancel("Tombstones can only be deleted by the server", 401);
+}
@@ -0,0 +1,2 @@
+//Tombstones are immutable
+cancel("Tombstones cannot be changed", 401);
@@ -0,0 +1,233 @@
+#!/usr/bin/env node
+/*
+ Generates typed DKEntity subclasses from the collection schemas of a Deployd app.
+
+ node DeploydKit-Codegen <resources dir> <output dir> [--prefix DK] [--collections post,user]
+
+ Every resources/<name>/config.json with a schema (Collection, TrackedCollection) or of
+ type UserCollection becomes <prefix><Name>.h/.m with a property per schema property, backed by an ivar:
+
+   string  -> NSString *     number -> double      boolean -> BOOL
+   array   -> NSArray *      object -> NSDictionary *
+
+ Fetched and saved values are decoded into the ivars once, when they change, so reading
+ a property doesn't look up or unbox the result map. The keys of scalar properties skip
+ the key validation on save. The classes register themselves for their collection in
+ +load, the entities fetched by DKQuery are instances of them.
+ */
+var fs = require('fs')
+  , path = require('path');
+
+// Properties already exposed by DKEntity or unusable as accessor names
+var RESERVED = ['id', 'createdAt', 'updatedAt', 'creatorId', 'password', 'entityName', 'entityId',
+  'isNew', 'isDirty', 'cachePolicy', 'maxCacheAge', 'writeBehindInterval', 'writeBehindMaxChanges',
+  'description', 'hash', 'class', 'self', 'superclass', 'zone', 'delete', 'save', 'refresh', 'reset', 'flush'];
+
+var TYPES = {
+  string: {
+    decl: 'NSString *', attr: 'copy', scalar: true,
+    decode: function(v) { return '[' + v + ' isKindOfClass:[NSString class]] ? ' + v + ' : nil'; },
+    box: function(v) { return '(' + v + ' != nil) ? (id)' + v + ' : [NSNull null]'; }
+  },
+  number: {
+    decl: 'double ', attr: 'assign', scalar: true,
+    decode: function(v) { return '[' + v + ' isKindOfClass:[NSNumber class]] ? [' + v + ' doubleValue] : 0.0'; },
+    box: function(v) { return '@(' + v + ')'; }
+  },
+  boolean: {
+    decl: 'BOOL ', attr: 'assign', scalar: true,
+    decode: function(v) { return '[' + v + ' isKindOfClass:[NSNumber class]] ? [' + v + ' boolValue] : NO'; },
+    box: function(v) { return '@(' + v + ')'; }
+  },
+  array: {
+    decl: 'NSArray *', attr: 'strong', scalar: false,
+    decode: function(v) { return '[' + v + ' isKindOfClass:[NSArray class]] ? ' + v + ' : nil'; },
+    box: function(v) { return '(' + v + ' != nil) ? (id)' + v + ' : [NSNull null]'; }
+  },
+  object: {
+    decl: 'NSDictionary *', attr: 'strong', scalar: false,
+    decode: function(v) { return '[' + v + ' isKindOfClass:[NSDictionary class]] ? ' + v + ' : nil'; },
+    box: function(v) { return '(' + v + ' != nil) ? (id)' + v + ' : [NSNull null]'; }
+  }
+};
+
+function capitalize(name) {
+  return name.charAt(0).toUpperCase() + name.slice(1);
+}
+
+function className(prefix, collection) {
+  return prefix + collection.split(/[^A-Za-z0-9]+/).filter(function(part) {
+    return part.length > 0;
+  }).map(capitalize).join('');
+}
+
+function isUsableName(name) {
+  // Keys with '$' or '.' can't be saved, names starting with an ARC method family can't be getters
+  return /^[A-Za-z_][A-Za-z0-9_]*$/.test(name) &&
+    RESERVED.indexOf(name) === -1 &&
+    !/^(new|copy|mutableCopy|alloc|init)([A-Z_0-9]|$)/.test(name);
+}
+
+function schemaProperties(config) {
+  var properties = []
+    , schema = config.properties || {};
+
+  if (config.type === 'UserCollection') {
+    properties.push({name: 'username', type: 'string'});
+  }
+  Object.keys(schema).sort(function(a, b) {
+    return (schema[a].order || 0) - (schema[b].order || 0);
+  }).forEach(function(key) {
+    var name = schema[key].name || key;
+    if (!TYPES[schema[key].type]) {
+      console.warn('Skipping ' + name + ': unsupported type ' + schema[key].type);
+    } else if (!isUsableName(name)) {
+      if (RESERVED.indexOf(name) === -1) console.warn('Skipping ' + name + ': not a usable property name');
+    } else if (!properties.some(function(p) { return p.name === name; })) {
+      properties.push({name: name, type: schema[key].type});
+    }
+  });
+  return properties;
+}
+
+function header(file, collection) {
+  return [
+    '//',
+    '//  ' + file,
+    '//  DeploydKit',
+    '//',
+    '//  Generated by DeploydKit-Codegen from resources/' + collection + '/config.json, do not edit.',
+    '//',
+    ''
+  ];
+}
+
+function generateHeader(name, collection, properties) {
+  var lines = header(name + '.h', collection);
+  lines.push('#import "DKEntity.h"', '');
+  lines.push('/**', ' A typed entity of the `' + collection + '` collection', ' */');
+  lines.push('@interface ' + name + ' : DKEntity', '');
+  properties.forEach(function(p) {
+    var type = TYPES[p.type];
+    lines.push('/**', ' The `' + p.name + '` ' + p.type + ' value', ' */');
+    lines.push('@property (nonatomic, ' + type.attr + ') ' + type.decl + p.name + ';', '');
+  });
+  lines.push('/**', ' Creates a new entity of the `' + collection + '` collection', ' @return The new entity', ' */');
+  lines.push('+ (' + name + ' *)entity;', '');
+  lines.push('@end', '');
+  return lines.join('\n');
+}
+
+function generateImplementation(name, collection, properties) {
+  var lines = header(name + '.m', collection)
+    , keyName = function(p) { return 'k' + name + capitalize(p.name) + 'Key'; }
+    , ivar = function(p) { return p.name + '_'; };
+
+  lines.push('#import "' + name + '.h"', '');
+  lines.push('#define k' + name + 'EntityName @"' + collection + '"');
+  properties.forEach(function(p) {
+    lines.push('#define ' + keyName(p) + ' @"' + p.name + '"');
+  });
+  lines.push('');
+
+  lines.push('@implementation ' + name + ' {', '@private');
+  properties.forEach(function(p) {
+    lines.push('  ' + TYPES[p.type].decl + ivar(p) + ';');
+  });
+  lines.push('}', '');
+
+  lines.push('+ (void)load {');
+  lines.push('  [DKEntity registerSubclass:self forEntityName:k' + name + 'EntityName];');
+  lines.push('}', '');
+
+  lines.push('+ (' + name + ' *)entity {');
+  lines.push('  return [[self alloc] initWithName:k' + name + 'EntityName];');
+  lines.push('}', '');
+
+  lines.push('+ (NSSet *)unvalidatedKeys {');
+  lines.push('  static NSSet *keys;');
+  lines.push('  static dispatch_once_t onceToken;');
+  lines.push('  dispatch_once(&onceToken, ^{');
+  lines.push('    keys = [NSSet setWithObjects:' + properties.filter(function(p) {
+    return TYPES[p.type].scalar;
+  }).map(function(p) {
+    return keyName(p) + ', ';
+  }).join('') + 'nil];');
+  lines.push('  });');
+  lines.push('  return keys;');
+  lines.push('}', '');
+
+  lines.push('- (void)decodeObjects {');
+  lines.push('  [super decodeObjects];');
+  lines.push('  id value = nil;');
+  properties.forEach(function(p) {
+    lines.push('  value = [self objectForKey:' + keyName(p) + '];');
+    lines.push('  ' + ivar(p) + ' = ' + TYPES[p.type].decode('value') + ';');
+  });
+  lines.push('}', '');
+
+  lines.push('- (void)setObject:(id)object forKey:(NSString *)key {');
+  lines.push('  [super setObject:object forKey:key];');
+  properties.forEach(function(p, i) {
+    lines.push('  ' + (i > 0 ? 'else ' : '') + 'if ([key isEqualToString:' + keyName(p) + ']) {');
+    lines.push('    ' + ivar(p) + ' = ' + TYPES[p.type].decode('object') + ';');
+    lines.push('  }');
+  });
+  lines.push('}', '');
+
+  properties.forEach(function(p) {
+    var type = TYPES[p.type];
+    lines.push('- (' + type.decl.trim() + ')' + p.name + ' {');
+    lines.push('  return ' + ivar(p) + ';');
+    lines.push('}', '');
+    lines.push('- (void)set' + capitalize(p.name) + ':(' + type.decl.trim() + ')' + p.name + ' {');
+    lines.push('  [super setObject:' + type.box(p.name) + ' forKey:' + keyName(p) + '];');
+    lines.push('  ' + ivar(p) + ' = ' + (p.type === 'string' ? '[' + p.name + ' copy]' : p.name) + ';');
+    lines.push('}', '');
+  });
+
+  lines.push('@end', '');
+  return lines.join('\n');
+}
+
+function generate(resourcesDir, outputDir, options) {
+  var generated = [];
+  fs.readdirSync(resourcesDir).sort().forEach(function(collection) {
+    var configPath = path.join(resourcesDir, collection, 'config.json')
+      , config;
+
+    if (options.collections && options.collections.indexOf(collection) === -1) return;
+    if (!fs.existsSync(configPath)) return;
+    config = JSON.parse(fs.readFileSync(configPath, 'utf8'));
+    // Collections and resources extending them, such as TrackedCollection, have a schema
+    if (config.type !== 'UserCollection' && !config.properties) return;
+
+    var name = className(options.prefix, collection)
+      , properties = schemaProperties(config);
+    fs.writeFileSync(path.join(outputDir, name + '.h'), generateHeader(name, collection, properties));
+    fs.writeFileSync(path.join(outputDir, name + '.m'), generateImplementation(name, collection, properties));
+    generated.push(name);
+  });
+  return generated;
+}
+
+module.exports = generate;
+
+if (require.main === module) {
+  var args = process.argv.slice(2)
+    , options = {prefix: ''}
+    , dirs = [];
+
+  for (var i = 0; i < args.length; i++) {
+    if (args[i] === '--prefix') options.prefix = args[++i] || '';
+    else if (args[i] === '--collections') options.collections = (args[++i] || '').split(',');
+    else dirs.push(args[i]);
+  }
+  if (dirs.length !== 2) {
+    console.error('Usage: node DeploydKit-Codegen <resources dir> <output dir> [--prefix DK] [--collections post,user]');
+    process.exit(1);
+  }
+  generate(dirs[0], dirs[1], options).forEach(function(name) {
+    console.log('Generated ' + name);
+  });
+}
@@ -0,0 +1,28 @@
+//
+//  DKBinaryCoder.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+/**
+ Encodes JSON objects in a compact binary format for the response cache.
+
+ The format is MessagePack-like: a "DKB1" magic, the table of dictionary keys, each key
+ stored once, then the values as type tags followed by varint lengths and counts. Decoding
+ doesn't scan text or unescape strings, and creates each key once. Decoded containers are
+ immutable, like the objects returned by NSJSONSerialization.
+ */
+@interface DKBinaryCoder : NSObject
+
++ (BOOL)isEncodedData:(NSData *)data;
+
+/**
+ Returns the encoded object, or `nil` if it contains objects that aren't valid in JSON
+ */
++ (NSData *)dataWithJSONObject:(id)object;
+
++ (id)JSONObjectWithData:(NSData *)data error:(NSError **)error;
+
+@end
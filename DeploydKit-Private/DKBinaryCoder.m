@@ -0,0 +1,341 @@
+//
+//  DKBinaryCoder.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKBinaryCoder.h"
+#import "DKConstants.h"
+
+#define kDKBinaryCoderMagic "DKB1"
+#define kDKBinaryCoderMagicLength 4
+#define kDKBinaryCoderMaxDepth 512
+
+enum {
+  DKBinaryTagNull = 0,
+  DKBinaryTagFalse,
+  DKBinaryTagTrue,
+  DKBinaryTagInteger,
+  DKBinaryTagDouble,
+  DKBinaryTagString,
+  DKBinaryTagArray,
+  DKBinaryTagDictionary
+};
+typedef NSInteger DKBinaryTag;
+
+typedef struct {
+  const uint8_t *bytes;
+  NSUInteger length;
+  NSUInteger offset;
+} DKBinaryReader;
+
+#pragma mark Encoding
+
+static void DKWriteTag(NSMutableData *data, DKBinaryTag tag) {
+  uint8_t byte = (uint8_t)tag;
+  [data appendBytes:&byte length:1];
+}
+
+static void DKWriteVarint(NSMutableData *data, uint64_t value) {
+  uint8_t buffer[10];
+  NSUInteger length = 0;
+  while (value >= 0x80) {
+    buffer[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buffer[length++] = (uint8_t)value;
+  [data appendBytes:buffer length:length];
+}
+
+static BOOL DKWriteString(NSMutableData *data, NSString *string) {
+  NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+  if (length == 0 && string.length > 0) {
+    // Not representable in UTF-8, e.g. unpaired surrogates
+    return NO;
+  }
+  DKWriteVarint(data, length);
+  NSUInteger offset = data.length;
+  [data increaseLengthBy:length];
+  return [string getBytes:(uint8_t *)data.mutableBytes + offset
+                maxLength:length
+               usedLength:NULL
+                 encoding:NSUTF8StringEncoding
+                  options:0
+                    range:NSMakeRange(0, string.length)
+           remainingRange:NULL];
+}
+
+static BOOL DKWriteNumber(NSMutableData *data, NSNumber *number) {
+  if (CFGetTypeID((__bridge CFTypeRef)number) == CFBooleanGetTypeID()) {
+    DKWriteTag(data, number.boolValue ? DKBinaryTagTrue : DKBinaryTagFalse);
+    return YES;
+  }
+
+  const char *type = [number objCType];
+  BOOL isInteger = (type[0] != '\0' && strchr("cCsSiIlLqQ", type[0]) != NULL);
+  BOOL isUnsigned = (isInteger && strchr("CSILQ", type[0]) != NULL);
+  if (isInteger && !(isUnsigned && number.unsignedLongLongValue > INT64_MAX)) {
+    // Zigzag encoding keeps small negative integers short
+    int64_t value = number.longLongValue;
+    DKWriteTag(data, DKBinaryTagInteger);
+    DKWriteVarint(data, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    return YES;
+  }
+
+  double value = number.doubleValue;
+  if (isnan(value) || isinf(value)) {
+    return NO;
+  }
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bits = CFSwapInt64HostToLittle(bits);
+  DKWriteTag(data, DKBinaryTagDouble);
+  [data appendBytes:&bits length:sizeof(bits)];
+  return YES;
+}
+
+static BOOL DKWriteObject(NSMutableData *data, id object, NSMutableDictionary *keyIndexes, NSMutableArray *keys, NSUInteger depth) {
+  if (depth > kDKBinaryCoderMaxDepth) {
+    return NO;
+  }
+  if (object == [NSNull null]) {
+    DKWriteTag(data, DKBinaryTagNull);
+    return YES;
+  }
+  if ([object isKindOfClass:[NSString class]]) {
+    DKWriteTag(data, DKBinaryTagString);
+    return DKWriteString(data, object);
+  }
+  if ([object isKindOfClass:[NSNumber class]]) {
+    return DKWriteNumber(data, object);
+  }
+  if ([object isKindOfClass:[NSArray class]]) {
+    DKWriteTag(data, DKBinaryTagArray);
+    DKWriteVarint(data, [object count]);
+    for (id value in object) {
+      if (!DKWriteObject(data, value, keyIndexes, keys, depth + 1)) {
+        return NO;
+      }
+    }
+    return YES;
+  }
+  if ([object isKindOfClass:[NSDictionary class]]) {
+    DKWriteTag(data, DKBinaryTagDictionary);
+    DKWriteVarint(data, [object count]);
+    for (id key in object) {
+      if (![key isKindOfClass:[NSString class]]) {
+        return NO;
+      }
+
+      // Keys are written once in the key table and referenced by index
+      NSNumber *index = keyIndexes[key];
+      if (index == nil) {
+        index = @(keys.count);
+        keyIndexes[key] = index;
+        [keys addObject:key];
+      }
+      DKWriteVarint(data, index.unsignedIntegerValue);
+      if (!DKWriteObject(data, object[key], keyIndexes, keys, depth + 1)) {
+        return NO;
+      }
+    }
+    return YES;
+  }
+  return NO;
+}
+
+#pragma mark Decoding
+
+static BOOL DKReadVarint(DKBinaryReader *reader, uint64_t *value) {
+  uint64_t result = 0;
+  for (NSUInteger shift = 0; shift < 64; shift += 7) {
+    if (reader->offset >= reader->length) {
+      return NO;
+    }
+    uint8_t byte = reader->bytes[reader->offset++];
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return YES;
+    }
+  }
+  return NO;
+}
+
+static BOOL DKReadCount(DKBinaryReader *reader, NSUInteger *count) {
+  // Every encoded item takes at least a byte, larger counts are corrupt
+  uint64_t value = 0;
+  if (!DKReadVarint(reader, &value) || value > reader->length - reader->offset) {
+    return NO;
+  }
+  *count = (NSUInteger)value;
+  return YES;
+}
+
+static NSString *DKReadString(DKBinaryReader *reader) {
+  NSUInteger length = 0;
+  if (!DKReadCount(reader, &length)) {
+    return nil;
+  }
+  NSString *string = [[NSString alloc] initWithBytes:reader->bytes + reader->offset
+                                              length:length
+                                            encoding:NSUTF8StringEncoding];
+  reader->offset += length;
+  return string;
+}
+
+static void DKReleaseObjects(__strong id *objects, NSUInteger count) {
+  for (NSUInteger i = 0; i < count; i++) {
+    objects[i] = nil;
+  }
+  free(objects);
+}
+
+static id DKReadObject(DKBinaryReader *reader, NSArray *keys, NSUInteger depth) {
+  if (depth > kDKBinaryCoderMaxDepth || reader->offset >= reader->length) {
+    return nil;
+  }
+
+  DKBinaryTag tag = reader->bytes[reader->offset++];
+  switch (tag) {
+    case DKBinaryTagNull:
+      return [NSNull null];
+    case DKBinaryTagFalse:
+      return @NO;
+    case DKBinaryTagTrue:
+      return @YES;
+    case DKBinaryTagInteger: {
+      uint64_t value = 0;
+      if (!DKReadVarint(reader, &value)) {
+        return nil;
+      }
+      return @((long long)((int64_t)(value >> 1) ^ -(int64_t)(value & 1)));
+    }
+    case DKBinaryTagDouble: {
+      uint64_t bits;
+      if (reader->length - reader->offset < sizeof(bits)) {
+        return nil;
+      }
+      memcpy(&bits, reader->bytes + reader->offset, sizeof(bits));
+      reader->offset += sizeof(bits);
+      bits = CFSwapInt64LittleToHost(bits);
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      return @(value);
+    }
+    case DKBinaryTagString:
+      return DKReadString(reader);
+    case DKBinaryTagArray: {
+      NSUInteger count = 0;
+      if (!DKReadCount(reader, &count)) {
+        return nil;
+      }
+      __strong id *objects = (__strong id *)calloc(MAX(count, 1), sizeof(id));
+      NSUInteger i = 0;
+      for (; i < count; i++) {
+        objects[i] = DKReadObject(reader, keys, depth + 1);
+        if (objects[i] == nil) {
+          break;
+        }
+      }
+      NSArray *array = (i == count) ? [NSArray arrayWithObjects:objects count:count] : nil;
+      DKReleaseObjects(objects, count);
+      return array;
+    }
+    case DKBinaryTagDictionary: {
+      NSUInteger count = 0;
+      if (!DKReadCount(reader, &count)) {
+        return nil;
+      }
+      __strong id *objects = (__strong id *)calloc(MAX(count, 1), sizeof(id));
+      __unsafe_unretained id *dictKeys = (__unsafe_unretained id *)calloc(MAX(count, 1), sizeof(id));
+      NSUInteger i = 0;
+      for (; i < count; i++) {
+        uint64_t index = 0;
+        if (!DKReadVarint(reader, &index) || index >= keys.count) {
+          break;
+        }
+        // The keys are retained by the key table
+        dictKeys[i] = keys[(NSUInteger)index];
+        objects[i] = DKReadObject(reader, keys, depth + 1);
+        if (objects[i] == nil) {
+          break;
+        }
+      }
+      NSDictionary *dict = (i == count) ? [NSDictionary dictionaryWithObjects:objects forKeys:dictKeys count:count] : nil;
+      DKReleaseObjects(objects, count);
+      free(dictKeys);
+      return dict;
+    }
+    default:
+      return nil;
+  }
+}
+
+@implementation DKBinaryCoder
+
++ (BOOL)isEncodedData:(NSData *)data {
+  return (data.length >= kDKBinaryCoderMagicLength &&
+          memcmp(data.bytes, kDKBinaryCoderMagic, kDKBinaryCoderMagicLength) == 0);
+}
+
++ (NSData *)dataWithJSONObject:(id)object {
+  if (object == nil) {
+    return nil;
+  }
+
+  NSMutableDictionary *keyIndexes = [NSMutableDictionary new];
+  NSMutableArray *keys = [NSMutableArray new];
+  NSMutableData *values = [NSMutableData new];
+  if (!DKWriteObject(values, object, keyIndexes, keys, 0)) {
+    return nil;
+  }
+
+  NSMutableData *data = [NSMutableData dataWithCapacity:values.length + 64];
+  [data appendBytes:kDKBinaryCoderMagic length:kDKBinaryCoderMagicLength];
+  DKWriteVarint(data, keys.count);
+  for (NSString *key in keys) {
+    if (!DKWriteString(data, key)) {
+      return nil;
+    }
+  }
+  [data appendData:values];
+  return data;
+}
+
++ (id)JSONObjectWithData:(NSData *)data error:(NSError **)error {
+  id object = nil;
+  if ([self isEncodedData:data]) {
+    DKBinaryReader reader = {data.bytes, data.length, kDKBinaryCoderMagicLength};
+    NSUInteger count = 0;
+    if (DKReadCount(&reader, &count)) {
+      NSMutableArray *keys = [NSMutableArray arrayWithCapacity:count];
+      for (NSUInteger i = 0; i < count; i++) {
+        NSString *key = DKReadString(&reader);
+        if (key == nil) {
+          break;
+        }
+        [keys addObject:key];
+      }
+      if (keys.count == count) {
+        object = DKReadObject(&reader, keys, 0);
+      }
+    }
+    if (reader.offset != reader.length) {
+      // Trailing bytes, the data is corrupt
+      object = nil;
+    }
+  }
+
+  if (object == nil) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidResponse
+              description:NSLocalizedString(@"Could not decode cached response", nil)
+                 original:nil];
+  }
+  return object;
+}
+
+@end
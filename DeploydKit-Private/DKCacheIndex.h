@@ -0,0 +1,24 @@
+//
+//  DKCacheIndex.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+/**
+ Maps cache tags (collection names and collection/entity IDs) to the cache keys of the
+ responses that depend on them, so that writes can invalidate only the affected entries.
+ */
+@interface DKCacheIndex : NSObject
+
++ (DKCacheIndex *)sharedIndex;
+
++ (NSString *)tagForEntityName:(NSString *)entityName;
++ (NSString *)tagForEntityName:(NSString *)entityName entityId:(NSString *)entityId;
+
+- (void)addCacheKey:(NSString *)cacheKey forTags:(NSArray *)tags;
+- (void)invalidateTags:(NSArray *)tags;
+- (void)removeAllTags;
+
+@end
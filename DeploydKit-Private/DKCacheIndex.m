@@ -0,0 +1,154 @@
+//
+//  DKCacheIndex.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKCacheIndex.h"
+#import "EGOCache.h"
+
+#define kDKCacheIndexKey @"DKCacheIndex"
+
+@implementation DKCacheIndex {
+@private
+  dispatch_queue_t     queue_;
+  NSMutableDictionary *keysByTag_;
+  NSMutableDictionary *tagsByKey_;
+  BOOL                 needsSave_;
+}
+
++ (DKCacheIndex *)sharedIndex {
+  static DKCacheIndex *index;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    index = [[self alloc] init];
+  });
+  return index;
+}
+
++ (NSString *)tagForEntityName:(NSString *)entityName {
+  return entityName;
+}
+
++ (NSString *)tagForEntityName:(NSString *)entityName entityId:(NSString *)entityId {
+  return [entityName stringByAppendingPathComponent:entityId];
+}
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    queue_ = dispatch_queue_create("DeploydKit cache index queue", DISPATCH_QUEUE_SERIAL);
+    keysByTag_ = [NSMutableDictionary new];
+    tagsByKey_ = [NSMutableDictionary new];
+
+    // Restore the persisted index, the cache entries outlive the process
+    NSDictionary *stored = (NSDictionary *)[[EGOCache globalCache] plistForKey:kDKCacheIndexKey];
+    if ([stored isKindOfClass:[NSDictionary class]]) {
+      for (NSString *tag in stored) {
+        for (NSString *key in stored[tag]) {
+          [self linkKey:key tag:tag];
+        }
+      }
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  dispatch_release(queue_);
+}
+
+- (void)addCacheKey:(NSString *)cacheKey forTags:(NSArray *)tags {
+  if (cacheKey.length == 0 || tags.count == 0) {
+    return;
+  }
+  dispatch_sync(queue_, ^{
+    // A key is re-tagged each time the response is stored, drop the old tags first
+    [self unlinkKey:cacheKey];
+    for (NSString *tag in tags) {
+      [self linkKey:cacheKey tag:tag];
+    }
+    [self setNeedsSave];
+  });
+}
+
+- (void)invalidateTags:(NSArray *)tags {
+  if (tags.count == 0) {
+    return;
+  }
+  dispatch_sync(queue_, ^{
+    NSMutableSet *keys = [NSMutableSet new];
+    for (NSString *tag in tags) {
+      NSSet *tagged = keysByTag_[tag];
+      if (tagged != nil) {
+        [keys unionSet:tagged];
+      }
+    }
+    for (NSString *key in keys) {
+      [[EGOCache globalCache] removeCacheForKey:key];
+      [self unlinkKey:key];
+    }
+    if (keys.count > 0) {
+      [self setNeedsSave];
+    }
+  });
+}
+
+- (void)removeAllTags {
+  dispatch_sync(queue_, ^{
+    [keysByTag_ removeAllObjects];
+    [tagsByKey_ removeAllObjects];
+    [self setNeedsSave];
+  });
+}
+
+- (void)linkKey:(NSString *)key tag:(NSString *)tag {
+  NSMutableSet *keys = keysByTag_[tag];
+  if (keys == nil) {
+    keys = [NSMutableSet new];
+    keysByTag_[tag] = keys;
+  }
+  [keys addObject:key];
+
+  NSMutableSet *tags = tagsByKey_[key];
+  if (tags == nil) {
+    tags = [NSMutableSet new];
+    tagsByKey_[key] = tags;
+  }
+  [tags addObject:tag];
+}
+
+- (void)unlinkKey:(NSString *)key {
+  for (NSString *tag in tagsByKey_[key]) {
+    NSMutableSet *keys = keysByTag_[tag];
+    [keys removeObject:key];
+    if (keys.count == 0) {
+      [keysByTag_ removeObjectForKey:tag];
+    }
+  }
+  [tagsByKey_ removeObjectForKey:key];
+}
+
+// Coalesce writes, the index changes on every cached GET
+- (void)setNeedsSave {
+  if (needsSave_) return;
+  needsSave_ = YES;
+
+  double delayInSeconds = 0.5;
+  dispatch_time_t popTime = dispatch_time(DISPATCH_TIME_NOW, delayInSeconds * NSEC_PER_SEC);
+  dispatch_after(popTime, queue_, ^(void){
+    if (!needsSave_) return;
+    NSMutableDictionary *stored = [NSMutableDictionary new];
+    for (NSString *tag in keysByTag_) {
+      stored[tag] = [keysByTag_[tag] allObjects];
+    }
+    [[EGOCache globalCache] setPlist:stored
+                              forKey:kDKCacheIndexKey
+                 withTimeoutInterval:[[NSDate distantFuture] timeIntervalSinceNow]];
+    needsSave_ = NO;
+  });
+}
+
+@end
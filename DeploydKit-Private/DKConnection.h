@@ -0,0 +1,45 @@
+//
+//  DKConnection.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+/**
+ Sends a request synchronously through a delegate driven NSURLConnection, for transfers that need
+ progress reporting or a streamed body.
+
+ The timeout applies to inactivity, not to the whole transfer, so large files don't time out
+ while bytes keep moving. Successful response bodies can be written to a stream instead of
+ being buffered.
+ */
+@interface DKConnection : NSObject
+
+/**
+ Called on a private queue as the body is sent
+ */
+@property (nonatomic, copy) void (^uploadProgressBlock)(long long bytesSent, long long totalBytes);
+
+/**
+ Returns a new stream for the body, when the connection must send a streamed body again
+ */
+@property (nonatomic, copy) NSInputStream *(^bodyStreamBlock)(void);
+
+/**
+ Called on a private queue for 2xx responses, returns the unopened stream the body is written to,
+ or `nil` to buffer it
+ */
+@property (nonatomic, copy) NSOutputStream *(^outputStreamBlock)(NSHTTPURLResponse *response);
+
+/**
+ Called on a private queue as a body written to a stream is received, with the expected length
+ of the response body or -1
+ */
+@property (nonatomic, copy) void (^downloadProgressBlock)(long long bytesReceived, long long expectedBytes);
+
+- (id)initWithRequest:(NSURLRequest *)request;
+
+- (NSData *)sendSynchronousReturningResponse:(NSHTTPURLResponse **)response timeout:(NSTimeInterval)timeout error:(NSError **)error;
+
+@end
@@ -0,0 +1,169 @@
+//
+//  DKConnection.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConnection.h"
+#import "DKManager.h"
+
+@interface DKConnection () <NSURLConnectionDataDelegate>
+@property (nonatomic, copy) NSURLRequest *request;
+@end
+
+@implementation DKConnection {
+@private
+  dispatch_semaphore_t  activity_;
+  NSHTTPURLResponse    *response_;
+  NSMutableData        *data_;
+  NSError              *error_;
+  BOOL                  finished_;
+  NSOutputStream       *outputStream_;
+  long long             bytesReceived_;
+}
+
+- (id)initWithRequest:(NSURLRequest *)request {
+  self = [super init];
+  if (self) {
+    self.request = request;
+  }
+  return self;
+}
+
+- (NSData *)sendSynchronousReturningResponse:(NSHTTPURLResponse **)response timeout:(NSTimeInterval)timeout error:(NSError **)error {
+  // Minimum timeout like NSURLConnection+Timeout
+  timeout = MAX(5.0, timeout);
+
+  activity_ = dispatch_semaphore_create(0);
+  data_ = [NSMutableData new];
+
+  NSOperationQueue *delegateQueue = [NSOperationQueue new];
+  delegateQueue.maxConcurrentOperationCount = 1;
+  NSURLConnection *connection = [[NSURLConnection alloc] initWithRequest:self.request delegate:self startImmediately:NO];
+  [connection setDelegateQueue:delegateQueue];
+  [connection start];
+
+  // Each delegate callback signals activity, give up after a silent timeout
+  BOOL timedOut = NO;
+  while (!timedOut) {
+    timedOut = (dispatch_semaphore_wait(activity_, dispatch_time(DISPATCH_TIME_NOW, timeout * NSEC_PER_SEC)) != 0);
+    BOOL finished = NO;
+    @synchronized(self) {
+      finished = finished_;
+    }
+    if (finished) {
+      break;
+    }
+  }
+  if (timedOut) {
+    [connection cancel];
+  }
+  [delegateQueue waitUntilAllOperationsAreFinished];
+  [outputStream_ close];
+  outputStream_ = nil;
+  @synchronized(self) {
+    dispatch_release(activity_);
+    activity_ = NULL;
+  }
+
+  if (timedOut) {
+    if (error != NULL) {
+      NSDictionary *infoDict = @{NSLocalizedDescriptionKey: NSLocalizedString(@"Request timed out", nil)};
+      *error = [NSError errorWithDomain:NSCocoaErrorDomain code:0x100 userInfo:infoDict];
+    }
+    return nil;
+  }
+  if (error_ != nil) {
+    if ([DKManager requestLogEnabled]) {
+      NSLog(@"error: %@ (%ld)", error_.localizedDescription, (long)error_.code);
+    }
+    if (error != NULL) {
+      *error = error_;
+    }
+    return nil;
+  }
+  if (response != NULL) {
+    *response = response_;
+  }
+  return [NSData dataWithData:data_];
+}
+
+- (void)signalActivityFinished:(BOOL)finished {
+  @synchronized(self) {
+    finished_ = finished_ || finished;
+    if (activity_ != NULL) {
+      dispatch_semaphore_signal(activity_);
+    }
+  }
+}
+
+#pragma mark NSURLConnectionDataDelegate
+
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+  response_ = (NSHTTPURLResponse *)response;
+  [data_ setLength:0];
+  [outputStream_ close];
+  outputStream_ = nil;
+  bytesReceived_ = 0;
+  if (self.outputStreamBlock != NULL && response_.statusCode >= 200 && response_.statusCode < 300) {
+    outputStream_ = self.outputStreamBlock(response_);
+    [outputStream_ open];
+  }
+  [self signalActivityFinished:NO];
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+  if (outputStream_ == nil) {
+    [data_ appendData:data];
+    [self signalActivityFinished:NO];
+    return;
+  }
+
+  const uint8_t *bytes = data.bytes;
+  NSUInteger written = 0;
+  while (written < data.length) {
+    NSInteger result = [outputStream_ write:bytes + written maxLength:data.length - written];
+    if (result <= 0) {
+      // E.g. the disk is full, what was written is kept
+      [connection cancel];
+      error_ = (outputStream_.streamError != nil) ? outputStream_.streamError : [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:nil];
+      [self signalActivityFinished:YES];
+      return;
+    }
+    written += result;
+  }
+  bytesReceived_ += data.length;
+  if (self.downloadProgressBlock != NULL) {
+    self.downloadProgressBlock(bytesReceived_, response_.expectedContentLength);
+  }
+  [self signalActivityFinished:NO];
+}
+
+- (void)connection:(NSURLConnection *)connection didSendBodyData:(NSInteger)bytesWritten
+ totalBytesWritten:(NSInteger)totalBytesWritten totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite {
+  if (self.uploadProgressBlock != NULL) {
+    self.uploadProgressBlock(totalBytesWritten, totalBytesExpectedToWrite);
+  }
+  [self signalActivityFinished:NO];
+}
+
+- (NSInputStream *)connection:(NSURLConnection *)connection needNewBodyStream:(NSURLRequest *)request {
+  return (self.bodyStreamBlock != NULL) ? self.bodyStreamBlock() : nil;
+}
+
+- (NSCachedURLResponse *)connection:(NSURLConnection *)connection willCacheResponse:(NSCachedURLResponse *)cachedResponse {
+  return nil;
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+  [self signalActivityFinished:YES];
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+  error_ = error;
+  [self signalActivityFinished:YES];
+}
+
+@end
@@ -26,4 +26,11 @@
 @interface DKQuery (Private)
 - (NSMutableDictionary*)queryDictForKey:(NSString *)key;
 - (NSString *)makeRegexSafeString:(NSString *)string;
+- (NSMutableDictionary *)requestDict;
+- (NSMutableDictionary *)conditionsDict;
+- (NSArray *)entitiesFromResults:(NSArray *)results;
+- (id)boundaryValueForKey:(NSString *)key ascending:(BOOL)ascending error:(NSError **)error;
+- (NSArray *)partitionQueriesForKey:(NSString *)key count:(NSUInteger)count error:(NSError **)error;
+- (BOOL)runQueries:(NSArray *)queries maxConcurrent:(NSUInteger)maxConcurrent resultBlock:(void (^)(NSUInteger idx, NSArray *results))block error:(NSError **)error;
++ (NSComparator)comparatorForSort:(NSDictionary *)sort;
 @end
\ No newline at end of file
@@ -0,0 +1,25 @@
+//
+//  DKQueryEvaluator.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+/**
+ Evaluates a query request dict (the JSON sent to Deployd) against locally held objects,
+ following MongoDB's matching, sorting and projection semantics.
+ */
+@interface DKQueryEvaluator : NSObject
+@property (nonatomic, copy, readonly) NSDictionary *requestDict;
+
+- (id)initWithRequestDict:(NSDictionary *)requestDict;
+
+- (BOOL)matchesObject:(NSDictionary *)object error:(NSError **)error;
+- (NSArray *)evaluateObjects:(NSArray *)objects error:(NSError **)error;
+
++ (id)valueForKeyPath:(NSString *)keyPath inObject:(NSDictionary *)object;
++ (BOOL)getCoordinatesOfPoint:(id)point x:(double *)x y:(double *)y;
++ (NSString *)nearKeyInConditions:(NSDictionary *)conditions;
+
+@end
@@ -0,0 +1,408 @@
+//
+//  DKQueryEvaluator.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKQueryEvaluator.h"
+#import "DKQuery-Private.h"
+#import "NSError+DeploydKit.h"
+
+@interface DKQueryEvaluator ()
+@property (nonatomic, copy, readwrite) NSDictionary *requestDict;
+@end
+
+// Missing fields match null, array fields match any of their elements
+static BOOL DKValueEquals(id value, id operand) {
+  if (value == nil || value == [NSNull null]) {
+    return (operand == nil || operand == [NSNull null]);
+  }
+  if ([value isEqual:operand]) {
+    return YES;
+  }
+  if ([value isKindOfClass:[NSArray class]]) {
+    for (id element in value) {
+      if ([element isEqual:operand]) {
+        return YES;
+      }
+    }
+  }
+  return NO;
+}
+
+// Range operators only compare values of the same type
+static BOOL DKValueSatisfiesComparison(id value, id operand, NSString *op) {
+  if ([value isKindOfClass:[NSArray class]]) {
+    for (id element in value) {
+      if (DKValueSatisfiesComparison(element, operand, op)) {
+        return YES;
+      }
+    }
+    return NO;
+  }
+  BOOL numbers = ([value isKindOfClass:[NSNumber class]] && [operand isKindOfClass:[NSNumber class]]);
+  BOOL strings = ([value isKindOfClass:[NSString class]] && [operand isKindOfClass:[NSString class]]);
+  if (!numbers && !strings) {
+    return NO;
+  }
+  NSComparisonResult result = [value compare:operand];
+  if ([op isEqualToString:@"$lt"]) {
+    return (result == NSOrderedAscending);
+  }
+  else if ([op isEqualToString:@"$lte"]) {
+    return (result != NSOrderedDescending);
+  }
+  else if ([op isEqualToString:@"$gt"]) {
+    return (result == NSOrderedDescending);
+  }
+  return (result != NSOrderedAscending);
+}
+
+// Planar distance, like a MongoDB 2d index
+static double DKPointDistance(double x1, double y1, double x2, double y2) {
+  return sqrt((x1 - x2) * (x1 - x2) + (y1 - y2) * (y1 - y2));
+}
+
+@implementation DKQueryEvaluator {
+@private
+  NSMutableDictionary *regexCache_;
+}
+
++ (NSSet *)commandKeys {
+  static NSSet *keys;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    keys = [NSSet setWithObjects:@"$sort", @"$limit", @"$skip", @"$fields", @"$limitRecursion", nil];
+  });
+  return keys;
+}
+
++ (id)valueForKeyPath:(NSString *)keyPath inObject:(NSDictionary *)object {
+  id value = object;
+  for (NSString *key in [keyPath componentsSeparatedByString:@"."]) {
+    if (![value isKindOfClass:[NSDictionary class]]) {
+      return nil;
+    }
+    value = value[key];
+  }
+  return value;
+}
+
++ (BOOL)getCoordinatesOfPoint:(id)point x:(double *)x y:(double *)y {
+  if (![point isKindOfClass:[NSArray class]] || [point count] < 2 ||
+      ![point[0] isKindOfClass:[NSNumber class]] || ![point[1] isKindOfClass:[NSNumber class]]) {
+    return NO;
+  }
+  *x = [point[0] doubleValue];
+  *y = [point[1] doubleValue];
+  return YES;
+}
+
++ (NSString *)nearKeyInConditions:(NSDictionary *)conditions {
+  for (NSString *key in conditions) {
+    id condition = conditions[key];
+    if (![key hasPrefix:@"$"] && [condition isKindOfClass:[NSDictionary class]] && condition[@"$near"] != nil) {
+      return key;
+    }
+  }
+  return nil;
+}
+
+- (id)initWithRequestDict:(NSDictionary *)requestDict {
+  self = [super init];
+  if (self) {
+    self.requestDict = (requestDict != nil) ? requestDict : @{};
+    regexCache_ = [NSMutableDictionary new];
+  }
+  return self;
+}
+
+- (BOOL)matchesObject:(NSDictionary *)object error:(NSError **)error {
+  NSError *matchError = nil;
+  BOOL matches = [self object:object matchesConditions:self.requestDict error:&matchError];
+  if (matchError != nil) {
+    if (error != NULL) {
+      *error = matchError;
+    }
+    return NO;
+  }
+  return matches;
+}
+
+- (NSArray *)evaluateObjects:(NSArray *)objects error:(NSError **)error {
+  NSMutableArray *results = [NSMutableArray new];
+  for (NSDictionary *object in objects) {
+    NSError *matchError = nil;
+    BOOL matches = [self object:object matchesConditions:self.requestDict error:&matchError];
+    if (matchError != nil) {
+      if (error != NULL) {
+        *error = matchError;
+      }
+      return nil;
+    }
+    if (matches) {
+      [results addObject:object];
+    }
+  }
+
+  // Sort, $near results are ordered by distance unless sorted explicitly
+  NSDictionary *sort = self.requestDict[@"$sort"];
+  NSString *nearKey = [isa nearKeyInConditions:self.requestDict];
+  if (sort.count > 0) {
+    [results sortWithOptions:NSSortStable usingComparator:[DKQuery comparatorForSort:sort]];
+  }
+  else if (nearKey != nil) {
+    double x = 0, y = 0;
+    [isa getCoordinatesOfPoint:self.requestDict[nearKey][@"$near"] x:&x y:&y];
+    [results sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(id obj1, id obj2) {
+      double px = 0, py = 0;
+      double d1 = [isa getCoordinatesOfPoint:[isa valueForKeyPath:nearKey inObject:obj1] x:&px y:&py] ? DKPointDistance(x, y, px, py) : HUGE_VAL;
+      double d2 = [isa getCoordinatesOfPoint:[isa valueForKeyPath:nearKey inObject:obj2] x:&px y:&py] ? DKPointDistance(x, y, px, py) : HUGE_VAL;
+      return (d1 < d2) ? NSOrderedAscending : ((d1 > d2) ? NSOrderedDescending : NSOrderedSame);
+    }];
+  }
+
+  // Skip and limit
+  NSUInteger skip = MIN([self.requestDict[@"$skip"] unsignedIntegerValue], results.count);
+  NSUInteger limit = [self.requestDict[@"$limit"] unsignedIntegerValue];
+  NSUInteger length = results.count - skip;
+  if (limit > 0) {
+    length = MIN(length, limit);
+  }
+  NSArray *page = [results subarrayWithRange:NSMakeRange(skip, length)];
+
+  // Project fields
+  NSDictionary *fields = self.requestDict[@"$fields"];
+  if (fields.count == 0) {
+    return page;
+  }
+  BOOL include = NO;
+  for (NSNumber *flag in [fields allValues]) {
+    include |= [flag boolValue];
+  }
+  NSMutableArray *projected = [NSMutableArray new];
+  for (NSDictionary *object in page) {
+    NSMutableDictionary *fieldObject = nil;
+    if (include) {
+      fieldObject = [NSMutableDictionary new];
+      for (NSString *key in object) {
+        if ([key isEqualToString:kDKEntityIDField] || [fields[key] boolValue]) {
+          fieldObject[key] = object[key];
+        }
+      }
+    }
+    else {
+      fieldObject = [object mutableCopy];
+      [fieldObject removeObjectsForKeys:[fields allKeys]];
+    }
+    [projected addObject:fieldObject];
+  }
+  return [NSArray arrayWithArray:projected];
+}
+
+- (BOOL)object:(NSDictionary *)object matchesConditions:(NSDictionary *)conditions error:(NSError **)error {
+  // Errors are read from a local, callers may not pass an error pointer
+  NSError *matchError = nil;
+  for (NSString *key in conditions) {
+    id condition = conditions[key];
+    BOOL matches = YES;
+    if ([key isEqualToString:@"$or"]) {
+      matches = NO;
+      for (NSDictionary *subconditions in condition) {
+        if ([self object:object matchesConditions:subconditions error:&matchError] || matchError != nil) {
+          matches = (matchError == nil);
+          break;
+        }
+      }
+    }
+    else if ([key isEqualToString:@"$and"]) {
+      for (NSDictionary *subconditions in condition) {
+        if (![self object:object matchesConditions:subconditions error:&matchError]) {
+          matches = NO;
+          break;
+        }
+      }
+    }
+    else if ([key hasPrefix:@"$"]) {
+      if (![[isa commandKeys] containsObject:key]) {
+        [NSError writeToError:error
+                         code:DKErrorInvalidParams
+                  description:[NSString stringWithFormat:NSLocalizedString(@"Query command '%@' cannot be evaluated locally", nil), key]
+                     original:nil];
+        return NO;
+      }
+      continue;
+    }
+    else {
+      id value = [isa valueForKeyPath:key inObject:object];
+      matches = [self value:value matchesCondition:condition error:&matchError];
+    }
+    if (matchError != nil) {
+      if (error != NULL) {
+        *error = matchError;
+      }
+      return NO;
+    }
+    if (!matches) {
+      return NO;
+    }
+  }
+  return YES;
+}
+
+- (BOOL)value:(id)value matchesCondition:(id)condition error:(NSError **)error {
+  // Plain values and embedded objects test for equality
+  if (![condition isKindOfClass:[NSDictionary class]] || ![[[condition allKeys] lastObject] hasPrefix:@"$"]) {
+    return DKValueEquals(value, condition);
+  }
+
+  for (NSString *op in condition) {
+    id operand = condition[op];
+    BOOL matches = YES;
+    if ([op isEqualToString:@"$lt"] || [op isEqualToString:@"$lte"] ||
+        [op isEqualToString:@"$gt"] || [op isEqualToString:@"$gte"]) {
+      matches = DKValueSatisfiesComparison(value, operand, op);
+    }
+    else if ([op isEqualToString:@"$ne"]) {
+      matches = !DKValueEquals(value, operand);
+    }
+    else if ([op isEqualToString:@"$in"] || [op isEqualToString:@"$nin"]) {
+      BOOL contained = NO;
+      for (id element in operand) {
+        if (DKValueEquals(value, element)) {
+          contained = YES;
+          break;
+        }
+      }
+      matches = ([op isEqualToString:@"$in"] ? contained : !contained);
+    }
+    else if ([op isEqualToString:@"$all"]) {
+      matches = ([operand count] > 0);
+      for (id element in operand) {
+        if (!DKValueEquals(value, element)) {
+          matches = NO;
+          break;
+        }
+      }
+    }
+    else if ([op isEqualToString:@"$exists"]) {
+      matches = ((value != nil) == [operand boolValue]);
+    }
+    else if ([op isEqualToString:@"$regex"]) {
+      NSRegularExpression *regex = [self regexWithPattern:operand options:condition[@"$options"] error:error];
+      matches = (regex != nil && [self value:value matchesRegex:regex]);
+    }
+    else if ([op isEqualToString:@"$options"] || [op isEqualToString:@"$maxDistance"]) {
+      continue;
+    }
+    else if ([op isEqualToString:@"$near"]) {
+      double x = 0, y = 0, px = 0, py = 0;
+      if (![isa getCoordinatesOfPoint:operand x:&x y:&y]) {
+        [NSError writeToError:error
+                         code:DKErrorInvalidParams
+                  description:NSLocalizedString(@"$near requires an [x, y] point", nil)
+                     original:nil];
+        return NO;
+      }
+      id maxDistance = condition[@"$maxDistance"];
+      matches = ([isa getCoordinatesOfPoint:value x:&px y:&py] &&
+                 (maxDistance == nil || DKPointDistance(x, y, px, py) <= [maxDistance doubleValue]));
+    }
+    else if ([op isEqualToString:@"$within"]) {
+      NSError *shapeError = nil;
+      matches = [self value:value isWithinShape:operand error:&shapeError];
+      if (shapeError != nil) {
+        if (error != NULL) {
+          *error = shapeError;
+        }
+        return NO;
+      }
+    }
+    else {
+      [NSError writeToError:error
+                       code:DKErrorInvalidParams
+                description:[NSString stringWithFormat:NSLocalizedString(@"Query operator '%@' cannot be evaluated locally", nil), op]
+                   original:nil];
+      return NO;
+    }
+    if (!matches) {
+      return NO;
+    }
+  }
+  return YES;
+}
+
+- (BOOL)value:(id)value isWithinShape:(NSDictionary *)shape error:(NSError **)error {
+  double px = 0, py = 0;
+  BOOL isPoint = [isa getCoordinatesOfPoint:value x:&px y:&py];
+  id box = [shape isKindOfClass:[NSDictionary class]] ? shape[@"$box"] : nil;
+  id center = [shape isKindOfClass:[NSDictionary class]] ? shape[@"$center"] : nil;
+  double x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+  
+  if ([box isKindOfClass:[NSArray class]] && [box count] == 2 &&
+      [isa getCoordinatesOfPoint:box[0] x:&x1 y:&y1] && [isa getCoordinatesOfPoint:box[1] x:&x2 y:&y2]) {
+    return (isPoint && px >= MIN(x1, x2) && px <= MAX(x1, x2) && py >= MIN(y1, y2) && py <= MAX(y1, y2));
+  }
+  if ([center isKindOfClass:[NSArray class]] && [center count] == 2 &&
+      [isa getCoordinatesOfPoint:center[0] x:&x1 y:&y1] && [center[1] isKindOfClass:[NSNumber class]]) {
+    return (isPoint && DKPointDistance(x1, y1, px, py) <= [center[1] doubleValue]);
+  }
+  [NSError writeToError:error
+                   code:DKErrorInvalidParams
+            description:NSLocalizedString(@"$within requires a $box or $center shape", nil)
+               original:nil];
+  return NO;
+}
+
+- (BOOL)value:(id)value matchesRegex:(NSRegularExpression *)regex {
+  if ([value isKindOfClass:[NSArray class]]) {
+    for (id element in value) {
+      if ([self value:element matchesRegex:regex]) {
+        return YES;
+      }
+    }
+    return NO;
+  }
+  if (![value isKindOfClass:[NSString class]]) {
+    return NO;
+  }
+  return ([regex firstMatchInString:value options:0 range:NSMakeRange(0, [value length])] != nil);
+}
+
+- (NSRegularExpression *)regexWithPattern:(NSString *)pattern options:(NSString *)optionString error:(NSError **)error {
+  NSString *cacheKey = [NSString stringWithFormat:@"/%@/%@", pattern, (optionString != nil) ? optionString : @""];
+  NSRegularExpression *regex = regexCache_[cacheKey];
+  if (regex != nil) {
+    return regex;
+  }
+
+  NSRegularExpressionOptions options = 0;
+  if ([optionString rangeOfString:@"i"].location != NSNotFound) {
+    options |= NSRegularExpressionCaseInsensitive;
+  }
+  if ([optionString rangeOfString:@"m"].location != NSNotFound) {
+    options |= NSRegularExpressionAnchorsMatchLines;
+  }
+  if ([optionString rangeOfString:@"s"].location != NSNotFound) {
+    options |= NSRegularExpressionDotMatchesLineSeparators;
+  }
+  if ([optionString rangeOfString:@"x"].location != NSNotFound) {
+    options |= NSRegularExpressionAllowCommentsAndWhitespace;
+  }
+
+  NSError *regexError = nil;
+  regex = [NSRegularExpression regularExpressionWithPattern:pattern options:options error:&regexError];
+  if (regexError != nil) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidParams
+              description:[NSString stringWithFormat:NSLocalizedString(@"Invalid regular expression '%@'", nil), pattern]
+                 original:regexError];
+    return nil;
+  }
+  regexCache_[cacheKey] = regex;
+  return regex;
+}
+
+@end
@@ -33,8 +33,11 @@ typedef NSInteger DKResponseStatus;
 - (id)sendRequestWithMethod:(NSString *)apiMethod entity:(NSString *)entityName error:(NSError **)error;
 - (id)sendRequestWithObject:(id)JSONObject method:(NSString *)apiMethod entity:(NSString *)entityName error:(NSError **)error;
 - (id)sendRequestWithData:(NSData *)data method:(NSString *)apiMethod entity:(NSString *)entityName error:(NSError **)error;
+- (id)sendRequestWithEncodedQuery:(NSString *)encodedQuery entity:(NSString *)entityName error:(NSError **)error;
 
 - (BOOL)hasCachedResult;
+- (id)cachedResultForEntity:(NSString *)entityName error:(NSError **)error;
+- (NSString *)md5:(NSString *)str;
 @end
 
 @interface DKRequest (Wrapping)
@@ -45,6 +48,12 @@ typedef NSInteger DKResponseStatus;
 
 @end
 
+@interface DKRequest (Caching)
+
++ (NSArray *)cacheTagsForResource:(NSString *)resourcePath method:(NSString *)apiMethod result:(id)resultObj;
+
+@end
+
 @interface DKRequest (Logging)
 
 + (void)logData:(NSData *)data isOut:(BOOL)isOut isCached:(BOOL)isCached;
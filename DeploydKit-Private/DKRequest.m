@@ -14,11 +14,17 @@
 #import "DKManager.h"
 #import "DKNetworkActivity.h"
 #import "EGOCache.h"
+#import "DKCacheIndex.h"
+#import "DKBinaryCoder.h"
 #import <CommonCrypto/CommonDigest.h>
 
 @interface DKRequest ()
     @property (nonatomic, copy, readwrite) NSString *endpoint;
     @property (nonatomic, copy, readwrite) NSString* keyCache;
+    - (id)sendRequestWithURL:(NSURL *)URL data:(NSData *)bodyData method:(NSString *)apiMethod
+                    resource:(NSString *)resourcePath cacheKey:(NSString *)cacheKey error:(NSError **)error;
+    - (BOOL)shouldPostQueryWithURLLength:(NSUInteger)length resource:(NSString *)resourcePath;
+    - (NSURL *)queryPostURLForResource:(NSString *)resourcePath;
 @end
 
 // DEVNOTE: Allow untrusted certs in debug version.
@@ -78,6 +84,7 @@
 
 - (id)sendRequestWithData:(NSData *)bodyData method:(NSString *)apiMethod
                    entity:(NSString *)entityName error:(NSError **)error {
+  NSString *resourcePath = entityName;
     
   //Append json to url
   if([apiMethod isEqualToString:@"query"] && bodyData && bodyData.length > 2){
@@ -91,9 +98,49 @@
         entityName = queryParams;
   }    
   NSString* urlString = [self.endpoint stringByAppendingString:entityName];
+  NSURL *URL = [NSURL URLWithString:[urlString stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]];
+    
+  // Long queries are sent as a JSON body, cached under the key of the URL query
+  if ([apiMethod isEqualToString:@"query"] && bodyData.length > 2 && [self shouldPostQueryWithURLLength:URL.absoluteString.length resource:resourcePath]) {
+    return [self sendRequestWithURL:[self queryPostURLForResource:resourcePath] data:bodyData method:@"querypost" resource:resourcePath cacheKey:[self md5:entityName] error:error];
+  }
+    
+  return [self sendRequestWithURL:URL data:bodyData method:apiMethod resource:resourcePath cacheKey:[self md5:entityName] error:error];
+}
+
+- (id)sendRequestWithEncodedQuery:(NSString *)encodedQuery entity:(NSString *)entityName error:(NSError **)error {
+  // The query is already JSON encoded and percent escaped
+  NSString *cacheResource = entityName;
+  NSMutableString *urlString = [NSMutableString stringWithString:self.endpoint];
+  [urlString appendString:entityName];
+  if (encodedQuery.length > 0) {
+    [urlString appendString:@"?"];
+    [urlString appendString:encodedQuery];
+    cacheResource = [NSString stringWithFormat:@"%@?%@", entityName, [encodedQuery stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding]];
     
+    // Long queries are sent as a JSON body, cached under the key of the URL query
+    if ([self shouldPostQueryWithURLLength:urlString.length resource:entityName]) {
+      NSData *bodyData = [[encodedQuery stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding] dataUsingEncoding:NSUTF8StringEncoding];
+      return [self sendRequestWithURL:[self queryPostURLForResource:entityName] data:bodyData method:@"querypost" resource:entityName cacheKey:[self md5:cacheResource] error:error];
+    }
+  }
+  
+  return [self sendRequestWithURL:[NSURL URLWithString:urlString] data:nil method:@"query" resource:entityName cacheKey:[self md5:cacheResource] error:error];
+}
+
+- (BOOL)shouldPostQueryWithURLLength:(NSUInteger)length resource:(NSString *)resourcePath {
+  NSUInteger threshold = [DKManager queryPOSTThreshold];
+  return (threshold > 0 && length > threshold && [resourcePath rangeOfString:@"?"].location == NSNotFound);
+}
+
+- (NSURL *)queryPostURLForResource:(NSString *)resourcePath {
+  NSString *urlString = [NSString stringWithFormat:@"%@%@/%@", self.endpoint, kDKRequestQueryPost, resourcePath];
+  return [NSURL URLWithString:[urlString stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]];
+}
+
+- (id)sendRequestWithURL:(NSURL *)URL data:(NSData *)bodyData method:(NSString *)apiMethod
+                resource:(NSString *)resourcePath cacheKey:(NSString *)cacheKey error:(NSError **)error {
   // Create url request
-  NSURL *URL = [NSURL URLWithString:[urlString stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]];
   NSMutableURLRequest *req = [NSMutableURLRequest requestWithURL:URL];
   req.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
   
@@ -101,10 +148,13 @@
   // https://devforums.apple.com/thread/25282
   req.timeoutInterval = 20.0;
   req.HTTPMethod = [self httpMethod:apiMethod];
+  
+  // Queries posted as a JSON body are cached like GET queries
+  BOOL cacheable = ([req.HTTPMethod isEqualToString:@"GET"] || [apiMethod isEqualToString:@"querypost"]);
     
   // Log request
   if ([DKManager requestLogEnabled]) {
-      NSLog(@"[URL] %@", urlString);
+      NSLog(@"[URL] %@", [URL.absoluteString stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding]);
   }
     
   if([req.HTTPMethod isEqualToString:@"POST"] || [req.HTTPMethod isEqualToString:@"PUT"]){
@@ -140,8 +190,8 @@
         result = [self sendSynchronousRequest:req returningResponse:&response error:&requestError];
         break;
     case DKCachePolicyUseCacheElseLoad:
-        if([req.HTTPMethod isEqualToString:@"GET"]){
-            result = [[EGOCache globalCache] dataForKey:self.keyCache?self.keyCache:[self md5:entityName]];
+        if(cacheable){
+            result = [[EGOCache globalCache] dataForKey:self.keyCache?self.keyCache:cacheKey];
             loadFromCache = YES;
         }
         if(!result){
@@ -150,8 +200,8 @@
         }
         break;
     case DKCachePolicyUseCacheIfOffline:
-        if(![DKManager endpointReachable] && [req.HTTPMethod isEqualToString:@"GET"]){
-            result = [[EGOCache globalCache] dataForKey:self.keyCache?self.keyCache:[self md5:entityName]];
+        if(![DKManager endpointReachable] && cacheable){
+            result = [[EGOCache globalCache] dataForKey:self.keyCache?self.keyCache:cacheKey];
             loadFromCache = YES;
         }else{
             result = [self sendSynchronousRequest:req returningResponse:&response error:&requestError];
@@ -167,12 +217,28 @@
     return nil;
   }
   
-  if([req.HTTPMethod isEqualToString:@"GET"] && !loadFromCache) {
-     self.keyCache = [self md5:entityName];
-     [[EGOCache globalCache] setData:result forKey:self.keyCache withTimeoutInterval:self.maxCacheAge];
+  NSError *responseError = nil;
+  id resultObj = [isa parseResponse:response withData:result error:&responseError isCached:loadFromCache];
+  if (responseError != nil) {
+    if (error != nil) {
+      *error = responseError;
+    }
+    return nil;
   }
     
-  return [isa parseResponse:response withData:result error:error isCached:loadFromCache];
+  if(cacheable && !loadFromCache) {
+     self.keyCache = cacheKey;
+     // Cache the decoded result in binary form, cache hits skip JSON parsing and unwrapping
+     NSData *cacheData = [DKBinaryCoder dataWithJSONObject:resultObj];
+     [[EGOCache globalCache] setData:(cacheData != nil ? cacheData : result) forKey:self.keyCache withTimeoutInterval:self.maxCacheAge];
+     [[DKCacheIndex sharedIndex] addCacheKey:self.keyCache
+                                     forTags:[isa cacheTagsForResource:resourcePath method:apiMethod result:resultObj]];
+  }
+  else if([apiMethod isEqualToString:@"save"] || [apiMethod isEqualToString:@"update"] || [apiMethod isEqualToString:@"delete"]) {
+     [[DKCacheIndex sharedIndex] invalidateTags:[isa cacheTagsForResource:resourcePath method:apiMethod result:resultObj]];
+  }
+    
+  return resultObj;
 }
 
 - (NSData *)sendSynchronousRequest:(NSURLRequest *)request returningResponse:(NSURLResponse **)response error:(NSError **)error {
@@ -191,6 +257,13 @@
     return [[EGOCache globalCache] hasCacheForKey:self.keyCache];
 }
 
+- (id)cachedResultForEntity:(NSString *)entityName error:(NSError **)error {
+    self.keyCache = [self md5:entityName];
+    NSData *result = [[EGOCache globalCache] dataForKey:self.keyCache];
+    if(!result) return nil;
+    return [isa parseResponse:nil withData:result error:error isCached:YES];
+}
+
 + (BOOL)canParseResponse:(NSHTTPURLResponse *)response {
   NSInteger code = response.statusCode;
   return (code == 200 || code == 204 || code == 400);
@@ -207,7 +280,11 @@
     // Log response
       [self logData:data isOut:NO isCached:isCached];
     
-    if (isCached || response.statusCode == DKResponseStatusSuccess) {
+    if (isCached && [DKBinaryCoder isEncodedData:data]) {
+      // Encoded results are stored unwrapped
+      return [DKBinaryCoder JSONObjectWithData:data error:error];
+    }
+    else if (isCached || response.statusCode == DKResponseStatusSuccess) {
       id resultObj = nil;
       NSError *JSONError = nil;
       
@@ -251,7 +328,9 @@
 
 -(NSString*)httpMethod:(NSString*)op{
     if([op isEqualToString:@"save"] || [op isEqualToString:@"login"] ||
-       [op isEqualToString:@"logout"] || [op isEqualToString:@"apn"]) return @"POST";
+       [op isEqualToString:@"logout"] || [op isEqualToString:@"apn"] ||
+       [op isEqualToString:@"batch"] || [op isEqualToString:@"querypost"] ||
+       [op isEqualToString:@"aggregate"]) return @"POST";
     if([op isEqualToString:@"update"]) return @"PUT";
     if([op isEqualToString:@"delete"]) return @"DELETE";
     return @"GET"; //refresh/query/me
@@ -309,11 +388,54 @@
 
 @end
 
+@implementation DKRequest (Caching)
+
++ (NSArray *)cacheTagsForResource:(NSString *)resourcePath method:(NSString *)apiMethod result:(id)resultObj {
+  NSArray *components = [resourcePath pathComponents];
+  if (components.count == 0) {
+    return @[];
+  }
+  NSString *entityName = components[0];
+  NSMutableArray *tags = [NSMutableArray new];
+  
+  // Queries and writes touch the whole collection, a write may change the membership of any query
+  if ([apiMethod isEqualToString:@"query"] || [apiMethod isEqualToString:@"querypost"] || [apiMethod isEqualToString:@"save"] ||
+      [apiMethod isEqualToString:@"update"] || [apiMethod isEqualToString:@"delete"]) {
+    [tags addObject:[DKCacheIndex tagForEntityName:entityName]];
+  }
+  
+  // Tag every entity contained in the response, or addressed by the resource path
+  NSMutableSet *entityIds = [NSMutableSet new];
+  if (components.count > 1 && ([apiMethod isEqualToString:@"update"] || [apiMethod isEqualToString:@"delete"])) {
+    [entityIds addObject:components[1]];
+  }
+  NSArray *objects = [resultObj isKindOfClass:[NSArray class]] ? resultObj : (resultObj ? @[resultObj] : @[]);
+  for (NSDictionary *objDict in objects) {
+    if ([objDict isKindOfClass:[NSDictionary class]]) {
+      NSString *entityId = objDict[kDKEntityIDField];
+      if ([entityId isKindOfClass:[NSString class]]) {
+        [entityIds addObject:entityId];
+      }
+    }
+  }
+  for (NSString *entityId in entityIds) {
+    [tags addObject:[DKCacheIndex tagForEntityName:entityName entityId:entityId]];
+  }
+  
+  return tags;
+}
+
+@end
+
 @implementation DKRequest (Logging)
 
 + (void)logData:(NSData *)data isOut:(BOOL)isOut isCached:(BOOL)isCached{
   if ([DKManager requestLogEnabled]) {
-    if (data.length > 0) {
+    if ([DKBinaryCoder isEncodedData:data]) {
+      NSLog(@"[%@%@] %lu bytes encoded",
+            (isOut ? @"OUT" : @"IN"),(isCached ? @" CACHE" : @""), (unsigned long)data.length);
+    }
+    else if (data.length > 0) {
       NSData *logData = data;
       if (data.length > 1000) {
         logData = [data subdataWithRange:NSMakeRange(0, 1000)];
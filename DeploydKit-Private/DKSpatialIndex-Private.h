@@ -0,0 +1,18 @@
+//
+//  DKSpatialIndex-Private.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKSpatialIndex.h"
+
+@interface DKSpatialIndex (Private)
++ (void)updateIndexesWithEntities:(NSArray *)entities entityName:(NSString *)entityName;
++ (void)removeEntityId:(NSString *)entityId fromIndexesWithEntityName:(NSString *)entityName;
+- (NSArray *)objectsNearPoint:(NSArray *)point maxDistance:(double)maxDistance limit:(NSUInteger)limit;
+- (NSArray *)objectsWithinBoxFrom:(NSArray *)lowerLeft to:(NSArray *)upperRight;
+- (NSArray *)candidateObjectsForCondition:(id)condition limit:(NSUInteger)limit;
+- (NSArray *)allObjects;
+@end
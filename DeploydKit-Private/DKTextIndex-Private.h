@@ -0,0 +1,17 @@
+//
+//  DKTextIndex-Private.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKTextIndex.h"
+
+@interface DKTextIndex (Private)
++ (void)updateIndexesWithEntities:(NSArray *)entities entityName:(NSString *)entityName;
++ (void)removeEntityId:(NSString *)entityId fromIndexesWithEntityName:(NSString *)entityName;
++ (void)invalidateIndexesWithEntityName:(NSString *)entityName;
+- (NSArray *)candidateObjectsForConditions:(NSDictionary *)conditions;
+- (NSArray *)allObjects;
+@end
@@ -22,10 +22,20 @@
 /*!
  Gets the currently channel 
 
+ Returns immediately with the channel saved last on this device, the server copy is read in the
+ background and only the attributes that changed since the last save are sent on the next save.
+ A synchronous save waits for the server copy to be read.
+
  @result Returns a DKChannel that represents the currently installation.
  */
 + (DKChannel *)currentChannel;
 
+/*!
+ Gets the currently channel once the server copy is read
+ @param block The result callback, error is set if the server couldn't be reached
+ */
++ (void)currentChannelInBackgroundWithBlock:(void (^)(DKChannel *channel, NSError *error))block;
+
 /*! @name Configuring a Push Notification */
 
 /*!
@@ -16,66 +16,202 @@ static NSString * AFNormalizedDeviceTokenStringWithDeviceToken(id deviceToken) {
     return [[[[deviceToken description] uppercaseString] stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"<>"]] stringByReplacingOccurrencesOfString:@" " withString:@""];
 }
 
+#define kDKChannelStateKeyFormat @"DeploydKit.channel.%@"
+
 @implementation DKChannel
 
 static DKChannel* currentChannel = nil;
+static dispatch_group_t bootstrapGroup = NULL;
+static BOOL channelReconciled = NO;
 
 +(DKChannel *)currentChannel{
-    if(currentChannel)
-        return currentChannel;
-    
-    currentChannel = [[self alloc] initWithName:kDKEntityChannel];
+    @synchronized(self){
+        if(currentChannel)
+            return currentChannel;
+        
+        currentChannel = [[self alloc] initWithName:kDKEntityChannel];
+        
+        // The channel saved last is used right away, the server copy is read in the background
+        NSDictionary *state = [self persistedState];
+        if(state){
+            currentChannel.resultMap = state;
+        }
+        [currentChannel setDeviceAttributes];
+        
+        DKChannel *channel = currentChannel;
+        bootstrapGroup = dispatch_group_create();
+        dispatch_group_async(bootstrapGroup, [DKManager queue], ^{
+            channelReconciled = [channel reconcileWithServer:NULL];
+        });
         
-    NSString *identifier = [SecureUDID UDIDForDomain:[DKManager APIEndpoint] usingKey:[DKManager APISecret]];
-    DKQuery* query = [DKQuery queryWithEntityName:kDKEntityChannel];
-    [query whereKey:kDKEntityChannelUDID equalTo:identifier];
-    NSError* error = nil;
-    NSArray* results = [query findAll:&error];
-    if(!error && results.count > 0){
-        DKEntity *channel = [results lastObject];
-        currentChannel.resultMap = channel.resultMap;
+        return currentChannel;
+    }
+}
+
++ (void)currentChannelInBackgroundWithBlock:(void (^)(DKChannel *channel, NSError *error))block{
+    block = [block copy];
+    DKChannel *channel = [self currentChannel];
+    dispatch_queue_t q = dispatch_get_current_queue();
+    // Runs after the bootstrap, a failed reconciliation is tried again
+    dispatch_async([DKManager queue], ^{
+        NSError *error = nil;
+        if(!channelReconciled){
+            channelReconciled = [channel reconcileWithServer:&error];
+        }
+        if (block != NULL) {
+            dispatch_async(q, ^{
+                block(channel, error);
+            });
+        }
+    });
+}
+
++ (NSString *)stateKey{
+    return [NSString stringWithFormat:kDKChannelStateKeyFormat, [DKManager APIEndpoint]];
+}
+
++ (NSDictionary *)persistedState{
+    NSData *data = [[NSUserDefaults standardUserDefaults] dataForKey:[self stateKey]];
+    id state = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:NULL] : nil;
+    return [state isKindOfClass:[NSDictionary class]] ? state : nil;
+}
+
++ (void)persistState:(NSDictionary *)state{
+    // Stored as JSON, user defaults don't take null values
+    NSData *data = [NSJSONSerialization isValidJSONObject:state] ? [NSJSONSerialization dataWithJSONObject:state options:0 error:NULL] : nil;
+    if(data){
+        [[NSUserDefaults standardUserDefaults] setObject:data forKey:[self stateKey]];
+    }
+}
+
+- (void)setObjectIfChanged:(id)object forKey:(NSString *)key{
+    // Values already sent aren't sent again
+    if(object && ![[self objectForKey:key] isEqual:object]){
+        [self setObject:object forKey:key];
+    }
+}
+
+- (NSString *)deviceIdentifier{
+    NSString *identifier = [self objectForKey:kDKEntityChannelUDID];
+    if(!identifier){
+        identifier = [SecureUDID UDIDForDomain:[DKManager APIEndpoint] usingKey:[DKManager APISecret]];
     }
-    else{
-        [currentChannel setObject:identifier forKey:kDKEntityChannelUDID];
-    }    
+    return identifier;
+}
 
+- (void)setDeviceAttributes{
+    // Sent with the first save, also when the channel is created before reaching the server
+    [self setObjectIfChanged:[self deviceIdentifier] forKey:kDKEntityChannelUDID];
     NSString * appVersion = [[NSBundle mainBundle] infoDictionary][@"CFBundleVersion"];
-    [currentChannel setObject:appVersion forKey:kDKEntityChannelAppVersion];
+    [self setObjectIfChanged:appVersion forKey:kDKEntityChannelAppVersion];
     //NSString * appName = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleDisplayName"];
     NSString * timeZone = [[NSTimeZone systemTimeZone] name]; //[[NSTimeZone defaultTimeZone] name];
-    [currentChannel setObject:timeZone forKey:kDKEntityChannelTimeZone];
+    [self setObjectIfChanged:timeZone forKey:kDKEntityChannelTimeZone];
     NSString * currentLocale = [[NSLocale currentLocale] identifier];
-    [currentChannel setObject:currentLocale forKey:kDKEntityChannelLocale];
+    [self setObjectIfChanged:currentLocale forKey:kDKEntityChannelLocale];
     NSString * preferredLanguage = [NSLocale preferredLanguages][0];
-    [currentChannel setObject:preferredLanguage forKey:kDKEntityChannelLanguage];
+    [self setObjectIfChanged:preferredLanguage forKey:kDKEntityChannelLanguage];
     NSString * deviceModel = [[UIDevice currentDevice] model];
-    [currentChannel setObject:deviceModel forKey:kDKEntityChannelDeviceModel];
+    [self setObjectIfChanged:deviceModel forKey:kDKEntityChannelDeviceModel];
     NSString * deviceSystem = [NSString stringWithFormat:@"%@ %@", [[UIDevice currentDevice] systemName], [[UIDevice currentDevice] systemVersion]];
-    [currentChannel setObject:deviceSystem forKey:kDKEntityChannelDeviceSystem];
+    [self setObjectIfChanged:deviceSystem forKey:kDKEntityChannelDeviceSystem];
     NSNumber * badge = @([UIApplication sharedApplication].applicationIconBadgeNumber);
-    [currentChannel setObject:badge forKey:kDKEntityChannelBadge];
+    [self setObjectIfChanged:badge forKey:kDKEntityChannelBadge];
     
     #ifdef __CORELOCATION__
         CLLocation *location = [[[self class] sharedLocationManager] location];
         if (location) {
             NSArray* loc = [NSArray arrayWithObjects: [NSNumber numberWithDouble:location.coordinate.longitude],
                                                       [NSNumber numberWithDouble:location.coordinate.latitude], nil];
-            [currentChannel setObject:loc forKey:kDKEntityChannelLocation];
+            [self setObjectIfChanged:loc forKey:kDKEntityChannelLocation];
         }
     #endif
+}
+
+- (BOOL)reconcileWithServer:(NSError **)error{
+    NSDictionary *serverMap = nil;
+    NSError *requestError = nil;
+    NSString *identifier = nil;
     
-    return currentChannel;
+    if(self.entityId.length > 0){
+        DKRequest *request = [DKRequest request];
+        request.cachePolicy = DKCachePolicyIgnoreCache;
+        serverMap = [request sendRequestWithObject:@{} method:@"refresh" entity:[self.entityName stringByAppendingPathComponent:self.entityId] error:&requestError];
+        if(requestError.code == DKErrorUnknownStatus){
+            // Not found by ID, looked up by UDID like on first launch
+            serverMap = nil;
+            requestError = nil;
+        }
+    }
+    if(!serverMap && !requestError){
+        // The channel may exist from a previous installation
+        identifier = [self deviceIdentifier];
+        DKQuery* query = [DKQuery queryWithEntityName:kDKEntityChannel];
+        [query whereKey:kDKEntityChannelUDID equalTo:identifier];
+        NSArray* results = [query findAll:&requestError];
+        if(!requestError){
+            serverMap = (results.count > 0) ? [[results lastObject] resultMap] : @{};
+        }
+    }
+    
+    // Offline, the local copy stays in use
+    if(requestError || ![serverMap isKindOfClass:[NSDictionary class]]){
+        if(error != NULL){
+            *error = requestError;
+        }
+        return NO;
+    }
+    
+    @synchronized(self){
+        NSDictionary *localMap = self.resultMap;
+        self.resultMap = serverMap;
+        
+        // Attributes the server already has aren't sent, the ones it's missing are sent again
+        for(NSString *key in [self.setMap allKeys]){
+            if([self.setMap[key] isEqual:serverMap[key]]){
+                [self.setMap removeObjectForKey:key];
+            }
+        }
+        NSSet *serverKeys = [NSSet setWithObjects:kDKEntityIDField, kDKEntityCreatedAtField, kDKEntityUpdatedAtField, kDKEntityCreatorIdField, nil];
+        for(NSString *key in localMap){
+            if(![serverKeys containsObject:key] && !serverMap[key] && !self.setMap[key]){
+                self.setMap[key] = localMap[key];
+            }
+        }
+        // Channels created offline have no UDID, a reinstall couldn't find them otherwise
+        if(!serverMap[kDKEntityChannelUDID] && !self.setMap[kDKEntityChannelUDID]){
+            self.setMap[kDKEntityChannelUDID] = identifier ? identifier : [self deviceIdentifier];
+        }
+    }
+    [isa persistState:serverMap];
+    return YES;
+}
+
+- (BOOL)save:(NSError **)error{
+    // Saves wait for the bootstrap, the channel could be created twice otherwise
+    if(self == currentChannel && dispatch_get_current_queue() != [DKManager queue]){
+        dispatch_group_wait(bootstrapGroup, DISPATCH_TIME_FOREVER);
+    }
+    return [super save:error];
+}
+
+- (BOOL)commitObjectResultMap:(NSDictionary *)resultMap method:(NSString *)method error:(NSError **)error{
+    BOOL success = [super commitObjectResultMap:resultMap method:method error:error];
+    if(success && self == currentChannel){
+        [isa persistState:self.resultMap];
+    }
+    return success;
 }
 
 + (void)storeDeviceToken:(id)deviceToken{
     if(currentChannel){
-        [currentChannel setObject:AFNormalizedDeviceTokenStringWithDeviceToken(deviceToken) forKey:kDKEntityChannelDeviceToken];
+        [currentChannel setObjectIfChanged:AFNormalizedDeviceTokenStringWithDeviceToken(deviceToken) forKey:kDKEntityChannelDeviceToken];
     }
 }
 
 + (void)storePrivateChannel:(id)privateChannel{
     if(currentChannel){
-        [currentChannel setObject:privateChannel forKey:kDKEntityChannelPrivateChannels];
+        [currentChannel setObjectIfChanged:privateChannel forKey:kDKEntityChannelPrivateChannels];
     }
 }
 
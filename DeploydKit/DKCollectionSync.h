@@ -0,0 +1,133 @@
+//
+//  DKCollectionSync.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKQuery;
+@class DKEntity;
+
+/**
+ Keeps a local copy of the entities matching a query up to date by fetching only what changed.
+
+ The first sync fetches all matching entities. Later syncs fetch the matching entities whose `updatedAt`
+ or `createdAt` is not older than the high-water mark of the previous sync, the IDs of the changed
+ local entities to remove the ones no longer matching, and the deletions
+ recorded since then in the tombstones collection (see `Deployd-Modules/resources/tombstones`,
+ written by the tracked-collection resource once a delete is stored). Timestamps are in seconds,
+ so the entities of the last second are fetched again, applying changes is idempotent.
+
+ The server prunes tombstones after a retention window, a sync whose watermark is older than
+ `tombstoneRetentionInterval` fetches all entities again.
+
+ The merged entities and the watermark are persisted per collection and query conditions, and
+ restored by the next sync object created for the same query. <DKManager> `clearAllCachedResults`
+ discards them, the next sync is then a full fetch.
+
+    DKQuery *query = [DKQuery queryWithEntityName:@"post"];
+    [query whereKey:@"sharedTo" containedIn:@[userId]];
+    DKCollectionSync *sync = [[DKCollectionSync alloc] initWithQuery:query];
+    [sync synchronize:&error];
+    NSArray *posts = [sync findAll:&error];
+ */
+@interface DKCollectionSync : NSObject
+
+/**
+ A copy of the synced query
+ */
+@property (nonatomic, strong, readonly) DKQuery *query;
+
+/**
+ The entity name of the synced collection
+ */
+@property (nonatomic, copy, readonly) NSString *entityName;
+
+/**
+ The server timestamp (in seconds) changes are fetched from, `nil` before the first sync
+ */
+@property (nonatomic, strong, readonly) NSNumber *watermark;
+
+/**
+ The time in seconds the server keeps tombstones, 30 days by default like the `tombstoneRetention`
+ setting of the collection
+ */
+@property (nonatomic, assign) NSTimeInterval tombstoneRetentionInterval;
+
+/**
+ The number of locally stored entities
+ */
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/**
+ The entities inserted or updated by the last sync
+ */
+@property (nonatomic, copy, readonly) NSArray *changedEntities;
+
+/**
+ The IDs of the entities removed by the last sync, deleted or no longer matching the query
+ */
+@property (nonatomic, copy, readonly) NSArray *removedEntityIds;
+
+/** @name Creating Syncs */
+
+/**
+ Initializes a sync for a query, restoring its persisted entities and watermark
+
+ The query conditions select the synced entities, its sort order, <DKQuery> `limit`, `skip` and
+ included or excluded keys are applied when reading the local entities.
+ @param query The query to sync, it is copied
+ @return The initialized sync
+ */
+- (id)initWithQuery:(DKQuery *)query;
+
+/**
+ Initializes a sync for a whole collection
+ @param entityName The entity name of the collection
+ @return The initialized sync
+ */
+- (id)initWithEntityName:(NSString *)entityName;
+
+/** @name Synchronizing */
+
+/**
+ Fetches the changes since the last sync and merges them into the local entities
+ @param error The error object to set on error
+ @return `YES` if the local entities are up to date, `NO` on error
+ */
+- (BOOL)synchronize:(NSError **)error;
+
+/**
+ Fetches the changes since the last sync in the background and merges them into the local entities
+ @param block The callback block, called on the current queue
+ */
+- (void)synchronizeInBackgroundWithBlock:(void (^)(BOOL success, NSError *error))block;
+
+/**
+ Discards the local entities and the watermark, the next sync is a full fetch
+ */
+- (void)reset;
+
+/** @name Reading Local Entities */
+
+/**
+ Returns the local entities in the query order, applying the query limit, skip and key subsets
+ @param error The error object to set on error
+ @return The local entities
+ */
+- (NSArray *)findAll:(NSError **)error;
+
+/**
+ Returns the local entity with the ID
+ @param entityId The entity ID
+ @return The local entity or `nil`
+ */
+- (DKEntity *)entityWithId:(NSString *)entityId;
+
++ (id)new UNAVAILABLE_ATTRIBUTE;
+- (id)init UNAVAILABLE_ATTRIBUTE;
+
+@end
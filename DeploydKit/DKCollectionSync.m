@@ -0,0 +1,339 @@
+//
+//  DKCollectionSync.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKCollectionSync.h"
+#import "DKQuery.h"
+#import "DKQuery-Private.h"
+#import "DKEntity.h"
+#import "DKEntity-Private.h"
+#import "DKRequest.h"
+#import "DKManager.h"
+#import "EGOCache.h"
+#import "DKBinaryCoder.h"
+#import "NSError+DeploydKit.h"
+
+#define kDKCollectionSyncStoreTimeout (60.0 * 60.0 * 24.0 * 365.0)
+#define kDKCollectionSyncDefaultTombstoneRetention (60.0 * 60.0 * 24.0 * 30.0)
+#define kDKCollectionSyncMaxIdsPerQuery 500
+
+// Returns the later of a timestamp and a result value, ignoring values that aren't timestamps
+static NSNumber *DKLaterTimestamp(NSNumber *timestamp, id value) {
+  if (![value isKindOfClass:[NSNumber class]]) {
+    return timestamp;
+  }
+  if (timestamp == nil || [value compare:timestamp] == NSOrderedDescending) {
+    return value;
+  }
+  return timestamp;
+}
+
+@interface DKCollectionSync ()
+@property (nonatomic, strong, readwrite) DKQuery *query;
+@property (nonatomic, copy, readwrite) NSString *entityName;
+@property (nonatomic, strong, readwrite) NSNumber *watermark;
+@property (nonatomic, copy, readwrite) NSArray *changedEntities;
+@property (nonatomic, copy, readwrite) NSArray *removedEntityIds;
+@property (nonatomic, strong) NSMutableDictionary *objects;
+@property (nonatomic, copy) NSString *storeKey;
+@end
+
+@implementation DKCollectionSync {
+@private
+  NSObject *syncLock_;
+}
+
+- (id)initWithQuery:(DKQuery *)query {
+  NSParameterAssert(query != nil);
+
+  self = [super init];
+  if (self) {
+    self.query = [query copy];
+    self.entityName = query.entityName;
+    self.objects = [NSMutableDictionary new];
+    self.tombstoneRetentionInterval = kDKCollectionSyncDefaultTombstoneRetention;
+    syncLock_ = [NSObject new];
+
+    // Only the conditions select the synced entities
+    NSMutableDictionary *conditions = [self.query conditionsDict];
+
+    NSData *JSONData = [NSJSONSerialization dataWithJSONObject:[DKRequest wrapSpecialObjectsInJSON:conditions] options:0 error:NULL];
+    NSString *JSONString = (JSONData != nil) ? [[NSString alloc] initWithData:JSONData encoding:NSUTF8StringEncoding] : [conditions description];
+    self.storeKey = [NSString stringWithFormat:@"sync-%@", [[DKRequest request] md5:[self.entityName stringByAppendingString:JSONString]]];
+
+    [self loadStore];
+  }
+  return self;
+}
+
+- (id)initWithEntityName:(NSString *)entityName {
+  return [self initWithQuery:[DKQuery queryWithEntityName:entityName]];
+}
+
+- (NSUInteger)count {
+  @synchronized(self) {
+    return self.objects.count;
+  }
+}
+
+#pragma mark Store
+
+- (void)loadStore {
+  NSData *data = [[EGOCache globalCache] dataForKey:self.storeKey];
+  if (data == nil) {
+    return;
+  }
+  // Encoded stores hold unwrapped objects, stores saved as JSON are still read
+  BOOL isEncoded = [DKBinaryCoder isEncodedData:data];
+  id store = nil;
+  if (isEncoded) {
+    store = [DKBinaryCoder JSONObjectWithData:data error:NULL];
+  }
+  else {
+    store = [NSJSONSerialization JSONObjectWithData:data options:0 error:NULL];
+  }
+  if (![store isKindOfClass:[NSDictionary class]] || ![store[@"objects"] isKindOfClass:[NSDictionary class]]) {
+    return;
+  }
+  self.watermark = DKLaterTimestamp(nil, store[@"watermark"]);
+  self.objects = [(isEncoded ? store[@"objects"] : [DKRequest unwrapSpecialObjectsInJSON:store[@"objects"]]) mutableCopy];
+}
+
+- (void)saveStore {
+  NSMutableDictionary *store = [NSMutableDictionary new];
+  store[@"objects"] = self.objects;
+  if (self.watermark != nil) {
+    store[@"watermark"] = self.watermark;
+  }
+  NSData *data = [DKBinaryCoder dataWithJSONObject:store];
+  if (data == nil) {
+    store[@"objects"] = [DKRequest wrapSpecialObjectsInJSON:self.objects];
+    data = [NSJSONSerialization dataWithJSONObject:store options:0 error:NULL];
+  }
+  if (data != nil) {
+    [[EGOCache globalCache] setData:data forKey:self.storeKey withTimeoutInterval:kDKCollectionSyncStoreTimeout];
+  }
+}
+
+- (void)reset {
+  @synchronized(self) {
+    [[EGOCache globalCache] removeCacheForKey:self.storeKey];
+    [self.objects removeAllObjects];
+    self.watermark = nil;
+    self.changedEntities = nil;
+    self.removedEntityIds = nil;
+  }
+}
+
+#pragma mark Synchronizing
+
+- (DKQuery *)conditionsQuery {
+  DKQuery *query = [self.query copy];
+  [query.sort removeAllObjects];
+  [query.fieldInclExcl removeAllObjects];
+  query.limit = 0;
+  query.skip = 0;
+  query.cachePolicy = DKCachePolicyIgnoreCache;
+  return query;
+}
+
+- (BOOL)synchronize:(NSError **)error {
+  // Syncs of the same object run one at a time
+  @synchronized(syncLock_) {
+    NSNumber *watermark = nil;
+    @synchronized(self) {
+      watermark = self.watermark;
+    }
+    // Deletions older than the retention window may have been pruned
+    NSTimeInterval age = [[NSDate date] timeIntervalSince1970] - [watermark doubleValue];
+    if (watermark == nil || age > self.tombstoneRetentionInterval) {
+      return [self fetchAll:error];
+    }
+    return [self fetchChangesSince:watermark error:error];
+  }
+}
+
+- (void)synchronizeInBackgroundWithBlock:(void (^)(BOOL success, NSError *error))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    BOOL success = [self synchronize:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(success, error);
+      });
+    }
+  });
+}
+
+- (BOOL)fetchAll:(NSError **)error {
+  // Read the watermark before fetching, writes made during the fetch are fetched again by the next sync
+  DKQuery *latest = [DKQuery queryWithEntityName:self.entityName];
+  NSNumber *watermark = nil;
+  for (NSString *key in @[kDKEntityUpdatedAtField, kDKEntityCreatedAtField]) {
+    NSError *boundaryError = nil;
+    id value = [latest boundaryValueForKey:key ascending:NO error:&boundaryError];
+    if (boundaryError != nil) {
+      if (error != NULL) {
+        *error = boundaryError;
+      }
+      return NO;
+    }
+    watermark = DKLaterTimestamp(watermark, value);
+  }
+
+  NSError *fetchError = nil;
+  NSArray *entities = [[self conditionsQuery] findAll:&fetchError];
+  if (fetchError != nil) {
+    if (error != NULL) {
+      *error = fetchError;
+    }
+    return NO;
+  }
+
+  NSMutableDictionary *objects = [NSMutableDictionary new];
+  for (DKEntity *entity in entities) {
+    if (entity.entityId != nil && entity.resultMap != nil) {
+      objects[entity.entityId] = entity.resultMap;
+    }
+  }
+
+  @synchronized(self) {
+    NSMutableArray *removedIds = [NSMutableArray new];
+    for (NSString *entityId in self.objects) {
+      if (objects[entityId] == nil) {
+        [removedIds addObject:entityId];
+      }
+    }
+    self.objects = objects;
+    self.watermark = watermark;
+    self.changedEntities = entities;
+    self.removedEntityIds = removedIds;
+    [self saveStore];
+  }
+  return YES;
+}
+
+- (BOOL)fetchChangesSince:(NSNumber *)watermark error:(NSError **)error {
+  // The changed entities matching the conditions
+  NSMutableArray *queries = [NSMutableArray new];
+  for (NSString *key in @[kDKEntityUpdatedAtField, kDKEntityCreatedAtField]) {
+    DKQuery *query = [self conditionsQuery];
+    NSMutableDictionary *keyDict = [query queryDictForKey:key];
+    keyDict[@"$gte"] = DKLaterTimestamp(watermark, keyDict[@"$gte"]);
+    [queries addObject:query];
+  }
+  DKQuery *tombstones = [DKQuery queryWithEntityName:kDKRequestTombstoneCollection];
+  [tombstones whereKey:kDKTombstoneCollectionField equalTo:self.entityName];
+  [tombstones whereKey:kDKTombstoneDeletedAtField greaterThanOrEqualTo:watermark];
+  [queries addObject:tombstones];
+
+  // The IDs of the changed local entities, the ones no longer matching the conditions left the results
+  NSArray *localIds = nil;
+  @synchronized(self) {
+    localIds = [self.objects allKeys];
+  }
+  for (NSUInteger i = 0; i < localIds.count; i += kDKCollectionSyncMaxIdsPerQuery) {
+    NSRange range = NSMakeRange(i, MIN((NSUInteger)kDKCollectionSyncMaxIdsPerQuery, localIds.count - i));
+    DKQuery *query = [DKQuery queryWithEntityName:self.entityName];
+    query.cachePolicy = DKCachePolicyIgnoreCache;
+    [query whereKey:kDKEntityIDField containedIn:[localIds subarrayWithRange:range]];
+    [query whereKey:kDKEntityUpdatedAtField greaterThanOrEqualTo:watermark];
+    [query includeKeys:@[kDKEntityIDField]];
+    [queries addObject:query];
+  }
+
+  NSMutableArray *results = [NSMutableArray new];
+  for (NSUInteger i = 0; i < queries.count; i++) {
+    [results addObject:@[]];
+  }
+  BOOL success = [self.query runQueries:queries maxConcurrent:3 resultBlock:^(NSUInteger idx, NSArray *queryResults) {
+    results[idx] = queryResults;
+  } error:error];
+  if (!success) {
+    return NO;
+  }
+
+  NSNumber *newWatermark = watermark;
+  NSMutableDictionary *changed = [NSMutableDictionary new];
+  for (NSUInteger i = 0; i < 2; i++) {
+    for (DKEntity *entity in results[i]) {
+      NSDictionary *object = entity.resultMap;
+      if (entity.entityId != nil && object != nil) {
+        changed[entity.entityId] = object;
+        newWatermark = DKLaterTimestamp(newWatermark, object[kDKEntityUpdatedAtField]);
+        newWatermark = DKLaterTimestamp(newWatermark, object[kDKEntityCreatedAtField]);
+      }
+    }
+  }
+  NSMutableSet *deletedIds = [NSMutableSet new];
+  for (DKEntity *tombstone in results[2]) {
+    id entityId = [tombstone objectForKey:kDKTombstoneEntityIdField];
+    if (entityId != nil) {
+      [deletedIds addObject:entityId];
+    }
+    newWatermark = DKLaterTimestamp(newWatermark, [tombstone objectForKey:kDKTombstoneDeletedAtField]);
+  }
+
+  // Split the changes into entities entering or staying in the results and entities leaving them
+  NSMutableArray *upserts = [NSMutableArray new];
+  NSMutableSet *removals = [NSMutableSet setWithSet:deletedIds];
+  for (NSString *entityId in changed) {
+    if (![deletedIds containsObject:entityId]) {
+      [upserts addObject:changed[entityId]];
+    }
+  }
+  for (NSUInteger i = 3; i < results.count; i++) {
+    for (DKEntity *entity in results[i]) {
+      if (entity.entityId != nil && changed[entity.entityId] == nil) {
+        [removals addObject:entity.entityId];
+      }
+    }
+  }
+
+  @synchronized(self) {
+    NSMutableArray *removedIds = [NSMutableArray new];
+    for (NSString *entityId in removals) {
+      if (self.objects[entityId] != nil) {
+        [self.objects removeObjectForKey:entityId];
+        [removedIds addObject:entityId];
+      }
+    }
+    for (NSDictionary *object in upserts) {
+      self.objects[object[kDKEntityIDField]] = object;
+    }
+    self.watermark = newWatermark;
+    self.changedEntities = [self.query entitiesFromResults:upserts];
+    self.removedEntityIds = removedIds;
+    [self saveStore];
+  }
+  return YES;
+}
+
+#pragma mark Reading Local Entities
+
+- (NSArray *)findAll:(NSError **)error {
+  NSArray *objects = nil;
+  @synchronized(self) {
+    objects = [self.objects allValues];
+  }
+  return [self.query findAllInEntities:objects error:error];
+}
+
+- (DKEntity *)entityWithId:(NSString *)entityId {
+  NSDictionary *object = nil;
+  @synchronized(self) {
+    object = self.objects[entityId];
+  }
+  if (object == nil) {
+    return nil;
+  }
+  return [[self.query entitiesFromResults:@[object]] lastObject];
+}
+
+@end
@@ -39,11 +39,28 @@ enum {
 };
 typedef NSInteger DKRegexOption;
 
+enum {
+  DKLiveQueryEventInserted = 0,
+  DKLiveQueryEventUpdated,
+  DKLiveQueryEventDeleted,
+  DKLiveQueryEventReconnected
+};
+typedef NSInteger DKLiveQueryEvent;
+
 //deployd collections for files handle on Amazon S3
 #define kDKRequestFileHandler @"s3bucket"
+#define kDKRequestFileMultipart @"multipart"
+#define kDKRequestFileExists @"exists"
 #define kDKRequestFileCollection @"files"
 //deployd field name of files collection
 #define kDKRequestAssignedFileName @"fileName"
+#define kDKRequestFileContentHash @"contentHash"
+#define kDKRequestFileContentHashHeader @"X-Content-Hash"
+//metadata keys of files
+#define kDKFileMetadataSize @"fileSize"
+#define kDKFileMetadataETag @"etag"
+#define kDKFileMetadataLastModified @"lastModified"
+#define kDKFileMetadataContentType @"contentType"
 //deployd user fields for login
 #define kDKEntityUserName @"username"
 #define kDKEntityUserPassword @"password"
@@ -54,6 +71,19 @@ typedef NSInteger DKRegexOption;
 #define kDKEntityCreatorIdField @"creatorId"
 //deployd collections for apn
 #define kDKRequestPushChannel @"apn"
+//deployd resource for query batches
+#define kDKRequestQueryBatch @"batch"
+//deployd resource for live queries
+#define kDKRequestLiveQuery @"live"
+//deployd resource for queries sent as a JSON body
+#define kDKRequestQueryPost @"query"
+//deployd resource for aggregations
+#define kDKRequestAggregate @"aggregate"
+//deployd collection for deletion tombstones
+#define kDKRequestTombstoneCollection @"tombstones"
+#define kDKTombstoneCollectionField @"collection"
+#define kDKTombstoneEntityIdField @"entityId"
+#define kDKTombstoneDeletedAtField @"deletedAt"
 //deployd channel fields
 #define kDKEntityChannel @"channel"
 #define kDKEntityChannelUDID @"udid"
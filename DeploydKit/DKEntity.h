@@ -68,6 +68,19 @@
  */
 @property (readwrite, assign) NSTimeInterval maxCacheAge;
 
+/**
+ The delay in seconds during which background saves are coalesced into one update, `0` (the default) sends each background save
+
+ Until the delayed save is sent, increments are summed, set values are replaced by the last one and pushed,
+ pulled or added objects are merged. Changes of a failed save stay pending for the next save.
+ */
+@property (nonatomic, assign) NSTimeInterval writeBehindInterval;
+
+/**
+ The number of pending changes that sends a coalesced background save before its delay, `0` for no limit. Defaults to 100.
+ */
+@property (nonatomic, assign) NSUInteger writeBehindMaxChanges;
+
 /** @name Creating and Initializing Entities */
 
 /**
@@ -109,11 +122,28 @@
 
 /**
  Saves the entity in the background and invokes callback on completion
+ 
+ If <writeBehindInterval> is set, the save is coalesced with the other background saves of the delay.
  @param block The save callback block
  @exception NSInvalidArgumentException Raised if any key contains an `$` or `.` character.
  */
 - (void)saveInBackgroundWithBlock:(void (^)(DKEntity *entity, NSError *error))block;
 
+/**
+ Saves the pending changes now and invokes the callbacks of the coalesced background saves
+ @param error The error object to be set on error
+ @return `YES` on success, `NO` on error
+ @exception NSInvalidArgumentException Raised if any key contains an `$` or `.` character.
+ */
+- (BOOL)flush:(NSError **)error;
+
+/**
+ Saves the pending changes in the background and invokes callback on completion
+ @param block The flush callback block
+ @exception NSInvalidArgumentException Raised if any key contains an `$` or `.` character.
+ */
+- (void)flushInBackgroundWithBlock:(void (^)(DKEntity *entity, NSError *error))block;
+
 /** @name Refreshing Entities */
 
 /**
@@ -300,6 +330,38 @@
  */
 - (BOOL)loggedUser:(NSError **)error;
 
+/** @name Subclassing Entities */
+
+/**
+ Registers the entity class instantiated for the entities fetched from a collection
+ 
+ Typed subclasses generated from the collection schemas by `DeploydKit-Codegen` register themselves.
+ @param entityClass The DKEntity subclass
+ @param entityName The collection name
+ */
++ (void)registerSubclass:(Class)entityClass forEntityName:(NSString *)entityName;
+
+/**
+ Returns the entity class registered for a collection
+ @param entityName The collection name
+ @return The registered subclass, or DKEntity
+ */
++ (Class)classForEntityName:(NSString *)entityName;
+
+/**
+ Returns the top level keys whose string, number and null values are not validated for `$` and `.`
+ characters on save, other values set for them are still validated
+ 
+ Subclasses return the keys of scalar properties. The default implementation returns `nil`.
+ @return The keys whose scalar values skip the validation
+ */
++ (NSSet *)unvalidatedKeys;
+
+/**
+ Called when the fetched or saved values change, subclasses decode the values returned by <objectForKey:> into ivars
+ */
+- (void)decodeObjects;
+
 + (id)new UNAVAILABLE_ATTRIBUTE;
 - (id)init UNAVAILABLE_ATTRIBUTE;
 @end
\ No newline at end of file
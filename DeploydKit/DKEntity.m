@@ -15,9 +15,67 @@
 #import "DKRequest.h"
 #import "DKConstants.h"
 #import "DKManager.h"
+#import "DKSpatialIndex.h"
+#import "DKSpatialIndex-Private.h"
+#import "DKTextIndex.h"
+#import "DKTextIndex-Private.h"
 #import "EGOCache.h"
 
-@implementation DKEntity
+#define kDKEntityDefaultWriteBehindMaxChanges 100
+
+// Sums two increments, integer amounts stay integers
+static NSNumber *DKSumAmounts(NSNumber *amount1, NSNumber *amount2) {
+  if (amount1 == nil) {
+    return amount2;
+  }
+  for (NSNumber *amount in @[amount1, amount2]) {
+    if (strcmp([amount objCType], @encode(double)) == 0 || strcmp([amount objCType], @encode(float)) == 0) {
+      return @([amount1 doubleValue] + [amount2 doubleValue]);
+    }
+  }
+  return @([amount1 longLongValue] + [amount2 longLongValue]);
+}
+
+@implementation DKEntity {
+@private
+  NSObject *saveLock_;
+  NSDictionary *sendingSetMap_;
+  NSUInteger pendingChanges_;
+  NSMutableArray *writeBehindCallbacks_;
+  BOOL writeBehindScheduled_;
+}
+
++ (NSMutableDictionary *)registeredSubclasses {
+  static NSMutableDictionary *subclasses;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    subclasses = [NSMutableDictionary new];
+  });
+  return subclasses;
+}
+
++ (void)registerSubclass:(Class)entityClass forEntityName:(NSString *)entityName {
+  NSParameterAssert([entityClass isSubclassOfClass:[DKEntity class]]);
+  NSParameterAssert(entityName.length > 0);
+  
+  NSMutableDictionary *subclasses = [self registeredSubclasses];
+  @synchronized(subclasses) {
+    subclasses[entityName] = entityClass;
+  }
+}
+
++ (Class)classForEntityName:(NSString *)entityName {
+  NSMutableDictionary *subclasses = [self registeredSubclasses];
+  Class entityClass = Nil;
+  @synchronized(subclasses) {
+    entityClass = (entityName != nil) ? subclasses[entityName] : Nil;
+  }
+  return (entityClass != Nil) ? entityClass : [DKEntity class];
+}
+
++ (NSSet *)unvalidatedKeys {
+  return nil;
+}
 
 + (DKEntity *)entityWithName:(NSString *)entityName {
   return [[self alloc] initWithName:entityName];
@@ -36,10 +94,21 @@
     self.loginMap = [NSMutableDictionary new];
     self.cachePolicy = DKCachePolicyIgnoreCache;
     self.maxCacheAge = [EGOCache globalCache].defaultTimeoutInterval;
+    self.writeBehindMaxChanges = kDKEntityDefaultWriteBehindMaxChanges;
+    saveLock_ = [NSObject new];
+    writeBehindCallbacks_ = [NSMutableArray new];
   }
   return self;
 }
 
+- (void)setResultMap:(NSDictionary *)resultMap {
+  _resultMap = resultMap;
+  [self decodeObjects];
+}
+
+- (void)decodeObjects {
+}
+
 - (NSString *)entityId {
   NSString *eid = (self.resultMap)[kDKEntityIDField];
   if ([eid isKindOfClass:[NSString class]]) {
@@ -77,21 +146,27 @@
 }
 
 - (BOOL)isDirty {
-  return (self.setMap.count +
-          self.incMap.count +
-          self.pushMap.count +
-          self.pushAllMap.count +
-          self.addToSetMap.count +
-          self.pullAllMap.count) > 0;
+  @synchronized(self) {
+    return (self.setMap.count +
+            self.incMap.count +
+            self.pushMap.count +
+            self.pushAllMap.count +
+            self.addToSetMap.count +
+            self.pullAllMap.count) > 0;
+  }
 }
 
 - (void)reset {
-  [self.setMap removeAllObjects];
-  [self.incMap removeAllObjects];
-  [self.pushMap removeAllObjects];
-  [self.pushAllMap removeAllObjects];
-  [self.addToSetMap removeAllObjects];
-  [self.pullAllMap removeAllObjects];
+  @synchronized(self) {
+    [self.setMap removeAllObjects];
+    [self.incMap removeAllObjects];
+    [self.pushMap removeAllObjects];
+    [self.pushAllMap removeAllObjects];
+    [self.addToSetMap removeAllObjects];
+    [self.pullAllMap removeAllObjects];
+    pendingChanges_ = 0;
+  }
+  [self decodeObjects];
 }
 
 - (BOOL)save {
@@ -109,6 +184,10 @@
 - (void)saveInBackgroundWithBlock:(void (^)(DKEntity *entity, NSError *error))block {
   block = [block copy];
   dispatch_queue_t q = dispatch_get_current_queue();
+  if (self.writeBehindInterval > 0) {
+    [self scheduleWriteBehindSaveWithBlock:block queue:q];
+    return;
+  }
   dispatch_async([DKManager queue], ^{
     NSError *error = nil;
     [self save:&error];
@@ -120,6 +199,70 @@
   });
 }
 
+- (void)scheduleWriteBehindSaveWithBlock:(void (^)(DKEntity *entity, NSError *error))block queue:(dispatch_queue_t)q {
+  BOOL flushNow = NO;
+  BOOL schedule = NO;
+  @synchronized(self) {
+    if (block != NULL) {
+      [writeBehindCallbacks_ addObject:[^(NSError *error) {
+        dispatch_async(q, ^{
+          block(self, error);
+        });
+      } copy]];
+    }
+    flushNow = (self.writeBehindMaxChanges > 0 && pendingChanges_ >= self.writeBehindMaxChanges);
+    schedule = (!flushNow && !writeBehindScheduled_);
+    if (schedule) {
+      writeBehindScheduled_ = YES;
+    }
+  }
+  
+  if (flushNow) {
+    dispatch_async([DKManager queue], ^{
+      [self flush:NULL];
+    });
+  }
+  else if (schedule) {
+    dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.writeBehindInterval * NSEC_PER_SEC));
+    dispatch_after(when, [DKManager queue], ^{
+      [self flush:NULL];
+    });
+  }
+}
+
+- (BOOL)flush:(NSError **)error {
+  NSArray *callbacks = nil;
+  @synchronized(self) {
+    callbacks = [writeBehindCallbacks_ copy];
+    [writeBehindCallbacks_ removeAllObjects];
+    writeBehindScheduled_ = NO;
+  }
+  
+  NSError *saveError = nil;
+  BOOL success = [self save:&saveError];
+  for (void (^callback)(NSError *error) in callbacks) {
+    callback(saveError);
+  }
+  if (saveError != nil && error != NULL) {
+    *error = saveError;
+  }
+  return success;
+}
+
+- (void)flushInBackgroundWithBlock:(void (^)(DKEntity *entity, NSError *error))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    [self flush:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(self, error);
+      });
+    }
+  });
+}
+
 - (BOOL)refresh {
   return [self refresh];
 }
@@ -189,6 +332,8 @@
   NSError *requestError = nil;
   [request sendRequestWithObject:requestDict method:@"delete" entity:[self.entityName stringByAppendingPathComponent:self.entityId] error:&requestError];
   if (requestError != nil) {
+    // The server may have deleted it anyway
+    [DKTextIndex invalidateIndexesWithEntityName:self.entityName];
     if (error != nil) {
       *error = requestError;
     }
@@ -196,6 +341,8 @@
   }
   
   // Remove maps
+  [DKSpatialIndex removeEntityId:self.entityId fromIndexesWithEntityName:self.entityName];
+  [DKTextIndex removeEntityId:self.entityId fromIndexesWithEntityName:self.entityName];
   self.resultMap = [NSDictionary new];
 
   [self reset];
@@ -222,23 +369,50 @@
 }
 
 - (id)objectForKey:(NSString *)key {
-  id obj = (self.setMap)[key];
-  if (obj == nil) {
-    obj = (self.resultMap)[key];
+  @synchronized(self) {
+    id obj = (self.setMap)[key];
+    if (obj == nil) {
+      obj = sendingSetMap_[key];
+    }
+    if (obj == nil) {
+      obj = (self.resultMap)[key];
+    }
+    return obj;
   }
-  return obj;
 }
 
 - (void)setObject:(id)object forKey:(NSString *)key {
-  (self.setMap)[key] = object;
+  @synchronized(self) {
+    (self.setMap)[key] = object;
+    pendingChanges_++;
+  }
 }
 
 - (void)pushObject:(id)object forKey:(NSString *)key {
-  (self.pushMap)[key] = object;
+  @synchronized(self) {
+    // A key is either pushed once or pushed all, merge repeated pushes
+    if ((self.pushMap)[key] == nil && (self.pushAllMap)[key] == nil) {
+      (self.pushMap)[key] = object;
+      pendingChanges_++;
+    }
+    else {
+      [self pushAllObjects:@[object] forKey:key];
+    }
+  }
 }
 
 - (void)pushAllObjects:(NSArray *)objects forKey:(NSString *)key {
-  (self.pushAllMap)[key] = objects;
+  @synchronized(self) {
+    NSMutableArray *list = [NSMutableArray new];
+    if ((self.pushMap)[key] != nil) {
+      [list addObject:(self.pushMap)[key]];
+      [self.pushMap removeObjectForKey:key];
+    }
+    [list addObjectsFromArray:(self.pushAllMap)[key]];
+    [list addObjectsFromArray:objects];
+    (self.pushAllMap)[key] = list;
+    pendingChanges_++;
+  }
 }
 
 - (void)pullObject:(id)object forKey:(NSString *)key {
@@ -246,7 +420,16 @@
 }
 
 - (void)pullAllObjects:(NSArray *)objects forKey:(NSString *)key {
-  (self.pullAllMap)[key] = objects;
+  @synchronized(self) {
+    NSMutableArray *list = [NSMutableArray arrayWithArray:(self.pullAllMap)[key]];
+    for (id obj in objects) {
+      if (![list containsObject:obj]) {
+        [list addObject:obj];
+      }
+    }
+    (self.pullAllMap)[key] = list;
+    pendingChanges_++;
+  }
 }
 
 - (void)addObjectToSet:(id)object forKey:(NSString *)key {
@@ -254,15 +437,18 @@
 }
 
 - (void)addAllObjectsToSet:(NSArray *)objects forKey:(NSString *)key {
-  NSMutableArray *list = (self.addToSetMap)[key];
-  if (list == nil) {
-    list = [NSMutableArray new];
-    (self.addToSetMap)[key] = list;
-  }
-  for (id obj in objects) {
-    if (![list containsObject:objects]) {
-        [list addObject:obj];
+  @synchronized(self) {
+    NSMutableArray *list = (self.addToSetMap)[key];
+    if (list == nil) {
+      list = [NSMutableArray new];
+      (self.addToSetMap)[key] = list;
     }
+    for (id obj in objects) {
+      if (![list containsObject:obj]) {
+          [list addObject:obj];
+      }
+    }
+    pendingChanges_++;
   }
 }
 
@@ -271,11 +457,14 @@
 }
 
 - (void)incrementKey:(NSString *)key byAmount:(NSNumber *)amount {
-  (self.incMap)[key] = amount;
+  @synchronized(self) {
+    (self.incMap)[key] = DKSumAmounts((self.incMap)[key], amount);
+    pendingChanges_++;
+  }
 }
 
 - (BOOL)isEqual:(id)object {
-  if ([object isKindOfClass:isa]) {
+  if ([object isKindOfClass:[DKEntity class]]) {
     return [[(DKEntity *)object entityId] isEqualToString:self.entityId];
   }
   return NO;
@@ -315,11 +504,102 @@
      return [self commitObjectResultMap:resultMap method:@"me" error:error];
 }
 
+- (NSDictionary *)takePendingChanges {
+  @synchronized(self) {
+    NSDictionary *maps = @{@"$set" : self.setMap,
+                           @"$inc" : self.incMap,
+                           @"$push" : self.pushMap,
+                           @"$pushAll" : self.pushAllMap,
+                           @"$addToSet" : self.addToSetMap,
+                           @"$pullAll" : self.pullAllMap};
+    NSMutableDictionary *changes = [NSMutableDictionary new];
+    for (NSString *op in maps) {
+      if ([maps[op] count] > 0) {
+        changes[op] = maps[op];
+      }
+    }
+    self.setMap = [NSMutableDictionary new];
+    self.incMap = [NSMutableDictionary new];
+    self.pushMap = [NSMutableDictionary new];
+    self.pushAllMap = [NSMutableDictionary new];
+    self.addToSetMap = [NSMutableDictionary new];
+    self.pullAllMap = [NSMutableDictionary new];
+    sendingSetMap_ = changes[@"$set"];
+    pendingChanges_ = 0;
+    return changes;
+  }
+}
+
+- (void)restorePendingChanges:(NSDictionary *)changes {
+  @synchronized(self) {
+    NSDictionary *setMap = self.setMap;
+    NSDictionary *incMap = self.incMap;
+    NSDictionary *pushMap = self.pushMap;
+    NSDictionary *pushAllMap = self.pushAllMap;
+    NSDictionary *addToSetMap = self.addToSetMap;
+    NSDictionary *pullAllMap = self.pullAllMap;
+    NSUInteger newerChanges = pendingChanges_;
+    
+    self.setMap = [NSMutableDictionary dictionaryWithDictionary:changes[@"$set"]];
+    self.incMap = [NSMutableDictionary dictionaryWithDictionary:changes[@"$inc"]];
+    self.pushMap = [NSMutableDictionary dictionaryWithDictionary:changes[@"$push"]];
+    self.pushAllMap = [NSMutableDictionary dictionaryWithDictionary:changes[@"$pushAll"]];
+    self.addToSetMap = [NSMutableDictionary new];
+    for (id key in changes[@"$addToSet"]) {
+      (self.addToSetMap)[key] = [changes[@"$addToSet"][key] mutableCopy];
+    }
+    self.pullAllMap = [NSMutableDictionary dictionaryWithDictionary:changes[@"$pullAll"]];
+    
+    // Replay the changes made since they were taken
+    for (id key in setMap) {
+      [self setObject:setMap[key] forKey:key];
+    }
+    for (id key in incMap) {
+      [self incrementKey:key byAmount:incMap[key]];
+    }
+    for (id key in pushMap) {
+      [self pushObject:pushMap[key] forKey:key];
+    }
+    for (id key in pushAllMap) {
+      [self pushAllObjects:pushAllMap[key] forKey:key];
+    }
+    for (id key in addToSetMap) {
+      [self addAllObjectsToSet:addToSetMap[key] forKey:key];
+    }
+    for (id key in pullAllMap) {
+      [self pullAllObjects:pullAllMap[key] forKey:key];
+    }
+    
+    pendingChanges_ = newerChanges;
+    for (NSString *op in changes) {
+      pendingChanges_ += [changes[op] count];
+    }
+  }
+}
+
 - (BOOL)sendAction:(NSString*)action error:(NSError **)error {
+  // Saves of the same entity are sent one at a time, changes made while one is sent stay pending
+  @synchronized(saveLock_) {
+    NSDictionary *changes = nil;
+    if (!([action isEqualToString:@"login"] || [action isEqualToString:@"logout"])) {
+      changes = [self takePendingChanges];
+    }
+    // Invalid keys raise, the values being sent are still cleared
+    @try {
+      return [self sendAction:action changes:changes error:error];
+    }
+    @finally {
+      @synchronized(self) {
+        sendingSetMap_ = nil;
+      }
+    }
+  }
+}
+
+- (BOOL)sendAction:(NSString*)action changes:(NSDictionary *)changes error:(NSError **)error {
     
         // Check if data has been written
-        if (!self.isDirty &&
-            !([action isEqualToString:@"login"] || [action isEqualToString:@"logout"])) {
+        if (changes != nil && changes.count == 0) {
             return YES;
         }
         
@@ -363,28 +643,35 @@
                 requestDict[key] = validateKeys(value);
             }
         }else{
-            if (self.setMap.count > 0) {
-                for (id key in self.setMap) {
-                    id value = (self.setMap)[key];
-                    requestDict[key] = validateKeys(value);
+            NSDictionary *setMap = changes[@"$set"];
+            if (setMap.count > 0) {
+                NSSet *unvalidatedKeys = [isa unvalidatedKeys];
+                for (id key in setMap) {
+                    id value = setMap[key];
+                    // Only scalar values of unvalidated keys skip the check, any value can be set for them
+                    BOOL isScalar = ([value isKindOfClass:[NSString class]] ||
+                                     [value isKindOfClass:[NSNumber class]] ||
+                                     [value isKindOfClass:[NSNull class]]);
+                    requestDict[key] = (isScalar && [unvalidatedKeys containsObject:key]) ? value : validateKeys(value);
                 }
             }
-            if (self.incMap.count > 0) {
-                [DKEntity deploydCommands:self.incMap operation:@"$inc" requestDict:requestDict];
+            if ([changes[@"$inc"] count] > 0) {
+                [DKEntity deploydCommands:changes[@"$inc"] operation:@"$inc" requestDict:requestDict];
             }
-            if (self.pushMap.count > 0) {
-                [DKEntity deploydCommands:self.pushMap operation:@"$push" requestDict:requestDict];
+            if ([changes[@"$push"] count] > 0) {
+                [DKEntity deploydCommands:changes[@"$push"] operation:@"$push" requestDict:requestDict];
             }
-            if (self.pushAllMap.count > 0) {
-                [DKEntity deploydCommands:self.pushAllMap operation:@"$pushAll" requestDict:requestDict];
+            if ([changes[@"$pushAll"] count] > 0) {
+                [DKEntity deploydCommands:changes[@"$pushAll"] operation:@"$pushAll" requestDict:requestDict];
             }
-            if (self.pullAllMap.count > 0) {
-                [DKEntity deploydCommands:self.pullAllMap operation:@"$pullAll" requestDict:requestDict];
+            if ([changes[@"$pullAll"] count] > 0) {
+                [DKEntity deploydCommands:changes[@"$pullAll"] operation:@"$pullAll" requestDict:requestDict];
             }
-            if (self.addToSetMap.count > 0) {
+            NSDictionary *addToSetMap = changes[@"$addToSet"];
+            if (addToSetMap.count > 0) {
                 NSMutableDictionary *addToSetDict = [NSMutableDictionary dictionaryWithObjectsAndKeys: nil];                
-                for (id key in self.addToSetMap) {
-                    id value = (self.addToSetMap)[key];
+                for (id key in addToSetMap) {
+                    id value = addToSetMap[key];
                     [DKEntity deploydCommands:[NSMutableDictionary dictionaryWithObjectsAndKeys: value, key, nil] operation:@"$each" requestDict:addToSetDict];
                 }                
                 requestDict[@"$addToSet"] = validateKeys(addToSetDict);
@@ -409,6 +696,11 @@
         NSError *requestError = nil;
         NSDictionary *resultMap = [request sendRequestWithObject:requestDict method:action entity:actionUri error:&requestError];
         if (requestError != nil) {
+            if (changes != nil) {
+                [self restorePendingChanges:changes];
+                // The server may have saved them anyway
+                [DKTextIndex invalidateIndexesWithEntityName:self.entityName];
+            }
             if (error != nil) {
                 *error = requestError;
             }
@@ -494,7 +786,15 @@
   }
   self.resultMap = resultMap;
   
-  [self reset];
+  if ([method isEqualToString:@"save"] || [method isEqualToString:@"update"] || [method isEqualToString:@"refresh"]) {
+    [DKSpatialIndex updateIndexesWithEntities:@[resultMap] entityName:self.entityName];
+    [DKTextIndex updateIndexesWithEntities:@[resultMap] entityName:self.entityName];
+  }
+  
+  // Saved changes were taken before sending, the pending ones were made meanwhile
+  if (!([method isEqualToString:@"save"] || [method isEqualToString:@"update"])) {
+    [self reset];
+  }
   
   return YES;
 }
@@ -0,0 +1,172 @@
+//
+//  DKEntityStore.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKEntity;
+@class DKQuery;
+
+/**
+ A persistent local store of entities, with secondary indexes on keys, for offline-first screens.
+
+ Entities are stored per collection in an SQLite database and looked up by ID, by value or by range of
+ values of an indexed key. Saving an entity that is already stored replaces it. Opening a store doesn't
+ read the stored entities, they are decoded when they are looked up.
+
+ Array values are indexed by element, like Deployd matches them. Indexed values compare numbers before
+ strings, strings are compared by their UTF-8 bytes.
+
+    DKEntityStore *store = [DKEntityStore defaultStore];
+    [store addIndexForKey:@"visits" entityName:@"post" error:&error];
+    [store saveResultsOfQuery:[DKQuery queryWithEntityName:@"post"] error:&error];
+    // ...
+    NSArray *popular = [store entitiesWithName:@"post" key:@"visits" from:@100 to:nil limit:20 error:&error];
+ */
+@interface DKEntityStore : NSObject
+
+/**
+ The path of the database file
+ */
+@property (nonatomic, copy, readonly) NSString *path;
+
+/** @name Opening Stores */
+
+/**
+ Returns the store in the application support directory
+ @return The default store
+ */
++ (DKEntityStore *)defaultStore;
+
+/**
+ Initializes a store, creating the database file if needed
+ @param path The path of the database file
+ @return The initialized store
+ */
+- (id)initWithPath:(NSString *)path;
+
+/**
+ Closes the database, the next operation reopens it
+ */
+- (void)close;
+
+/** @name Declaring Indexes */
+
+/**
+ Adds an index on a key of a collection, indexing the stored entities
+ @param key The indexed key, nested keys are separated by dots
+ @param entityName The entity name of the collection
+ @param error The error object to set on error
+ @return `YES` if the index was added or already exists, `NO` on error
+ */
+- (BOOL)addIndexForKey:(NSString *)key entityName:(NSString *)entityName error:(NSError **)error;
+
+/**
+ Removes an index
+ @param key The indexed key
+ @param entityName The entity name of the collection
+ @param error The error object to set on error
+ @return `YES` if the index was removed, `NO` on error
+ */
+- (BOOL)removeIndexForKey:(NSString *)key entityName:(NSString *)entityName error:(NSError **)error;
+
+/**
+ Returns the indexed keys of a collection
+ @param entityName The entity name of the collection
+ @return The indexed keys
+ */
+- (NSArray *)indexedKeysForEntityName:(NSString *)entityName;
+
+/** @name Saving Entities */
+
+/**
+ Inserts or replaces entities in a single transaction
+ @param entities The saved entities, entities without ID are skipped
+ @param error The error object to set on error
+ @return `YES` if the entities were saved, `NO` on error
+ */
+- (BOOL)saveEntities:(NSArray *)entities error:(NSError **)error;
+
+/**
+ Fetches the results of a query and inserts or replaces them
+ @param query The query to fetch, it shouldn't include or exclude keys
+ @param error The error object to set on error
+ @return The fetched entities, `nil` on error
+ */
+- (NSArray *)saveResultsOfQuery:(DKQuery *)query error:(NSError **)error;
+
+/**
+ Removes an entity
+ @param entityId The ID of the removed entity
+ @param entityName The entity name of the collection
+ @param error The error object to set on error
+ @return `YES` if the entity was removed or not stored, `NO` on error
+ */
+- (BOOL)removeEntityWithId:(NSString *)entityId entityName:(NSString *)entityName error:(NSError **)error;
+
+/**
+ Removes all entities of a collection, its indexes are kept
+ @param entityName The entity name of the collection
+ @param error The error object to set on error
+ @return `YES` if the entities were removed, `NO` on error
+ */
+- (BOOL)removeAllEntitiesWithName:(NSString *)entityName error:(NSError **)error;
+
+/** @name Looking Up Entities */
+
+/**
+ Returns a stored entity
+ @param entityName The entity name of the collection
+ @param entityId The entity ID
+ @param error The error object to set on error
+ @return The entity, `nil` if it isn't stored or on error
+ */
+- (DKEntity *)entityWithName:(NSString *)entityName entityId:(NSString *)entityId error:(NSError **)error;
+
+/**
+ Returns all stored entities of a collection
+ @param entityName The entity name of the collection
+ @param error The error object to set on error
+ @return The entities, `nil` on error
+ */
+- (NSArray *)entitiesWithName:(NSString *)entityName error:(NSError **)error;
+
+/**
+ Returns the stored entities whose indexed key matches a value
+ @param entityName The entity name of the collection
+ @param key The indexed key
+ @param value The matched string or number value, or an element of array values
+ @param error The error object to set on error
+ @return The matching entities, `nil` if the key isn't indexed or on error
+ */
+- (NSArray *)entitiesWithName:(NSString *)entityName key:(NSString *)key equalTo:(id)value error:(NSError **)error;
+
+/**
+ Returns the stored entities whose indexed key is in a range, in ascending order of the key
+ @param entityName The entity name of the collection
+ @param key The indexed key
+ @param lowerValue The lowest matched value, or `nil` for no lower bound
+ @param upperValue The highest matched value, or `nil` for no upper bound
+ @param limit The maximum number of entities returned, or 0 for no limit
+ @param error The error object to set on error
+ @return The matching entities, `nil` if the key isn't indexed or on error
+ */
+- (NSArray *)entitiesWithName:(NSString *)entityName key:(NSString *)key from:(id)lowerValue to:(id)upperValue
+                        limit:(NSUInteger)limit error:(NSError **)error;
+
+/**
+ Returns the number of stored entities of a collection
+ @param entityName The entity name of the collection
+ @param error The error object to set on error
+ @return The number of entities
+ */
+- (NSUInteger)countOfEntitiesWithName:(NSString *)entityName error:(NSError **)error;
+
++ (id)new UNAVAILABLE_ATTRIBUTE;
+- (id)init UNAVAILABLE_ATTRIBUTE;
+
+@end
@@ -0,0 +1,621 @@
+//
+//  DKEntityStore.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKEntityStore.h"
+#import "DKEntity.h"
+#import "DKEntity-Private.h"
+#import "DKQuery.h"
+#import "DKQuery-Private.h"
+#import "DKQueryEvaluator.h"
+#import "DKBinaryCoder.h"
+#import <sqlite3.h>
+
+#define kDKEntityStoreFileName @"DeploydKit.sqlite"
+
+@interface DKEntityStore ()
+@property (nonatomic, copy, readwrite) NSString *path;
+@end
+
+static BOOL DKIsIndexableValue(id value) {
+  return [value isKindOfClass:[NSString class]] || [value isKindOfClass:[NSNumber class]];
+}
+
+static BOOL DKIsIntegerNumber(NSNumber *number) {
+  if (CFGetTypeID((__bridge CFTypeRef)number) == CFBooleanGetTypeID()) {
+    return YES;
+  }
+  const char *type = [number objCType];
+  return (type[0] != '\0' && strchr("cCsSiIlLqQ", type[0]) != NULL);
+}
+
+static NSArray *DKIndexValuesOfObject(NSDictionary *object, NSString *key) {
+  id value = [DKQueryEvaluator valueForKeyPath:key inObject:object];
+  if (DKIsIndexableValue(value)) {
+    return @[value];
+  }
+  if ([value isKindOfClass:[NSArray class]]) {
+    NSMutableOrderedSet *values = [NSMutableOrderedSet new];
+    for (id element in value) {
+      if (DKIsIndexableValue(element)) {
+        [values addObject:element];
+      }
+    }
+    return values.array;
+  }
+  return @[];
+}
+
+@implementation DKEntityStore {
+@private
+  dispatch_queue_t     queue_;
+  sqlite3             *db_;
+  NSMutableDictionary *statements_;
+  NSMutableDictionary *indexedKeys_;
+}
+
++ (DKEntityStore *)defaultStore {
+  static DKEntityStore *store;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    NSString *directory = [NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES) lastObject];
+    NSString *path = [[directory stringByAppendingPathComponent:@"DeploydKit"] stringByAppendingPathComponent:kDKEntityStoreFileName];
+    store = [[self alloc] initWithPath:path];
+  });
+  return store;
+}
+
+- (id)initWithPath:(NSString *)path {
+  self = [super init];
+  if (self) {
+    self.path = path;
+    queue_ = dispatch_queue_create("DeploydKit entity store queue", DISPATCH_QUEUE_SERIAL);
+    statements_ = [NSMutableDictionary new];
+    indexedKeys_ = [NSMutableDictionary new];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [self closeDatabase];
+  dispatch_release(queue_);
+}
+
+- (void)close {
+  dispatch_sync(queue_, ^{
+    [self closeDatabase];
+  });
+}
+
+#pragma mark Database
+
+- (BOOL)openDatabase:(NSError **)error {
+  if (db_ != NULL) {
+    return YES;
+  }
+
+  [[NSFileManager defaultManager] createDirectoryAtPath:[self.path stringByDeletingLastPathComponent]
+                            withIntermediateDirectories:YES
+                                             attributes:nil
+                                                  error:NULL];
+  if (sqlite3_open_v2(self.path.fileSystemRepresentation, &db_,
+                      SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+    [self writeDatabaseError:error];
+    [self closeDatabase];
+    return NO;
+  }
+
+  // WAL keeps reads from waiting on writes, opening only reads the declared indexes
+  NSArray *schema = @[@"PRAGMA journal_mode = WAL",
+                      @"PRAGMA synchronous = NORMAL",
+                      @"CREATE TABLE IF NOT EXISTS dk_entities (collection TEXT NOT NULL, id TEXT NOT NULL, data BLOB NOT NULL, PRIMARY KEY (collection, id))",
+                      @"CREATE TABLE IF NOT EXISTS dk_indexes (collection TEXT NOT NULL, key TEXT NOT NULL, PRIMARY KEY (collection, key))",
+                      @"CREATE TABLE IF NOT EXISTS dk_index_entries (collection TEXT NOT NULL, key TEXT NOT NULL, value, id TEXT NOT NULL)",
+                      @"CREATE INDEX IF NOT EXISTS dk_index_entries_value ON dk_index_entries (collection, key, value)",
+                      @"CREATE INDEX IF NOT EXISTS dk_index_entries_id ON dk_index_entries (collection, id)"];
+  for (NSString *sql in schema) {
+    if (sqlite3_exec(db_, sql.UTF8String, NULL, NULL, NULL) != SQLITE_OK) {
+      [self writeDatabaseError:error];
+      [self closeDatabase];
+      return NO;
+    }
+  }
+
+  [indexedKeys_ removeAllObjects];
+  return [self querySQL:@"SELECT collection, key FROM dk_indexes" arguments:@[] error:error row:^(sqlite3_stmt *statement, BOOL *stop) {
+    NSString *entityName = [self stringInColumn:0 statement:statement];
+    NSMutableArray *keys = indexedKeys_[entityName];
+    if (keys == nil) {
+      keys = [NSMutableArray new];
+      indexedKeys_[entityName] = keys;
+    }
+    [keys addObject:[self stringInColumn:1 statement:statement]];
+  }];
+}
+
+- (void)closeDatabase {
+  for (NSValue *statement in [statements_ allValues]) {
+    sqlite3_finalize([statement pointerValue]);
+  }
+  [statements_ removeAllObjects];
+  if (db_ != NULL) {
+    sqlite3_close(db_);
+    db_ = NULL;
+  }
+}
+
+- (void)writeDatabaseError:(NSError **)error {
+  NSString *message = (db_ != NULL) ? @(sqlite3_errmsg(db_)) : nil;
+  [NSError writeToError:error
+                   code:DKErrorOperationFailed
+            description:[NSString stringWithFormat:NSLocalizedString(@"Entity store operation failed (%@)", nil), message]
+               original:nil];
+}
+
+- (sqlite3_stmt *)statementForSQL:(NSString *)sql arguments:(NSArray *)arguments error:(NSError **)error {
+  // Statements are prepared once and reused
+  sqlite3_stmt *statement = [statements_[sql] pointerValue];
+  if (statement == NULL) {
+    if (sqlite3_prepare_v2(db_, sql.UTF8String, -1, &statement, NULL) != SQLITE_OK) {
+      [self writeDatabaseError:error];
+      return NULL;
+    }
+    statements_[sql] = [NSValue valueWithPointer:statement];
+  }
+
+  int index = 1;
+  for (id argument in arguments) {
+    if ([argument isKindOfClass:[NSString class]]) {
+      sqlite3_bind_text(statement, index, [argument UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    else if ([argument isKindOfClass:[NSNumber class]]) {
+      if (DKIsIntegerNumber(argument)) {
+        sqlite3_bind_int64(statement, index, [argument longLongValue]);
+      }
+      else {
+        sqlite3_bind_double(statement, index, [argument doubleValue]);
+      }
+    }
+    else if ([argument isKindOfClass:[NSData class]]) {
+      sqlite3_bind_blob(statement, index, [argument bytes], (int)[argument length], SQLITE_TRANSIENT);
+    }
+    else {
+      sqlite3_bind_null(statement, index);
+    }
+    index++;
+  }
+  return statement;
+}
+
+- (void)resetStatement:(sqlite3_stmt *)statement {
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+}
+
+- (BOOL)executeSQL:(NSString *)sql arguments:(NSArray *)arguments error:(NSError **)error {
+  sqlite3_stmt *statement = [self statementForSQL:sql arguments:arguments error:error];
+  if (statement == NULL) {
+    return NO;
+  }
+  int result = sqlite3_step(statement);
+  if (result != SQLITE_DONE && result != SQLITE_ROW) {
+    [self writeDatabaseError:error];
+  }
+  [self resetStatement:statement];
+  return (result == SQLITE_DONE || result == SQLITE_ROW);
+}
+
+- (BOOL)querySQL:(NSString *)sql arguments:(NSArray *)arguments error:(NSError **)error
+             row:(void (^)(sqlite3_stmt *statement, BOOL *stop))block {
+  sqlite3_stmt *statement = [self statementForSQL:sql arguments:arguments error:error];
+  if (statement == NULL) {
+    return NO;
+  }
+  int result = SQLITE_ROW;
+  BOOL stop = NO;
+  while (!stop && (result = sqlite3_step(statement)) == SQLITE_ROW) {
+    block(statement, &stop);
+  }
+  if (!stop && result != SQLITE_DONE) {
+    [self writeDatabaseError:error];
+  }
+  [self resetStatement:statement];
+  return (stop || result == SQLITE_DONE);
+}
+
+- (BOOL)inTransaction:(BOOL (^)(NSError **error))block error:(NSError **)error {
+  if (![self executeSQL:@"BEGIN IMMEDIATE" arguments:@[] error:error]) {
+    return NO;
+  }
+  if (block(error)) {
+    return [self executeSQL:@"COMMIT" arguments:@[] error:error];
+  }
+  [self executeSQL:@"ROLLBACK" arguments:@[] error:NULL];
+  return NO;
+}
+
+- (NSString *)stringInColumn:(int)column statement:(sqlite3_stmt *)statement {
+  const unsigned char *text = sqlite3_column_text(statement, column);
+  return (text != NULL) ? @((const char *)text) : nil;
+}
+
+- (NSDictionary *)objectInColumn:(int)column statement:(sqlite3_stmt *)statement {
+  // The blob is only decoded, it doesn't need to be copied
+  NSData *data = [NSData dataWithBytesNoCopy:(void *)sqlite3_column_blob(statement, column)
+                                      length:sqlite3_column_bytes(statement, column)
+                                freeWhenDone:NO];
+  id object = [DKBinaryCoder JSONObjectWithData:data error:NULL];
+  return [object isKindOfClass:[NSDictionary class]] ? object : nil;
+}
+
+- (DKEntity *)entityWithName:(NSString *)entityName object:(NSDictionary *)object {
+  DKEntity *entity = [[[DKEntity classForEntityName:entityName] alloc] initWithName:entityName];
+  entity.resultMap = object;
+  return entity;
+}
+
+#pragma mark Indexes
+
+- (BOOL)indexObject:(NSDictionary *)object entityId:(NSString *)entityId key:(NSString *)key
+         entityName:(NSString *)entityName error:(NSError **)error {
+  for (id value in DKIndexValuesOfObject(object, key)) {
+    if (![self executeSQL:@"INSERT INTO dk_index_entries (collection, key, value, id) VALUES (?, ?, ?, ?)"
+                arguments:@[entityName, key, value, entityId]
+                    error:error]) {
+      return NO;
+    }
+  }
+  return YES;
+}
+
+- (BOOL)addIndexForKey:(NSString *)key entityName:(NSString *)entityName error:(NSError **)error {
+  __block BOOL success = NO;
+  __block NSError *storeError = nil;
+  dispatch_sync(queue_, ^{
+    NSError *blockError = nil;
+    if (![self openDatabase:&blockError]) {
+      storeError = blockError;
+      return;
+    }
+    if ([indexedKeys_[entityName] containsObject:key]) {
+      success = YES;
+      return;
+    }
+
+    success = [self inTransaction:^BOOL(NSError **transactionError) {
+      if (![self executeSQL:@"INSERT INTO dk_indexes (collection, key) VALUES (?, ?)" arguments:@[entityName, key] error:transactionError]) {
+        return NO;
+      }
+
+      // Index the stored entities
+      NSMutableDictionary *objects = [NSMutableDictionary new];
+      BOOL read = [self querySQL:@"SELECT id, data FROM dk_entities WHERE collection = ?" arguments:@[entityName] error:transactionError row:^(sqlite3_stmt *statement, BOOL *stop) {
+        NSString *entityId = [self stringInColumn:0 statement:statement];
+        NSDictionary *object = [self objectInColumn:1 statement:statement];
+        if (entityId != nil && object != nil) {
+          objects[entityId] = object;
+        }
+      }];
+      if (!read) {
+        return NO;
+      }
+      for (NSString *entityId in objects) {
+        if (![self indexObject:objects[entityId] entityId:entityId key:key entityName:entityName error:transactionError]) {
+          return NO;
+        }
+      }
+      return YES;
+    } error:&blockError];
+
+    if (success) {
+      NSMutableArray *keys = indexedKeys_[entityName];
+      if (keys == nil) {
+        keys = [NSMutableArray new];
+        indexedKeys_[entityName] = keys;
+      }
+      [keys addObject:key];
+    }
+    storeError = blockError;
+  });
+  if (!success && error != NULL) {
+    *error = storeError;
+  }
+  return success;
+}
+
+- (BOOL)removeIndexForKey:(NSString *)key entityName:(NSString *)entityName error:(NSError **)error {
+  __block BOOL success = NO;
+  __block NSError *storeError = nil;
+  dispatch_sync(queue_, ^{
+    NSError *blockError = nil;
+    if (![self openDatabase:&blockError]) {
+      storeError = blockError;
+      return;
+    }
+    success = [self inTransaction:^BOOL(NSError **transactionError) {
+      return ([self executeSQL:@"DELETE FROM dk_indexes WHERE collection = ? AND key = ?" arguments:@[entityName, key] error:transactionError] &&
+              [self executeSQL:@"DELETE FROM dk_index_entries WHERE collection = ? AND key = ?" arguments:@[entityName, key] error:transactionError]);
+    } error:&blockError];
+    if (success) {
+      [indexedKeys_[entityName] removeObject:key];
+    }
+    storeError = blockError;
+  });
+  if (!success && error != NULL) {
+    *error = storeError;
+  }
+  return success;
+}
+
+- (NSArray *)indexedKeysForEntityName:(NSString *)entityName {
+  __block NSArray *keys = nil;
+  dispatch_sync(queue_, ^{
+    if ([self openDatabase:NULL]) {
+      keys = [indexedKeys_[entityName] copy];
+    }
+  });
+  return (keys != nil) ? keys : @[];
+}
+
+#pragma mark Saving
+
+- (BOOL)saveEntities:(NSArray *)entities error:(NSError **)error {
+  if (entities.count == 0) {
+    return YES;
+  }
+
+  __block BOOL success = NO;
+  __block NSError *storeError = nil;
+  dispatch_sync(queue_, ^{
+    NSError *blockError = nil;
+    if (![self openDatabase:&blockError]) {
+      storeError = blockError;
+      return;
+    }
+    success = [self inTransaction:^BOOL(NSError **transactionError) {
+      for (DKEntity *entity in entities) {
+        NSString *entityId = entity.entityId;
+        NSDictionary *object = entity.resultMap;
+        if (entityId.length == 0 || object == nil) {
+          continue;
+        }
+        NSData *data = [DKBinaryCoder dataWithJSONObject:object];
+        if (data == nil) {
+          [NSError writeToError:transactionError
+                           code:DKErrorInvalidParams
+                    description:NSLocalizedString(@"Could not encode entity", nil)
+                       original:nil];
+          return NO;
+        }
+        if (![self executeSQL:@"INSERT OR REPLACE INTO dk_entities (collection, id, data) VALUES (?, ?, ?)"
+                    arguments:@[entity.entityName, entityId, data]
+                        error:transactionError]) {
+          return NO;
+        }
+
+        // Replace the index entries of the entity
+        NSArray *keys = indexedKeys_[entity.entityName];
+        if (keys.count == 0) {
+          continue;
+        }
+        if (![self executeSQL:@"DELETE FROM dk_index_entries WHERE collection = ? AND id = ?"
+                    arguments:@[entity.entityName, entityId]
+                        error:transactionError]) {
+          return NO;
+        }
+        for (NSString *key in keys) {
+          if (![self indexObject:object entityId:entityId key:key entityName:entity.entityName error:transactionError]) {
+            return NO;
+          }
+        }
+      }
+      return YES;
+    } error:&blockError];
+    storeError = blockError;
+  });
+  if (!success && error != NULL) {
+    *error = storeError;
+  }
+  return success;
+}
+
+- (NSArray *)saveResultsOfQuery:(DKQuery *)query error:(NSError **)error {
+  if (query.fieldInclExcl.count > 0) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidParams
+              description:NSLocalizedString(@"Queries including or excluding keys can't be stored", nil)
+                 original:nil];
+    return nil;
+  }
+  NSArray *results = [query findAll:error];
+  if (results == nil || ![self saveEntities:results error:error]) {
+    return nil;
+  }
+  return results;
+}
+
+- (BOOL)removeEntityWithId:(NSString *)entityId entityName:(NSString *)entityName error:(NSError **)error {
+  return [self removeEntitiesWithName:entityName
+                         entitiesSQL:@"DELETE FROM dk_entities WHERE collection = ? AND id = ?"
+                          entriesSQL:@"DELETE FROM dk_index_entries WHERE collection = ? AND id = ?"
+                           arguments:@[entityName, entityId]
+                               error:error];
+}
+
+- (BOOL)removeAllEntitiesWithName:(NSString *)entityName error:(NSError **)error {
+  return [self removeEntitiesWithName:entityName
+                         entitiesSQL:@"DELETE FROM dk_entities WHERE collection = ?"
+                          entriesSQL:@"DELETE FROM dk_index_entries WHERE collection = ?"
+                           arguments:@[entityName]
+                               error:error];
+}
+
+- (BOOL)removeEntitiesWithName:(NSString *)entityName entitiesSQL:(NSString *)entitiesSQL entriesSQL:(NSString *)entriesSQL
+                     arguments:(NSArray *)arguments error:(NSError **)error {
+  __block BOOL success = NO;
+  __block NSError *storeError = nil;
+  dispatch_sync(queue_, ^{
+    NSError *blockError = nil;
+    if (![self openDatabase:&blockError]) {
+      storeError = blockError;
+      return;
+    }
+    success = [self inTransaction:^BOOL(NSError **transactionError) {
+      return ([self executeSQL:entitiesSQL arguments:arguments error:transactionError] &&
+              [self executeSQL:entriesSQL arguments:arguments error:transactionError]);
+    } error:&blockError];
+    storeError = blockError;
+  });
+  if (!success && error != NULL) {
+    *error = storeError;
+  }
+  return success;
+}
+
+#pragma mark Looking Up
+
+- (NSArray *)entitiesWithName:(NSString *)entityName SQL:(NSString *)sql arguments:(NSArray *)arguments
+                        limit:(NSUInteger)limit error:(NSError **)error {
+  __block NSMutableArray *entities = nil;
+  __block NSError *storeError = nil;
+  dispatch_sync(queue_, ^{
+    NSError *blockError = nil;
+    if (![self openDatabase:&blockError]) {
+      storeError = blockError;
+      return;
+    }
+
+    // Entities with several matching array elements are returned once
+    NSMutableArray *results = [NSMutableArray new];
+    NSMutableSet *entityIds = [NSMutableSet new];
+    BOOL success = [self querySQL:sql arguments:arguments error:&blockError row:^(sqlite3_stmt *statement, BOOL *stop) {
+      NSString *entityId = [self stringInColumn:0 statement:statement];
+      if (entityId == nil || [entityIds containsObject:entityId]) {
+        return;
+      }
+      [entityIds addObject:entityId];
+      NSDictionary *object = [self objectInColumn:1 statement:statement];
+      if (object != nil) {
+        [results addObject:[self entityWithName:entityName object:object]];
+      }
+      *stop = (limit > 0 && results.count >= limit);
+    }];
+    if (success) {
+      entities = results;
+    }
+    storeError = blockError;
+  });
+  if (entities == nil && error != NULL) {
+    *error = storeError;
+  }
+  return (entities != nil) ? [NSArray arrayWithArray:entities] : nil;
+}
+
+- (BOOL)checkIndexForKey:(NSString *)key entityName:(NSString *)entityName error:(NSError **)error {
+  if (![[self indexedKeysForEntityName:entityName] containsObject:key]) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidParams
+              description:[NSString stringWithFormat:NSLocalizedString(@"No index for key '%@'", nil), key]
+                 original:nil];
+    return NO;
+  }
+  return YES;
+}
+
+- (DKEntity *)entityWithName:(NSString *)entityName entityId:(NSString *)entityId error:(NSError **)error {
+  if (entityId.length == 0) {
+    return nil;
+  }
+  NSArray *entities = [self entitiesWithName:entityName
+                                         SQL:@"SELECT id, data FROM dk_entities WHERE collection = ? AND id = ?"
+                                   arguments:@[entityName, entityId]
+                                       limit:1
+                                       error:error];
+  return [entities lastObject];
+}
+
+- (NSArray *)entitiesWithName:(NSString *)entityName error:(NSError **)error {
+  return [self entitiesWithName:entityName
+                            SQL:@"SELECT id, data FROM dk_entities WHERE collection = ?"
+                      arguments:@[entityName]
+                          limit:0
+                          error:error];
+}
+
+- (NSArray *)entitiesWithName:(NSString *)entityName key:(NSString *)key equalTo:(id)value error:(NSError **)error {
+  if (!DKIsIndexableValue(value)) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidParams
+              description:NSLocalizedString(@"Indexed values must be strings or numbers", nil)
+                 original:nil];
+    return nil;
+  }
+  if (![self checkIndexForKey:key entityName:entityName error:error]) {
+    return nil;
+  }
+  return [self entitiesWithName:entityName
+                            SQL:@"SELECT e.id, e.data FROM dk_index_entries i JOIN dk_entities e ON e.collection = i.collection AND e.id = i.id "
+                                @"WHERE i.collection = ? AND i.key = ? AND i.value = ?"
+                      arguments:@[entityName, key, value]
+                          limit:0
+                          error:error];
+}
+
+- (NSArray *)entitiesWithName:(NSString *)entityName key:(NSString *)key from:(id)lowerValue to:(id)upperValue
+                        limit:(NSUInteger)limit error:(NSError **)error {
+  if ((lowerValue != nil && !DKIsIndexableValue(lowerValue)) || (upperValue != nil && !DKIsIndexableValue(upperValue))) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidParams
+              description:NSLocalizedString(@"Indexed values must be strings or numbers", nil)
+                 original:nil];
+    return nil;
+  }
+  if (![self checkIndexForKey:key entityName:entityName error:error]) {
+    return nil;
+  }
+
+  NSMutableString *sql = [NSMutableString stringWithString:@"SELECT e.id, e.data FROM dk_index_entries i JOIN dk_entities e ON e.collection = i.collection AND e.id = i.id "
+                                                           @"WHERE i.collection = ? AND i.key = ?"];
+  NSMutableArray *arguments = [NSMutableArray arrayWithObjects:entityName, key, nil];
+  if (lowerValue != nil) {
+    [sql appendString:@" AND i.value >= ?"];
+    [arguments addObject:lowerValue];
+  }
+  if (upperValue != nil) {
+    [sql appendString:@" AND i.value <= ?"];
+    [arguments addObject:upperValue];
+  }
+
+  // Numbers sort before strings, an open range only spans the type of its bound
+  id bound = (lowerValue != nil) ? lowerValue : upperValue;
+  if (bound != nil && (lowerValue == nil || upperValue == nil)) {
+    [sql appendString:[bound isKindOfClass:[NSString class]] ? @" AND typeof(i.value) = 'text'" : @" AND typeof(i.value) IN ('integer', 'real')"];
+  }
+  [sql appendString:@" ORDER BY i.value"];
+
+  return [self entitiesWithName:entityName SQL:sql arguments:arguments limit:limit error:error];
+}
+
+- (NSUInteger)countOfEntitiesWithName:(NSString *)entityName error:(NSError **)error {
+  __block NSUInteger count = 0;
+  __block NSError *storeError = nil;
+  dispatch_sync(queue_, ^{
+    NSError *blockError = nil;
+    if ([self openDatabase:&blockError]) {
+      [self querySQL:@"SELECT COUNT(*) FROM dk_entities WHERE collection = ?" arguments:@[entityName] error:&blockError row:^(sqlite3_stmt *statement, BOOL *stop) {
+        count = (NSUInteger)sqlite3_column_int64(statement, 0);
+      }];
+    }
+    storeError = blockError;
+  });
+  if (storeError != nil && error != NULL) {
+    *error = storeError;
+  }
+  return count;
+}
+
+@end
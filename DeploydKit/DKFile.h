@@ -37,6 +37,44 @@
  */
 @property (nonatomic, strong, readonly) NSData *data;
 
+/**
+ The URL of the local file to upload, `nil` if the file was created with data
+ */
+@property (nonatomic, copy, readonly) NSURL *fileURL;
+
+/**
+ The size of the parts of multipart uploads, 0 (the default) to upload the file in a single request
+
+ Files created with data or a file URL and longer than the part size are uploaded in parts, several
+ at a time, a failed part is retried on its own. S3 requires parts of at least 5 MB, smaller sizes
+ are raised to it.
+ */
+@property (nonatomic, assign) NSUInteger partSize;
+
+/**
+ The number of parts of a multipart upload sent at the same time, 4 by default
+ */
+@property (nonatomic, assign) NSUInteger maxConcurrentParts;
+
+/**
+ The number of times a failed part is sent again before the upload fails, 3 by default
+ */
+@property (nonatomic, assign) NSUInteger maxPartRetries;
+
+/**
+ If `YES` the content hash is looked up before uploading a file without name, and a file with the
+ same contents is reused instead of uploading it again, `NO` by default.
+
+ Reused files are shared, deleting one deletes the file of every entity referencing it. Files
+ created with a stream are always uploaded, files uploaded in parts can't be reused later.
+ */
+@property (nonatomic, assign) BOOL deduplicatesContent;
+
+/**
+ The hex encoded SHA-256 hash of the contents, `nil` until it's computed
+ */
+@property (copy, readonly) NSString *contentHash;
+
 /**
  The cache policy to use for the query
  */
@@ -75,6 +113,27 @@
  */
 + (DKFile *)fileWithName:(NSString *)name data:(NSData *)data;
 
+/**
+ Creates a new file uploading the contents of a local file.
+
+ The contents are streamed from disk on save, they are never loaded in memory.
+ @param name The file name, if `nil` the server will assign a random name.
+ @param fileURL The URL of the local file
+ @return The initialized file
+ */
++ (DKFile *)fileWithName:(NSString *)name contentsOfURL:(NSURL *)fileURL;
+
+/**
+ Creates a new file uploading the bytes read from a stream.
+
+ The stream is read on save, it can only be saved once.
+ @param name The file name, if `nil` the server will assign a random name.
+ @param inputStream The unopened stream to upload
+ @param length The number of bytes of the stream
+ @return The initialized file
+ */
++ (DKFile *)fileWithName:(NSString *)name inputStream:(NSInputStream *)inputStream length:(unsigned long long)length;
+
 /**
  Initializes a new file with the given data and name.
  
@@ -89,6 +148,8 @@
 
 /**
  Checks if a file with the specified name exists.
+
+ The check is a HEAD request answered from the S3 object metadata, the file isn't downloaded.
  @param fileName The file name to check
  @return `YES` if the file exists, `NO` if it doesn't
  */
@@ -109,6 +170,48 @@
  */
 + (void)fileExists:(NSString *)fileName inBackgroundWithBlock:(void (^)(BOOL exists, NSError *error))block;
 
+/** @name Reading Metadata */
+
+/**
+ Returns the metadata of a file, with a HEAD request.
+
+ The metadata has the `kDKFileMetadataSize`, `kDKFileMetadataETag`, `kDKFileMetadataLastModified`
+ (an NSDate) and `kDKFileMetadataContentType` keys, the ETag changes when the contents change.
+ @param fileName The file name
+ @param error The error object set on error
+ @return The metadata, `nil` if the file doesn't exist or on error
+ @exception NSInternalInconsistencyException Raised if the file name is empty
+ */
++ (NSDictionary *)metadataOfFile:(NSString *)fileName error:(NSError **)error;
+
+/**
+ Returns the metadata of many files, checking their existence in batches.
+
+ The server checks up to 100 names per request, concurrently.
+ @param fileNames The file names
+ @param error The error object set on error
+ @return The metadata by file name, files that don't exist aren't in it, `nil` on error
+ */
++ (NSDictionary *)metadataOfFiles:(NSArray *)fileNames error:(NSError **)error;
+
+/**
+ Returns the metadata of many files in the background
+ @param fileNames The file names
+ @param block The result callback
+ */
++ (void)metadataOfFiles:(NSArray *)fileNames inBackgroundWithBlock:(void (^)(NSDictionary *metadata, NSError *error))block;
+
+/** @name Hashing Contents */
+
+/**
+ Computes the content hash on a background queue, reading files in chunks.
+
+ Calling it before saving keeps the hash off the save, it's computed once.
+ @param block The result callback, `contentHash` is `nil` on error
+ @exception NSInternalInconsistencyException Raised if data or file URL is not set
+ */
+- (void)computeContentHashInBackgroundWithBlock:(void (^)(NSString *contentHash, NSError *error))block;
+
 /** @name Deleting Files */
 
 /**
@@ -143,7 +246,7 @@
 /**
  Saves the current file
  @return `YES` if the file was saved, otherwise `NO`.
- @exception NSInternalInconsistencyException Raised if data is not set
+ @exception NSInternalInconsistencyException Raised if data, file URL or stream is not set
  */
 - (BOOL)save;
 
@@ -151,17 +254,26 @@
  Saves the current file
  @param error The error object set on error
  @return `YES` if the file was saved, otherwise `NO`.
- @exception NSInternalInconsistencyException Raised if data is not set
+ @exception NSInternalInconsistencyException Raised if data, file URL or stream is not set
  */
 - (BOOL)save:(NSError **)error;
 
 /**
  Saves the current file in the background
  @param block The result block
- @exception NSInternalInconsistencyException Raised if data is not set
+ @exception NSInternalInconsistencyException Raised if data, file URL or stream is not set
  */
 - (void)saveInBackgroundWithBlock:(void (^)(BOOL success, NSError *error))block;
 
+/**
+ Saves the current file in the background, reporting the upload progress
+ @param block The result block
+ @param progressBlock The progress block, called with the number of bytes sent and the total
+ @exception NSInternalInconsistencyException Raised if data, file URL or stream is not set
+ */
+- (void)saveInBackgroundWithBlock:(void (^)(BOOL success, NSError *error))block
+                    progressBlock:(void (^)(long long bytesSent, long long totalBytes))progressBlock;
+
 /** @name Loading Data */
 
 /**
@@ -186,4 +298,42 @@
  */
 - (void)loadDataInBackgroundWithBlock:(void (^)(BOOL success, NSData *data, NSError *error))block;
 
+/** @name Downloading Files */
+
+/**
+ Downloads the file to disk, streaming it without buffering it in memory.
+
+ The download is written to a partial file next to the destination. An interrupted download is
+ resumed from the bytes already received with an HTTP range request, conditional on the ETag or
+ Last-Modified date of the first response, a file changed in between is downloaded again. Downloads
+ of the same file run one at a time. Completed downloads are reused according to the cache policy
+ and the maximum cache age.
+ @param error The error object set on error
+ @return The URL of the downloaded file, `nil` on error
+ @exception NSInternalInconsistencyException Raised if name is not set
+ */
+- (NSURL *)loadFile:(NSError **)error;
+
+/**
+ Downloads the file to disk and maps it in memory
+ @param error The error object set on error
+ @return The memory-mapped file data, `nil` on error
+ @exception NSInternalInconsistencyException Raised if name is not set
+ */
+- (NSData *)loadMappedData:(NSError **)error;
+
+/**
+ Downloads the file to disk in the background, reporting the download progress
+ @param block The result callback block
+ @param progressBlock The progress block, called with the number of bytes received and the total, or -1 if unknown
+ @exception NSInternalInconsistencyException Raised if name is not set
+ */
+- (void)loadFileInBackgroundWithBlock:(void (^)(NSURL *fileURL, NSError *error))block
+                        progressBlock:(void (^)(long long bytesReceived, long long totalBytes))progressBlock;
+
+/**
+ Removes the completed and partial downloads, called by <DKManager> `clearAllCachedResults`
+ */
++ (void)removeDownloadedFiles;
+
 @end
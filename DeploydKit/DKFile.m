@@ -14,14 +14,25 @@
 #import "DKManager.h"
 #import "DKRequest.h"
 #import "DKNetworkActivity.h"
+#import "DKConnection.h"
 #import "NSURLConnection+Timeout.h"
 #import "EGOCache.h"
+#import <CommonCrypto/CommonDigest.h>
+
+#define kDKFileDownloadDirectory @"DeploydKit-Files"
+#define kDKFileMinPartSize (5 * 1024 * 1024)
+#define kDKFileHashChunkSize (1024 * 1024)
+#define kDKFileMaxNamesPerExistsRequest 100
 
 @interface DKFile ()
     @property (nonatomic, assign, readwrite) BOOL isVolatile;
     @property (nonatomic, assign, readwrite) BOOL isLoading;
     @property (nonatomic, copy, readwrite) NSString *name;
     @property (nonatomic, strong, readwrite) NSData *data;
+    @property (nonatomic, copy, readwrite) NSURL *fileURL;
+    @property (nonatomic, strong) NSInputStream *inputStream;
+    @property (nonatomic, assign) unsigned long long inputStreamLength;
+    @property (copy, readwrite) NSString *contentHash;
 @end
 
 @implementation DKFile
@@ -38,6 +49,19 @@
   return [[self alloc] initWithName:name data:data];
 }
 
++ (DKFile *)fileWithName:(NSString *)name contentsOfURL:(NSURL *)fileURL {
+  DKFile *file = [[self alloc] initWithName:name data:nil];
+  file.fileURL = fileURL;
+  return file;
+}
+
++ (DKFile *)fileWithName:(NSString *)name inputStream:(NSInputStream *)inputStream length:(unsigned long long)length {
+  DKFile *file = [[self alloc] initWithName:name data:nil];
+  file.inputStream = inputStream;
+  file.inputStreamLength = length;
+  return file;
+}
+
 - (id)initWithName:(NSString *)name data:(NSData *)data {
   self = [self init];
   if (self) {
@@ -46,6 +70,8 @@
     self.isVolatile = YES;
     self.cachePolicy = DKCachePolicyIgnoreCache;
     self.maxCacheAge = [EGOCache globalCache].defaultTimeoutInterval;
+    self.maxConcurrentParts = 4;
+    self.maxPartRetries = 3;
   }
   return self;
 }
@@ -55,56 +81,191 @@
 }
 
 + (BOOL)fileExists:(NSString *)fileName error:(NSError **)error {
+  return ([self metadataOfFile:fileName error:error] != nil);
+}
+
++ (void)fileExists:(NSString *)fileName inBackgroundWithBlock:(void (^)(BOOL exists, NSError *error))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    BOOL exists = [self fileExists:fileName error:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(exists, error); 
+      });
+    }
+  });
+}
 
+#pragma mark Metadata
+
++ (NSDateFormatter *)HTTPDateFormatter {
+  // Formatters aren't thread safe, each request uses its own
+  NSDateFormatter *formatter = [NSDateFormatter new];
+  formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+  formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+  formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+  return formatter;
+}
+
++ (NSDictionary *)metadataWithFileSize:(id)fileSize etag:(id)etag lastModified:(id)lastModified contentType:(id)contentType
+                         dateFormatter:(NSDateFormatter *)formatter {
+  NSMutableDictionary *metadata = [NSMutableDictionary new];
+  if ([fileSize respondsToSelector:@selector(longLongValue)]) {
+    metadata[kDKFileMetadataSize] = @([fileSize longLongValue]);
+  }
+  if ([etag isKindOfClass:[NSString class]]) {
+    metadata[kDKFileMetadataETag] = etag;
+  }
+  NSDate *date = [lastModified isKindOfClass:[NSString class]] ? [formatter dateFromString:lastModified] : nil;
+  if (date != nil) {
+    metadata[kDKFileMetadataLastModified] = date;
+  }
+  if ([contentType isKindOfClass:[NSString class]]) {
+    metadata[kDKFileMetadataContentType] = contentType;
+  }
+  return metadata;
+}
+
++ (NSDictionary *)metadataOfFile:(NSString *)fileName error:(NSError **)error {
   // Check for file name
   if (fileName.length == 0) {
-        [NSException raise:NSInternalInconsistencyException
-                    format:NSLocalizedString(@"Invalid filename", nil)];
-        return NO;
+    [NSException raise:NSInternalInconsistencyException
+                format:NSLocalizedString(@"Invalid filename", nil)];
+    return nil;
   }
-    
-  // Send request synchronously
-  DKRequest *request = [DKRequest request];
-  request.cachePolicy = DKCachePolicyIgnoreCache;
+  
+  NSString *ep = [[[DKManager APIEndpoint] stringByAppendingPathComponent:kDKRequestFileHandler] stringByAppendingPathComponent:fileName];
+  NSMutableURLRequest *req = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:ep]];
+  req.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
+  req.HTTPMethod = @"HEAD";
+  
+  if ([DKManager requestLogEnabled]) {
+    NSLog(@"[FILE] HEAD '%@'", fileName);
+  }
+  
+  [DKNetworkActivity begin];
+  NSError *reqError = nil;
+  NSHTTPURLResponse *response = nil;
+  [NSURLConnection sendSynchronousRequest:req returningResponse:&response timeout:20.0 error:&reqError];
+  [DKNetworkActivity end];
+  
+  if (reqError != nil || response == nil) {
+    [NSError writeToError:error
+                     code:DKErrorConnectionFailed
+              description:NSLocalizedString(@"Connection failed", nil)
+                 original:reqError];
+    return nil;
+  }
+  if (response.statusCode == 404) {
+    return nil;
+  }
+  if (response.statusCode != 200) {
+    [NSError writeToError:error
+                     code:DKErrorUnknownStatus
+              description:[NSString stringWithFormat:NSLocalizedString(@"Unknown response (%i)", nil), response.statusCode]
+                 original:nil];
+    return nil;
+  }
+  
+  NSDictionary *headers = response.allHeaderFields;
+  return [self metadataWithFileSize:[self valueOfHeader:@"Content-Length" inHeaders:headers]
+                               etag:[self valueOfHeader:@"ETag" inHeaders:headers]
+                       lastModified:[self valueOfHeader:@"Last-Modified" inHeaders:headers]
+                        contentType:[self valueOfHeader:@"Content-Type" inHeaders:headers]
+                      dateFormatter:[self HTTPDateFormatter]];
+}
 
-  NSDictionary *requestDict = @{kDKRequestAssignedFileName: fileName};
-  NSMutableString * queryParams = [NSMutableString stringWithString:kDKRequestFileCollection];
-    
-  NSError *requestError = nil;
-  id results = [request sendRequestWithObject:requestDict method:@"query" entity:queryParams error:&requestError];
-  if (requestError != nil) {
-    if (error != nil) {
-        *error = requestError;
++ (NSString *)valueOfHeader:(NSString *)name inHeaders:(NSDictionary *)headers {
+  // Header names are case insensitive
+  for (NSString *key in headers) {
+    if ([key caseInsensitiveCompare:name] == NSOrderedSame) {
+      return headers[key];
     }
-    return NO;
   }
-   
-  if ([results isKindOfClass:[NSArray class]]) {
-    for (NSDictionary *objDict in results) {
-        if ([objDict isKindOfClass:[NSDictionary class]]) {
-                NSString *resultFileName = objDict[kDKRequestAssignedFileName];
-                return [fileName isEqualToString: resultFileName];
-        }
+  return nil;
+}
+
++ (NSDictionary *)metadataOfFiles:(NSArray *)fileNames error:(NSError **)error {
+  NSMutableDictionary *metadata = [NSMutableDictionary new];
+  NSDateFormatter *formatter = [self HTTPDateFormatter];
+  NSString *ep = [[[DKManager APIEndpoint] stringByAppendingPathComponent:kDKRequestFileHandler] stringByAppendingPathComponent:kDKRequestFileExists];
+  
+  // The server checks a limited number of names per request
+  for (NSUInteger i = 0; i < fileNames.count; i += kDKFileMaxNamesPerExistsRequest) {
+    NSArray *names = [fileNames subarrayWithRange:NSMakeRange(i, MIN(kDKFileMaxNamesPerExistsRequest, fileNames.count - i))];
+    NSData *body = [NSJSONSerialization dataWithJSONObject:names options:0 error:NULL];
+    
+    NSMutableURLRequest *req = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:ep]];
+    req.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
+    req.HTTPMethod = @"POST";
+    req.HTTPBody = body;
+    // The module reads the body itself
+    [req setValue:@"application/octet-stream" forHTTPHeaderField:@"Content-Type"];
+    
+    [DKRequest logData:body isOut:YES isCached:NO];
+    
+    [DKNetworkActivity begin];
+    NSError *reqError = nil;
+    NSHTTPURLResponse *response = nil;
+    NSData *data = [NSURLConnection sendSynchronousRequest:req returningResponse:&response timeout:20.0 error:&reqError];
+    [DKNetworkActivity end];
+    
+    if (reqError != nil || response == nil) {
+      [NSError writeToError:error
+                       code:DKErrorConnectionFailed
+                description:NSLocalizedString(@"Connection failed", nil)
+                   original:reqError];
+      return nil;
     }
-  }
     
-  return NO;
+    NSError *responseError = nil;
+    id result = [DKRequest parseResponse:response withData:data error:&responseError isCached:NO];
+    if (responseError != nil) {
+      if (error != NULL) {
+        *error = responseError;
+      }
+      return nil;
+    }
+    if (![result isKindOfClass:[NSDictionary class]]) {
+      [NSError writeToError:error
+                       code:DKErrorInvalidResponse
+                description:NSLocalizedString(@"Could not read file metadata", nil)
+                   original:nil];
+      return nil;
+    }
+    
+    for (NSString *fileName in result) {
+      NSDictionary *fileMetadata = result[fileName];
+      if ([fileMetadata isKindOfClass:[NSDictionary class]]) {
+        metadata[fileName] = [self metadataWithFileSize:fileMetadata[kDKFileMetadataSize]
+                                                   etag:fileMetadata[kDKFileMetadataETag]
+                                           lastModified:fileMetadata[kDKFileMetadataLastModified]
+                                            contentType:fileMetadata[kDKFileMetadataContentType]
+                                          dateFormatter:formatter];
+      }
+    }
+  }
+  return metadata;
 }
 
-+ (void)fileExists:(NSString *)fileName inBackgroundWithBlock:(void (^)(BOOL exists, NSError *error))block {
++ (void)metadataOfFiles:(NSArray *)fileNames inBackgroundWithBlock:(void (^)(NSDictionary *metadata, NSError *error))block {
   block = [block copy];
   dispatch_queue_t q = dispatch_get_current_queue();
   dispatch_async([DKManager queue], ^{
     NSError *error = nil;
-    BOOL exists = [self fileExists:fileName error:&error];
+    NSDictionary *metadata = [self metadataOfFiles:fileNames error:&error];
     if (block != NULL) {
       dispatch_async(q, ^{
-        block(exists, error); 
+        block(metadata, error);
       });
     }
   });
 }
 
+#pragma mark Deleting
+
 + (BOOL)deleteFile:(NSString *)fileName error:(NSError **)error {
     // Create the request
     DKRequest *request = [DKRequest request];
@@ -145,13 +306,144 @@
   });
 }
 
-- (BOOL)saveSynchronous:(BOOL)saveSync //TODO: saveSync ignored
-            resultBlock:(void (^)(BOOL success, NSError *error))resultBlock
-                  error:(NSError **)error {
-  // Check if data is set
-  if (self.data.length == 0) {
+- (unsigned long long)bodyLength {
+  if (self.data != nil) {
+    return self.data.length;
+  }
+  if (self.fileURL != nil) {
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:self.fileURL.path error:NULL];
+    return attributes.fileSize;
+  }
+  return (self.inputStream != nil) ? self.inputStreamLength : 0;
+}
+
+- (void)checkBody {
+  if ([self bodyLength] == 0) {
     [NSException raise:NSInternalInconsistencyException format:NSLocalizedString(@"Cannot save file with no data set", nil)];
-    return NO;
+  }
+}
+
+#pragma mark Content Hashing
+
+- (NSString *)computeContentHash:(NSError **)error {
+  NSString *contentHash = self.contentHash;
+  if (contentHash != nil) {
+    return contentHash;
+  }
+  
+  // Streams can only be read once, files are hashed a chunk at a time
+  CC_SHA256_CTX context;
+  CC_SHA256_Init(&context);
+  if (self.data != nil) {
+    const uint8_t *bytes = self.data.bytes;
+    NSUInteger length = self.data.length;
+    for (NSUInteger offset = 0; offset < length; offset += kDKFileHashChunkSize) {
+      CC_SHA256_Update(&context, bytes + offset, (CC_LONG)MIN(kDKFileHashChunkSize, length - offset));
+    }
+  }
+  else if (self.fileURL != nil) {
+    NSInputStream *stream = [NSInputStream inputStreamWithURL:self.fileURL];
+    uint8_t *buffer = malloc(kDKFileHashChunkSize);
+    NSInteger result = 0;
+    [stream open];
+    while ((result = [stream read:buffer maxLength:kDKFileHashChunkSize]) > 0) {
+      CC_SHA256_Update(&context, buffer, (CC_LONG)result);
+    }
+    free(buffer);
+    NSError *streamError = stream.streamError;
+    [stream close];
+    if (result < 0 || stream == nil) {
+      [NSError writeToError:error
+                       code:DKErrorOperationFailed
+                description:NSLocalizedString(@"Could not read file", nil)
+                   original:streamError];
+      return nil;
+    }
+  }
+  else {
+    return nil;
+  }
+  
+  unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+  CC_SHA256_Final(digest, &context);
+  NSMutableString *hexHash = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+  for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+    [hexHash appendFormat:@"%02x", digest[i]];
+  }
+  self.contentHash = hexHash;
+  return hexHash;
+}
+
+- (void)computeContentHashInBackgroundWithBlock:(void (^)(NSString *contentHash, NSError *error))block {
+  if (self.data == nil && self.fileURL == nil) {
+    [NSException raise:NSInternalInconsistencyException format:NSLocalizedString(@"Cannot hash file with no data or file URL set", nil)];
+  }
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  // Hashing doesn't wait for the requests on the manager queue
+  dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+    NSError *error = nil;
+    NSString *contentHash = [self computeContentHash:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(contentHash, error);
+      });
+    }
+  });
+}
+
+- (NSString *)fileNameWithContentHash:(NSString *)contentHash {
+  DKRequest *request = [DKRequest request];
+  request.cachePolicy = DKCachePolicyIgnoreCache;
+  
+  NSDictionary *requestDict = @{kDKRequestFileContentHash: contentHash, @"$limit": @1};
+  
+  // A failed lookup uploads the file
+  NSError *requestError = nil;
+  id results = [request sendRequestWithObject:requestDict method:@"query" entity:kDKRequestFileCollection error:&requestError];
+  if (requestError != nil || ![results isKindOfClass:[NSArray class]]) {
+    return nil;
+  }
+  for (NSDictionary *objDict in results) {
+    if ([objDict isKindOfClass:[NSDictionary class]]) {
+      NSString *fileName = objDict[kDKRequestAssignedFileName];
+      if ([fileName isKindOfClass:[NSString class]] && fileName.length > 0) {
+        return fileName;
+      }
+    }
+  }
+  return nil;
+}
+
+#pragma mark Saving
+
+- (BOOL)saveWithProgressBlock:(void (^)(long long bytesSent, long long totalBytes))progressBlock error:(NSError **)error {
+  // Check if data is set
+  [self checkBody];
+  unsigned long long length = [self bodyLength];
+  
+  // Contents already on the server are reused instead of being sent again
+  NSString *contentHash = self.contentHash;
+  if (self.deduplicatesContent && self.name.length == 0 && self.inputStream == nil) {
+    contentHash = [self computeContentHash:NULL];
+    NSString *fileName = (contentHash != nil) ? [self fileNameWithContentHash:contentHash] : nil;
+    if (fileName != nil) {
+      if ([DKManager requestLogEnabled]) {
+        NSLog(@"[FILE] save '%@' (%llu bytes, reused)", fileName, length);
+      }
+      self.name = fileName;
+      self.isVolatile = NO;
+      if (progressBlock != NULL) {
+        progressBlock((long long)length, (long long)length);
+      }
+      return YES;
+    }
+  }
+  
+  // Large files and data are uploaded in parts, streams can only be read once
+  NSUInteger partSize = (self.partSize > 0) ? MAX(self.partSize, kDKFileMinPartSize) : 0;
+  if (partSize > 0 && length > partSize && self.inputStream == nil) {
+    return [self saveInPartsOfSize:partSize length:length progressBlock:progressBlock error:error];
   }
     
   // Create url request
@@ -164,32 +456,69 @@
   NSMutableURLRequest *req = [NSMutableURLRequest requestWithURL:URL];
   
   req.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
-  req.HTTPBody = self.data;
   req.HTTPMethod = @"POST";
   
-  NSString *contentLen = [NSString stringWithFormat:@"%u", self.data.length];
+  // Files and streams are sent as a streamed body, only a buffer of it is in memory
+  NSURL *fileURL = self.fileURL;
+  if (self.data != nil) {
+    req.HTTPBody = self.data;
+  }
+  else if (fileURL != nil) {
+    req.HTTPBodyStream = [NSInputStream inputStreamWithURL:fileURL];
+  }
+  else {
+    req.HTTPBodyStream = self.inputStream;
+    self.inputStream = nil;
+  }
+  
+  NSString *contentLen = [NSString stringWithFormat:@"%llu", length];
   
   [req setValue:contentLen forHTTPHeaderField:@"Content-Length"];
   [req setValue:@"application/octet-stream" forHTTPHeaderField:@"Content-Type"];
   
+  // The server records the hash if it matches the received bytes
+  if (contentHash != nil) {
+    [req setValue:contentHash forHTTPHeaderField:kDKRequestFileContentHashHeader];
+  }
+  
   // Log
   if ([DKManager requestLogEnabled]) {
-    NSLog(@"[FILE] save '%@' (%u bytes)", self.name, self.data.length);
+    NSLog(@"[FILE] save '%@' (%llu bytes%@)", self.name, length, (self.data != nil ? @"" : @", streamed"));
   }
   
   // Start network activity indicator
   self.isLoading = YES;
   [DKNetworkActivity begin];
   
-  // Save synchronous
+  // Save synchronous, the timeout applies to inactivity
+  DKConnection *connection = [[DKConnection alloc] initWithRequest:req];
+  if (progressBlock != NULL) {
+    // The expected total of streamed bodies isn't always known to the connection
+    connection.uploadProgressBlock = ^(long long bytesSent, long long totalBytes) {
+      progressBlock(bytesSent, (long long)length);
+    };
+  }
+  if (fileURL != nil) {
+    connection.bodyStreamBlock = ^NSInputStream *{
+      return [NSInputStream inputStreamWithURL:fileURL];
+    };
+  }
   NSError *reqError = nil;
   NSHTTPURLResponse *response = nil;
-  NSData *data = [NSURLConnection sendSynchronousRequest:req returningResponse:&response timeout:20.0 error:&reqError];
+  NSData *data = [connection sendSynchronousReturningResponse:&response timeout:20.0 error:&reqError];
     
   // End network activity
   self.isLoading = NO;
   [DKNetworkActivity end];
     
+  if (reqError != nil) {
+    [NSError writeToError:error
+                     code:DKErrorConnectionFailed
+              description:NSLocalizedString(@"Connection failed", nil)
+                 original:reqError];
+    return NO;
+  }
+    
   [DKRequest logData:data isOut:NO isCached:NO];
     
   // Parse response
@@ -201,7 +530,7 @@
                                                 options:NSJSONReadingAllowFragments
                                                   error:&JSONError];
   }
-  if (JSONError != nil) {   //TODO: check reqError
+  if (JSONError != nil) {
     [NSError writeToError:error
                      code:DKErrorInvalidResponse
               description:NSLocalizedString(@"Could not deserialize JSON response", nil)
@@ -211,28 +540,243 @@
     self.name = resultObj[kDKRequestAssignedFileName];
     if(!self.name) return NO;
     self.isVolatile = NO;
-    if(resultBlock) resultBlock(YES,nil);
     return YES;
   }
-  else{
-    if(resultBlock) resultBlock(NO,*error);
-  }
   
   return NO;
 }
 
+#pragma mark Multipart Uploads
+
+- (id)sendMultipartRequestWithMethod:(NSString *)method path:(NSString *)path body:(NSData *)body
+                       progressBlock:(void (^)(long long bytesSent, long long totalBytes))progressBlock
+                               error:(NSError **)error {
+  NSString *ep = [[[DKManager APIEndpoint] stringByAppendingPathComponent:kDKRequestFileHandler] stringByAppendingFormat:@"/%@", path];
+  NSMutableURLRequest *req = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:[ep stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]]];
+  req.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
+  req.HTTPMethod = method;
+  if (body != nil) {
+    req.HTTPBody = body;
+    [req setValue:[NSString stringWithFormat:@"%u", body.length] forHTTPHeaderField:@"Content-Length"];
+    [req setValue:@"application/octet-stream" forHTTPHeaderField:@"Content-Type"];
+  }
+  
+  if ([DKManager requestLogEnabled]) {
+    NSLog(@"[FILE] %@ '%@'%@", method, path, (body != nil ? [NSString stringWithFormat:@" (%u bytes)", body.length] : @""));
+  }
+  
+  DKConnection *connection = [[DKConnection alloc] initWithRequest:req];
+  connection.uploadProgressBlock = progressBlock;
+  NSError *reqError = nil;
+  NSHTTPURLResponse *response = nil;
+  NSData *data = [connection sendSynchronousReturningResponse:&response timeout:20.0 error:&reqError];
+  if (reqError != nil) {
+    [NSError writeToError:error
+                     code:DKErrorConnectionFailed
+              description:NSLocalizedString(@"Connection failed", nil)
+                 original:reqError];
+    return nil;
+  }
+  
+  NSError *responseError = nil;
+  id resultObj = [DKRequest parseResponse:response withData:data error:&responseError isCached:NO];
+  if (responseError != nil) {
+    if (error != NULL) {
+      *error = responseError;
+    }
+    return nil;
+  }
+  return resultObj;
+}
+
+- (NSData *)bodyPartAtOffset:(unsigned long long)offset length:(NSUInteger)length {
+  if (self.data != nil) {
+    // The data is retained until the upload ends
+    return [NSData dataWithBytesNoCopy:(uint8_t *)self.data.bytes + offset length:length freeWhenDone:NO];
+  }
+  NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingFromURL:self.fileURL error:NULL];
+  [fileHandle seekToFileOffset:offset];
+  NSData *part = [fileHandle readDataOfLength:length];
+  [fileHandle closeFile];
+  return (part.length == length) ? part : nil;
+}
+
+- (BOOL)saveInPartsOfSize:(NSUInteger)partSize length:(unsigned long long)length
+            progressBlock:(void (^)(long long bytesSent, long long totalBytes))progressBlock
+                    error:(NSError **)error {
+  NSUInteger partCount = (NSUInteger)((length + partSize - 1) / partSize);
+  if ([DKManager requestLogEnabled]) {
+    NSLog(@"[FILE] save '%@' (%llu bytes, %u parts)", self.name, length, partCount);
+  }
+  
+  self.isLoading = YES;
+  [DKNetworkActivity begin];
+  
+  // The server assigns the file name
+  NSError *uploadError = nil;
+  NSString *path = [NSString stringWithFormat:@"%@?fileSize=%llu", kDKRequestFileMultipart, length];
+  NSDictionary *upload = [self sendMultipartRequestWithMethod:@"POST" path:path body:nil progressBlock:NULL error:&uploadError];
+  NSString *fileName = nil;
+  NSString *uploadId = nil;
+  if ([upload isKindOfClass:[NSDictionary class]]) {
+    fileName = upload[kDKRequestAssignedFileName];
+    uploadId = upload[@"uploadId"];
+  }
+  if (uploadError == nil && (fileName.length == 0 || uploadId.length == 0)) {
+    [NSError writeToError:&uploadError
+                     code:DKErrorInvalidResponse
+              description:NSLocalizedString(@"Could not start multipart upload", nil)
+                 original:nil];
+  }
+  
+  if (uploadError == nil) {
+    // Parts are sent a few at a time, the first part failing after its retries stops the upload
+    NSObject *lock = [NSObject new];
+    long long *partBytesSent = calloc(partCount, sizeof(long long));
+    __block NSError *partsError = nil;
+    dispatch_semaphore_t slots = dispatch_semaphore_create(MAX(self.maxConcurrentParts, 1));
+    dispatch_group_t group = dispatch_group_create();
+    
+    for (NSUInteger i = 0; i < partCount; i++) {
+      dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+      BOOL failed = NO;
+      @synchronized(lock) {
+        failed = (partsError != nil);
+      }
+      if (failed) {
+        dispatch_semaphore_signal(slots);
+        break;
+      }
+      
+      dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        unsigned long long offset = (unsigned long long)i * partSize;
+        NSUInteger partLength = (NSUInteger)MIN((unsigned long long)partSize, length - offset);
+        NSString *partPath = [NSString stringWithFormat:@"%@/%@?partNumber=%u&uploadId=%@", kDKRequestFileMultipart, fileName, i + 1, uploadId];
+        void (^partProgressBlock)(long long, long long) = ^(long long bytesSent, long long totalBytes) {
+          long long sent = 0;
+          @synchronized(lock) {
+            partBytesSent[i] = bytesSent;
+            for (NSUInteger j = 0; j < partCount; j++) {
+              sent += partBytesSent[j];
+            }
+          }
+          if (progressBlock != NULL) {
+            progressBlock(sent, (long long)length);
+          }
+        };
+        
+        NSError *partError = nil;
+        BOOL uploaded = NO;
+        for (NSUInteger attempt = 0; !uploaded && attempt <= self.maxPartRetries; attempt++) {
+          if (attempt > 0) {
+            // Back off before retrying
+            partProgressBlock(0, partLength);
+            [NSThread sleepForTimeInterval:attempt];
+          }
+          NSData *body = [self bodyPartAtOffset:offset length:partLength];
+          if (body == nil) {
+            partError = nil;
+            [NSError writeToError:&partError
+                             code:DKErrorOperationFailed
+                      description:NSLocalizedString(@"Could not read file", nil)
+                         original:nil];
+            break;
+          }
+          partError = nil;
+          NSDictionary *result = [self sendMultipartRequestWithMethod:@"PUT" path:partPath body:body progressBlock:partProgressBlock error:&partError];
+          uploaded = ([result isKindOfClass:[NSDictionary class]] && result[@"etag"] != nil);
+          if (!uploaded && partError == nil) {
+            [NSError writeToError:&partError
+                             code:DKErrorInvalidResponse
+                      description:NSLocalizedString(@"Could not upload part", nil)
+                         original:nil];
+          }
+        }
+        if (!uploaded) {
+          @synchronized(lock) {
+            if (partsError == nil) {
+              partsError = partError;
+            }
+          }
+        }
+        dispatch_semaphore_signal(slots);
+      });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    dispatch_release(group);
+    dispatch_release(slots);
+    free(partBytesSent);
+    uploadError = partsError;
+    
+    // S3 assembles the parts
+    if (uploadError == nil) {
+      path = [NSString stringWithFormat:@"%@/%@/complete?uploadId=%@&parts=%u", kDKRequestFileMultipart, fileName, uploadId, partCount];
+      NSDictionary *result = [self sendMultipartRequestWithMethod:@"POST" path:path body:nil progressBlock:NULL error:&uploadError];
+      if (uploadError == nil && ![result isKindOfClass:[NSDictionary class]]) {
+        [NSError writeToError:&uploadError
+                         code:DKErrorInvalidResponse
+                  description:NSLocalizedString(@"Could not complete multipart upload", nil)
+                     original:nil];
+      }
+    }
+    
+    // Discard the uploaded parts and the file entry
+    if (uploadError != nil) {
+      path = [NSString stringWithFormat:@"%@/%@?uploadId=%@", kDKRequestFileMultipart, fileName, uploadId];
+      [self sendMultipartRequestWithMethod:@"DELETE" path:path body:nil progressBlock:NULL error:NULL];
+    }
+  }
+  
+  self.isLoading = NO;
+  [DKNetworkActivity end];
+  
+  if (uploadError != nil) {
+    if (error != NULL) {
+      *error = uploadError;
+    }
+    return NO;
+  }
+  self.name = fileName;
+  self.isVolatile = NO;
+  return YES;
+}
+
 - (BOOL)save {
   return [self save:NULL];
 }
 
 - (BOOL)save:(NSError **)error {
-  return [self saveSynchronous:YES resultBlock:NULL error:error];
+  return [self saveWithProgressBlock:NULL error:error];
 }
 
 - (void)saveInBackgroundWithBlock:(void (^)(BOOL success, NSError *error))block {
-  [self saveSynchronous:NO resultBlock:block error:NULL];
+  [self saveInBackgroundWithBlock:block progressBlock:NULL];
 }
 
+- (void)saveInBackgroundWithBlock:(void (^)(BOOL success, NSError *error))block
+                    progressBlock:(void (^)(long long bytesSent, long long totalBytes))progressBlock {
+  [self checkBody];
+  block = [block copy];
+  progressBlock = [progressBlock copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  void (^queueProgressBlock)(long long, long long) = NULL;
+  if (progressBlock != NULL) {
+    queueProgressBlock = ^(long long bytesSent, long long totalBytes) {
+      dispatch_async(q, ^{
+        progressBlock(bytesSent, totalBytes);
+      });
+    };
+  }
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    BOOL success = [self saveWithProgressBlock:queueProgressBlock error:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(success, error); 
+      });
+    }
+  });
+}
 
 - (NSData *)loadSynchronous:(BOOL)loadSync //TODO: loadSync ignored
                 resultBlock:(void (^)(BOOL success, NSData *data, NSError *error))resultBlock
@@ -337,4 +881,241 @@
    [self loadSynchronous:NO resultBlock:block error:nil];
 }
 
+#pragma mark Downloads
+
++ (NSString *)downloadDirectory {
+  NSString *caches = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject];
+  return [caches stringByAppendingPathComponent:kDKFileDownloadDirectory];
+}
+
++ (void)removeDownloadedFiles {
+  [[NSFileManager defaultManager] removeItemAtPath:[self downloadDirectory] error:NULL];
+}
+
+- (NSString *)downloadPath {
+  NSString *fileName = [self.name stringByReplacingOccurrencesOfString:@"/" withString:@"_"];
+  return [[isa downloadDirectory] stringByAppendingPathComponent:fileName];
+}
+
+- (BOOL)hasUsableDownloadAtPath:(NSString *)path {
+  if (self.cachePolicy == DKCachePolicyIgnoreCache ||
+      (self.cachePolicy == DKCachePolicyUseCacheIfOffline && [DKManager endpointReachable])) {
+    return NO;
+  }
+  NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL];
+  return (attributes != nil && -[attributes.fileModificationDate timeIntervalSinceNow] < self.maxCacheAge);
+}
+
+// Downloads of the same file share the partial file, they run one at a time
++ (NSObject *)downloadLockForPath:(NSString *)path {
+  static NSMutableDictionary *locks;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    locks = [NSMutableDictionary new];
+  });
+  @synchronized(locks) {
+    NSObject *lock = locks[path];
+    if (lock == nil) {
+      lock = [NSObject new];
+      locks[path] = lock;
+    }
+    return lock;
+  }
+}
+
+// The strong ETag or Last-Modified date of the response, resumed downloads send it as If-Range
++ (NSString *)rangeValidatorForResponse:(NSHTTPURLResponse *)response {
+  NSString *etag = nil;
+  NSString *lastModified = nil;
+  for (NSString *field in response.allHeaderFields) {
+    if ([field caseInsensitiveCompare:@"ETag"] == NSOrderedSame) {
+      etag = response.allHeaderFields[field];
+    }
+    else if ([field caseInsensitiveCompare:@"Last-Modified"] == NSOrderedSame) {
+      lastModified = response.allHeaderFields[field];
+    }
+  }
+  if (etag.length > 0 && ![etag hasPrefix:@"W/"]) {
+    return etag;
+  }
+  return (lastModified.length > 0) ? lastModified : nil;
+}
+
+- (NSURL *)loadFileWithProgressBlock:(void (^)(long long bytesReceived, long long totalBytes))progressBlock error:(NSError **)error {
+  // Check file name
+  if (self.name.length == 0) {
+    [NSException raise:NSInternalInconsistencyException
+                format:NSLocalizedString(@"Invalid filename", nil)];
+    return nil;
+  }
+  
+  NSString *path = [self downloadPath];
+  @synchronized([isa downloadLockForPath:path]) {
+    return [self loadFileAtPath:path progressBlock:progressBlock error:error];
+  }
+}
+
+- (NSURL *)loadFileAtPath:(NSString *)path progressBlock:(void (^)(long long bytesReceived, long long totalBytes))progressBlock error:(NSError **)error {
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+  if ([self hasUsableDownloadAtPath:path]) {
+    if ([DKManager requestLogEnabled]) {
+      NSLog(@"[FILE IN CACHE] downloaded '%@'", self.name);
+    }
+    self.isVolatile = NO;
+    return [NSURL fileURLWithPath:path];
+  }
+  
+  // Resume from the bytes already written, if the validator of the version they belong to is known
+  NSString *partPath = [path stringByAppendingPathExtension:@"part"];
+  NSString *validatorPath = [partPath stringByAppendingPathExtension:@"validator"];
+  [fileManager createDirectoryAtPath:[isa downloadDirectory] withIntermediateDirectories:YES attributes:nil error:NULL];
+  unsigned long long offset = [[fileManager attributesOfItemAtPath:partPath error:NULL] fileSize];
+  NSString *validator = (offset > 0) ? [NSString stringWithContentsOfFile:validatorPath encoding:NSUTF8StringEncoding error:NULL] : nil;
+  if (validator.length == 0) {
+    offset = 0;
+  }
+  
+  // Create url request
+  NSString *ep = [[[DKManager APIEndpoint] stringByAppendingPathComponent:kDKRequestFileHandler] stringByAppendingPathComponent:self.name];
+  NSMutableURLRequest *req = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:ep]];
+  req.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
+  req.HTTPMethod = @"GET";
+  if (offset > 0) {
+    [req setValue:[NSString stringWithFormat:@"bytes=%llu-", offset] forHTTPHeaderField:@"Range"];
+    [req setValue:validator forHTTPHeaderField:@"If-Range"];
+  }
+  
+  // Log
+  if ([DKManager requestLogEnabled]) {
+    NSLog(@"[FILE OUT] download name '%@' from byte %llu", self.name, offset);
+  }
+  
+  __block long long startOffset = (long long)offset;
+  __block long long totalBytes = -1;
+  DKConnection *connection = [[DKConnection alloc] initWithRequest:req];
+  connection.outputStreamBlock = ^NSOutputStream *(NSHTTPURLResponse *response) {
+    // A full response, sent if the file changed, replaces the partial file
+    BOOL append = (response.statusCode == 206 && startOffset > 0);
+    if (!append) {
+      startOffset = 0;
+      NSString *responseValidator = [isa rangeValidatorForResponse:response];
+      if (responseValidator != nil) {
+        [responseValidator writeToFile:validatorPath atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+      }
+      else {
+        [fileManager removeItemAtPath:validatorPath error:NULL];
+      }
+    }
+    totalBytes = (response.expectedContentLength >= 0) ? startOffset + response.expectedContentLength : -1;
+    return [NSOutputStream outputStreamToFileAtPath:partPath append:append];
+  };
+  if (progressBlock != NULL) {
+    connection.downloadProgressBlock = ^(long long bytesReceived, long long expectedBytes) {
+      progressBlock(startOffset + bytesReceived, totalBytes);
+    };
+  }
+  
+  // Load sync, the timeout applies to inactivity
+  self.isLoading = YES;
+  [DKNetworkActivity begin];
+  NSError *reqError = nil;
+  NSHTTPURLResponse *response = nil;
+  NSData *data = [connection sendSynchronousReturningResponse:&response timeout:20.0 error:&reqError];
+  self.isLoading = NO;
+  [DKNetworkActivity end];
+  
+  // The partial file is kept for the next attempt
+  if (reqError != nil) {
+    [NSError writeToError:error
+                     code:DKErrorConnectionFailed
+              description:NSLocalizedString(@"Connection failed", nil)
+                 original:reqError];
+    return nil;
+  }
+  
+  // The partial file is longer than the file, start over
+  if (response.statusCode == 416 && offset > 0) {
+    [fileManager removeItemAtPath:partPath error:NULL];
+    [fileManager removeItemAtPath:validatorPath error:NULL];
+    return [self loadFileAtPath:path progressBlock:progressBlock error:error];
+  }
+  
+  if (response.statusCode != 200 && response.statusCode != 206) {
+    [DKRequest logData:data isOut:NO isCached:NO];
+    [NSError writeToError:error
+                     code:DKErrorUnknownStatus
+              description:[NSString stringWithFormat:NSLocalizedString(@"Unknown response (%i)", nil), response.statusCode]
+                 original:nil];
+    return nil;
+  }
+  
+  unsigned long long length = [[fileManager attributesOfItemAtPath:partPath error:NULL] fileSize];
+  if (totalBytes >= 0 && length != (unsigned long long)totalBytes) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidResponse
+              description:NSLocalizedString(@"Incomplete download", nil)
+                 original:nil];
+    return nil;
+  }
+  
+  [fileManager removeItemAtPath:path error:NULL];
+  [fileManager removeItemAtPath:validatorPath error:NULL];
+  NSError *moveError = nil;
+  if (![fileManager moveItemAtPath:partPath toPath:path error:&moveError]) {
+    [NSError writeToError:error
+                     code:DKErrorOperationFailed
+              description:NSLocalizedString(@"Could not store download", nil)
+                 original:moveError];
+    return nil;
+  }
+  
+  if ([DKManager requestLogEnabled]) {
+    NSLog(@"[FILE IN] downloaded size '%llu' byte", length);
+  }
+  self.isVolatile = NO;
+  return [NSURL fileURLWithPath:path];
+}
+
+- (NSURL *)loadFile:(NSError **)error {
+  return [self loadFileWithProgressBlock:NULL error:error];
+}
+
+- (NSData *)loadMappedData:(NSError **)error {
+  NSURL *fileURL = [self loadFile:error];
+  if (fileURL == nil) {
+    return nil;
+  }
+  return [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:error];
+}
+
+- (void)loadFileInBackgroundWithBlock:(void (^)(NSURL *fileURL, NSError *error))block
+                        progressBlock:(void (^)(long long bytesReceived, long long totalBytes))progressBlock {
+  // Check file name
+  if (self.name.length == 0) {
+    [NSException raise:NSInternalInconsistencyException
+                format:NSLocalizedString(@"Invalid filename", nil)];
+    return;
+  }
+  block = [block copy];
+  progressBlock = [progressBlock copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  void (^queueProgressBlock)(long long, long long) = NULL;
+  if (progressBlock != NULL) {
+    queueProgressBlock = ^(long long bytesReceived, long long totalBytes) {
+      dispatch_async(q, ^{
+        progressBlock(bytesReceived, totalBytes);
+      });
+    };
+  }
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    NSURL *fileURL = [self loadFileWithProgressBlock:queueProgressBlock error:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(fileURL, error);
+      });
+    }
+  });
+}
+
 @end
\ No newline at end of file
@@ -0,0 +1,88 @@
+//
+//  DKImagePipeline.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import <CoreGraphics/CoreGraphics.h>
+
+/**
+ Decodes image data to bitmaps on a background queue and caches them in memory, for lists that
+ display images while scrolling.
+
+ Images are downsampled with ImageIO to the displayed pixel size while decoding, the full-size image
+ is never decoded. Decoded bitmaps are cached by key and pixel size, the cache evicts bitmaps when
+ their total size exceeds the cost limit. The pipeline uses Core Graphics only, wrap the returned
+ images with `+[UIImage imageWithCGImage:scale:orientation:]` to display them.
+
+    CGFloat pixelSize = 44.0 * [UIScreen mainScreen].scale;
+    CGImageRef image = [pipeline cachedImageForKey:key maxPixelSize:pixelSize];
+    if (image == NULL) {
+      cell.decodeOperation = [pipeline decodeImageWithData:data key:key maxPixelSize:pixelSize block:^(CGImageRef image) {
+        // ...
+      }];
+    }
+ */
+@interface DKImagePipeline : NSObject
+
+/**
+ The maximum total size in bytes of the cached bitmaps, 20 MB by default
+ */
+@property (nonatomic, assign) NSUInteger totalCostLimit;
+
+/**
+ The maximum number of images decoded at the same time, 2 by default
+ */
+@property (nonatomic, assign) NSInteger maxConcurrentDecodes;
+
+/** @name Getting the Shared Pipeline */
+
+/**
+ Returns the pipeline shared by the query tables
+ @return The shared pipeline
+ */
++ (DKImagePipeline *)sharedPipeline;
+
+/** @name Decoding Images */
+
+/**
+ Decodes image data synchronously, downsampling it
+ @param data The encoded image data, e.g. PNG or JPEG
+ @param maxPixelSize The maximum width and height of the decoded bitmap in pixels, or 0 for the full size
+ @return The decoded bitmap, the caller releases it, or `NULL` if the data isn't an image
+ */
++ (CGImageRef)newImageWithData:(NSData *)data maxPixelSize:(CGFloat)maxPixelSize CF_RETURNS_RETAINED;
+
+/**
+ Returns a cached bitmap
+ @param key The key identifying the image data
+ @param maxPixelSize The maximum pixel size the image was decoded with
+ @return The cached bitmap, valid until the current autorelease pool drains, or `NULL` if it isn't cached
+ */
+- (CGImageRef)cachedImageForKey:(NSString *)key maxPixelSize:(CGFloat)maxPixelSize;
+
+/**
+ Decodes image data on the decoding queue and caches the bitmap.
+
+ The block is called on the calling queue, it isn't called if the operation is cancelled on that
+ queue first, even once decoded. Cancel the operation when the image isn't displayed anymore, e.g.
+ when the cell is reused.
+ @param data The encoded image data
+ @param key The key identifying the image data, or `nil` to not cache the bitmap
+ @param maxPixelSize The maximum width and height of the decoded bitmap in pixels, or 0 for the full size
+ @param block The result block, `image` is `NULL` if the data isn't an image
+ @return The decoding operation
+ */
+- (NSOperation *)decodeImageWithData:(NSData *)data key:(NSString *)key maxPixelSize:(CGFloat)maxPixelSize
+                               block:(void (^)(CGImageRef image))block;
+
+/** @name Managing the Cache */
+
+/**
+ Removes all cached bitmaps
+ */
+- (void)removeAllImages;
+
+@end
@@ -0,0 +1,179 @@
+//
+//  DKImagePipeline.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKImagePipeline.h"
+#import <ImageIO/ImageIO.h>
+
+#define kDKImagePipelineDefaultCostLimit (20 * 1024 * 1024)
+
+// -cancel has no effect on finished operations, the flag also suppresses a callback already queued
+@interface DKImageDecodeOperation : NSBlockOperation
+@property (atomic, assign) BOOL callbackCancelled;
+@end
+
+@implementation DKImageDecodeOperation
+
+- (void)cancel {
+  self.callbackCancelled = YES;
+  [super cancel];
+}
+
+@end
+
+@implementation DKImagePipeline {
+@private
+  NSCache           *cache_;
+  NSOperationQueue  *decodeQueue_;
+}
+
++ (DKImagePipeline *)sharedPipeline {
+  static DKImagePipeline *sharedPipeline;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    sharedPipeline = [DKImagePipeline new];
+  });
+  return sharedPipeline;
+}
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    cache_ = [NSCache new];
+    decodeQueue_ = [NSOperationQueue new];
+    self.totalCostLimit = kDKImagePipelineDefaultCostLimit;
+    self.maxConcurrentDecodes = 2;
+  }
+  return self;
+}
+
+- (NSUInteger)totalCostLimit {
+  return cache_.totalCostLimit;
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+  cache_.totalCostLimit = totalCostLimit;
+}
+
+- (NSInteger)maxConcurrentDecodes {
+  return decodeQueue_.maxConcurrentOperationCount;
+}
+
+- (void)setMaxConcurrentDecodes:(NSInteger)maxConcurrentDecodes {
+  decodeQueue_.maxConcurrentOperationCount = MAX(maxConcurrentDecodes, 1);
+}
+
++ (CGImageRef)newImageWithData:(NSData *)data maxPixelSize:(CGFloat)maxPixelSize {
+  if (data.length == 0) {
+    return NULL;
+  }
+
+  // The source doesn't keep a decoded copy, the bitmap drawn below is the only one
+  NSDictionary *sourceOptions = @{(__bridge id)kCGImageSourceShouldCache: @NO};
+  CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, (__bridge CFDictionaryRef)sourceOptions);
+  if (source == NULL) {
+    return NULL;
+  }
+  CGImageRef image = NULL;
+  if (CGImageSourceGetCount(source) > 0) {
+    if (maxPixelSize > 0.0) {
+      // Downsampled while decoding, JPEGs are decoded at a reduced scale
+      NSDictionary *options = @{(__bridge id)kCGImageSourceCreateThumbnailFromImageAlways: @YES,
+                                (__bridge id)kCGImageSourceCreateThumbnailWithTransform: @YES,
+                                (__bridge id)kCGImageSourceShouldCache: @NO,
+                                (__bridge id)kCGImageSourceThumbnailMaxPixelSize: @(ceil(maxPixelSize))};
+      image = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+    }
+    else {
+      image = CGImageSourceCreateImageAtIndex(source, 0, (__bridge CFDictionaryRef)sourceOptions);
+    }
+  }
+  CFRelease(source);
+  if (image == NULL) {
+    return NULL;
+  }
+
+  // Images are decoded when first drawn, drawing them here keeps decoding off the main thread
+  size_t width = CGImageGetWidth(image);
+  size_t height = CGImageGetHeight(image);
+  CGImageAlphaInfo alphaInfo = CGImageGetAlphaInfo(image);
+  BOOL hasAlpha = !(alphaInfo == kCGImageAlphaNone ||
+                    alphaInfo == kCGImageAlphaNoneSkipFirst ||
+                    alphaInfo == kCGImageAlphaNoneSkipLast);
+  CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+  CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace,
+                                               kCGBitmapByteOrder32Host | (hasAlpha ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst));
+  CGColorSpaceRelease(colorSpace);
+  if (context == NULL) {
+    return image;
+  }
+  CGContextDrawImage(context, CGRectMake(0.0, 0.0, width, height), image);
+  CGImageRef decodedImage = CGBitmapContextCreateImage(context);
+  CGContextRelease(context);
+  if (decodedImage != NULL) {
+    CGImageRelease(image);
+    image = decodedImage;
+  }
+  return image;
+}
+
+- (NSString *)cacheKeyForKey:(NSString *)key maxPixelSize:(CGFloat)maxPixelSize {
+  return [NSString stringWithFormat:@"%@@%.0f", key, ceil(maxPixelSize)];
+}
+
+- (CGImageRef)cachedImageForKey:(NSString *)key maxPixelSize:(CGFloat)maxPixelSize {
+  if (key == nil) {
+    return NULL;
+  }
+  // Kept alive by the pool if the cache evicts it
+  __autoreleasing id image = [cache_ objectForKey:[self cacheKeyForKey:key maxPixelSize:maxPixelSize]];
+  return (__bridge CGImageRef)image;
+}
+
+- (NSOperation *)decodeImageWithData:(NSData *)data key:(NSString *)key maxPixelSize:(CGFloat)maxPixelSize
+                               block:(void (^)(CGImageRef image))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  NSString *cacheKey = (key != nil) ? [self cacheKeyForKey:key maxPixelSize:maxPixelSize] : nil;
+  NSCache *cache = cache_;
+
+  DKImageDecodeOperation *operation = [DKImageDecodeOperation new];
+  __weak DKImageDecodeOperation *weakOperation = operation;
+  [operation addExecutionBlock:^{
+    DKImageDecodeOperation *decodeOperation = weakOperation;
+    if (decodeOperation == nil || decodeOperation.isCancelled) {
+      return;
+    }
+
+    // An earlier operation may have decoded the same image
+    id image = (cacheKey != nil) ? [cache objectForKey:cacheKey] : nil;
+    if (image == nil) {
+      image = CFBridgingRelease([DKImagePipeline newImageWithData:data maxPixelSize:maxPixelSize]);
+      if (image != nil && cacheKey != nil) {
+        CGImageRef imageRef = (__bridge CGImageRef)image;
+        [cache setObject:image forKey:cacheKey cost:CGImageGetBytesPerRow(imageRef) * CGImageGetHeight(imageRef)];
+      }
+    }
+
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        // Operations cancelled on the calling queue after decoding don't call back
+        if (!decodeOperation.callbackCancelled) {
+          block((__bridge CGImageRef)image);
+        }
+      });
+    }
+  }];
+  [decodeQueue_ addOperation:operation];
+  return operation;
+}
+
+- (void)removeAllImages {
+  [cache_ removeAllObjects];
+}
+
+@end
@@ -0,0 +1,76 @@
+//
+//  DKLiveQuery.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKQuery;
+@class DKEntity;
+
+/**
+ A subscription to the changes of a query's results, pushed by the server.
+
+ The subscription streams server-sent events from the live-query resource (see
+ `Deployd-Modules/node_modules/live-query`), which is notified of stored writes by the
+ tracked-collection resource. Entities are read with the subscriber's session, the collection's GET
+ event applies.
+ Each write that adds an entity to, changes an entity in, or removes an entity from the query
+ results is delivered as a `DKLiveQueryEventInserted`, `DKLiveQueryEventUpdated` or
+ `DKLiveQueryEventDeleted` event.
+
+ Lost connections are reopened automatically. Writes made while disconnected are not delivered,
+ a `DKLiveQueryEventReconnected` event with a `nil` entity tells the client to refetch.
+ The subscription is active until it is cancelled.
+ */
+@interface DKLiveQuery : NSObject
+
+/**
+ A copy of the subscribed query
+ */
+@property (nonatomic, strong, readonly) DKQuery *query;
+
+/**
+ `YES` while the event stream is open
+ */
+@property (nonatomic, assign, readonly) BOOL isConnected;
+
+/**
+ The error that closed the event stream, if any
+ */
+@property (nonatomic, strong, readonly) NSError *lastError;
+
+/**
+ The delay before reopening a lost connection, doubled on each failed attempt up to a minute. Defaults to 2 seconds.
+ */
+@property (nonatomic, assign) NSTimeInterval reconnectInterval;
+
+/** @name Creating Subscriptions */
+
+/**
+ Initializes a new subscription, call <start> to open it
+ @param query The query to subscribe to, it is copied
+ @param block The block called with each change, on the queue that initialized the subscription
+ @return The initialized subscription
+ */
+- (id)initWithQuery:(DKQuery *)query block:(void (^)(DKLiveQueryEvent event, DKEntity *entity))block;
+
+/** @name Controlling Subscriptions */
+
+/**
+ Opens the event stream
+ */
+- (void)start;
+
+/**
+ Closes the event stream, no more events are delivered
+ */
+- (void)cancel;
+
++ (id)new UNAVAILABLE_ATTRIBUTE;
+- (id)init UNAVAILABLE_ATTRIBUTE;
+
+@end
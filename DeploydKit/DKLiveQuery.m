@@ -0,0 +1,246 @@
+//
+//  DKLiveQuery.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKLiveQuery.h"
+#import "DKQuery.h"
+#import "DKQuery-Private.h"
+#import "DKEntity.h"
+#import "DKRequest.h"
+#import "DKManager.h"
+#import "NSError+DeploydKit.h"
+
+#define kDKLiveQueryMaxReconnectInterval 60.0
+
+@interface DKLiveQuery ()
+@property (nonatomic, strong, readwrite) DKQuery *query;
+@property (nonatomic, assign, readwrite) BOOL isConnected;
+@property (nonatomic, strong, readwrite) NSError *lastError;
+@property (nonatomic, copy) void (^block)(DKLiveQueryEvent event, DKEntity *entity);
+@end
+
+@implementation DKLiveQuery {
+@private
+  NSURLConnection  *connection_;
+  NSOperationQueue *delegateQueue_;
+  NSMutableData    *buffer_;
+  dispatch_queue_t  callbackQueue_;
+  BOOL              cancelled_;
+  BOOL              hasConnected_;
+  NSTimeInterval    retryInterval_;
+}
+
+- (id)initWithQuery:(DKQuery *)query block:(void (^)(DKLiveQueryEvent event, DKEntity *entity))block {
+  NSParameterAssert(query != nil);
+
+  self = [super init];
+  if (self) {
+    self.query = [query copy];
+    self.block = block;
+    self.reconnectInterval = 2.0;
+
+    delegateQueue_ = [NSOperationQueue new];
+    delegateQueue_.maxConcurrentOperationCount = 1;
+    buffer_ = [NSMutableData new];
+    callbackQueue_ = dispatch_get_current_queue();
+    dispatch_retain(callbackQueue_);
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [connection_ cancel];
+  dispatch_release(callbackQueue_);
+}
+
+- (NSURLRequest *)streamRequest {
+  NSDictionary *spec = @{@"collection" : self.query.entityName,
+                         @"query" : [DKRequest wrapSpecialObjectsInJSON:[self.query requestDict]]};
+  NSData *JSONData = [NSJSONSerialization dataWithJSONObject:spec options:0 error:NULL];
+  NSString *JSONString = [[NSString alloc] initWithData:JSONData encoding:NSUTF8StringEncoding];
+  NSString *urlString = [NSString stringWithFormat:@"%@%@?%@", [DKManager APIEndpoint], kDKRequestLiveQuery, JSONString];
+
+  NSMutableURLRequest *req = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:[urlString stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]]];
+  req.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
+  // The server sends a heartbeat well within the idle timeout
+  req.timeoutInterval = 60.0;
+  [req setValue:@"text/event-stream" forHTTPHeaderField:@"Accept"];
+  return req;
+}
+
+- (void)start {
+  @synchronized(self) {
+    if (connection_ != nil) {
+      return;
+    }
+    cancelled_ = NO;
+    retryInterval_ = self.reconnectInterval;
+    [self connect];
+  }
+}
+
+- (void)cancel {
+  @synchronized(self) {
+    cancelled_ = YES;
+    [connection_ cancel];
+    connection_ = nil;
+    self.isConnected = NO;
+  }
+}
+
+- (void)connect {
+  [buffer_ setLength:0];
+  connection_ = [[NSURLConnection alloc] initWithRequest:[self streamRequest] delegate:self startImmediately:NO];
+  [connection_ setDelegateQueue:delegateQueue_];
+  [connection_ start];
+}
+
+- (void)connectionClosedWithError:(NSError *)error retry:(BOOL)retry {
+  @synchronized(self) {
+    connection_ = nil;
+    self.isConnected = NO;
+    self.lastError = error;
+    if (cancelled_ || !retry) {
+      return;
+    }
+
+    NSTimeInterval delay = retryInterval_;
+    retryInterval_ = MIN(retryInterval_ * 2.0, kDKLiveQueryMaxReconnectInterval);
+
+    dispatch_time_t popTime = dispatch_time(DISPATCH_TIME_NOW, delay * NSEC_PER_SEC);
+    dispatch_after(popTime, dispatch_get_main_queue(), ^(void){
+      @synchronized(self) {
+        if (!cancelled_ && connection_ == nil) {
+          [self connect];
+        }
+      }
+    });
+  }
+}
+
+- (void)deliverEvent:(DKLiveQueryEvent)event entity:(DKEntity *)entity {
+  dispatch_async(callbackQueue_, ^{
+    BOOL cancelled = NO;
+    @synchronized(self) {
+      cancelled = cancelled_;
+    }
+    if (!cancelled && self.block != NULL) {
+      self.block(event, entity);
+    }
+  });
+}
+
+#pragma mark Event Stream Parsing
+
+- (void)processBuffer {
+  NSData *separator = [@"\n\n" dataUsingEncoding:NSUTF8StringEncoding];
+  while (YES) {
+    NSRange range = [buffer_ rangeOfData:separator options:0 range:NSMakeRange(0, buffer_.length)];
+    if (range.location == NSNotFound) {
+      break;
+    }
+    NSData *eventData = [buffer_ subdataWithRange:NSMakeRange(0, range.location)];
+    [buffer_ replaceBytesInRange:NSMakeRange(0, NSMaxRange(range)) withBytes:NULL length:0];
+
+    [self processEvent:[[NSString alloc] initWithData:eventData encoding:NSUTF8StringEncoding]];
+  }
+}
+
+- (void)processEvent:(NSString *)eventString {
+  NSString *type = @"message";
+  NSMutableArray *dataLines = [NSMutableArray new];
+  NSCharacterSet *whitespace = [NSCharacterSet whitespaceCharacterSet];
+
+  for (NSString *rawLine in [eventString componentsSeparatedByString:@"\n"]) {
+    NSString *line = [rawLine stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"\r"]];
+    // Comments, like the heartbeat
+    if ([line hasPrefix:@":"]) {
+      continue;
+    }
+    else if ([line hasPrefix:@"event:"]) {
+      type = [[line substringFromIndex:6] stringByTrimmingCharactersInSet:whitespace];
+    }
+    else if ([line hasPrefix:@"data:"]) {
+      [dataLines addObject:[[line substringFromIndex:5] stringByTrimmingCharactersInSet:whitespace]];
+    }
+  }
+  if (dataLines.count == 0) {
+    return;
+  }
+
+  DKLiveQueryEvent event;
+  if ([type isEqualToString:@"inserted"]) {
+    event = DKLiveQueryEventInserted;
+  }
+  else if ([type isEqualToString:@"updated"]) {
+    event = DKLiveQueryEventUpdated;
+  }
+  else if ([type isEqualToString:@"deleted"]) {
+    event = DKLiveQueryEventDeleted;
+  }
+  else {
+    return;
+  }
+
+  NSData *JSONData = [[dataLines componentsJoinedByString:@"\n"] dataUsingEncoding:NSUTF8StringEncoding];
+  id doc = [NSJSONSerialization JSONObjectWithData:JSONData options:0 error:NULL];
+  if (![doc isKindOfClass:[NSDictionary class]]) {
+    return;
+  }
+  DKEntity *entity = [[self.query entitiesFromResults:@[[DKRequest unwrapSpecialObjectsInJSON:doc]]] lastObject];
+  [self deliverEvent:event entity:entity];
+}
+
+#pragma mark NSURLConnectionDataDelegate
+
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+  NSInteger statusCode = [(NSHTTPURLResponse *)response statusCode];
+  if (statusCode != 200) {
+    [connection cancel];
+
+    NSError *error = nil;
+    [NSError writeToError:&error
+                     code:DKErrorOperationFailed
+              description:[NSString stringWithFormat:NSLocalizedString(@"Live query subscription failed (%i)", nil), statusCode]
+                 original:nil];
+    // Client errors, like a missing login, won't resolve by retrying
+    [self connectionClosedWithError:error retry:(statusCode >= 500)];
+    return;
+  }
+
+  BOOL reconnected = NO;
+  @synchronized(self) {
+    self.isConnected = YES;
+    self.lastError = nil;
+    retryInterval_ = self.reconnectInterval;
+    reconnected = hasConnected_;
+    hasConnected_ = YES;
+  }
+  if (reconnected) {
+    [self deliverEvent:DKLiveQueryEventReconnected entity:nil];
+  }
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+  [buffer_ appendData:data];
+  [self processBuffer];
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+  [self connectionClosedWithError:nil retry:YES];
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+  NSError *connectionError = nil;
+  [NSError writeToError:&connectionError
+                   code:DKErrorConnectionFailed
+            description:NSLocalizedString(@"Connection failed", nil)
+               original:error];
+  [self connectionClosedWithError:connectionError retry:YES];
+}
+
+@end
@@ -75,6 +75,24 @@
  */
 + (dispatch_queue_t)queue;
 
+/** @name Query Transport */
+
+/**
+ Sets the URL length above which queries are sent as a JSON body instead of in the URL
+ 
+ Queries above the threshold are posted to the query-post resource (see
+ `Deployd-Modules/node_modules/query-post`), which runs them on the collection. Their results
+ are cached like the results of the same query sent in the URL. Defaults to 4096, 0 disables it.
+ @param length The maximum length of a query URL, in bytes
+ */
++ (void)setQueryPOSTThreshold:(NSUInteger)length;
+
+/**
+ Returns the URL length above which queries are sent as a JSON body
+ @return The maximum length of a query URL, in bytes
+ */
++ (NSUInteger)queryPOSTThreshold;
+
 /** @name Debug */
 
 /**
@@ -101,8 +119,23 @@
 /** @name Controlling Caching Behavior (only used for GET requests)*/
 
 /**
- Clears the cached results for all requests.
+ Clears the cached results for all requests and the downloaded files.
  */
 + (void)clearAllCachedResults;
 
+/**
+ Clears the cached results of all queries on the given entity collection.
+ 
+ Successful saves and deletes already do this for the collection they write to.
+ @param entityName The entity collection name
+ */
++ (void)clearCachedResultsForEntityName:(NSString *)entityName;
+
+/**
+ Clears the cached results that contain the given entity, and all queries on its collection.
+ @param entityName The entity collection name
+ @param entityId The entity ID
+ */
++ (void)clearCachedResultsForEntityName:(NSString *)entityName entityId:(NSString *)entityId;
+
 @end
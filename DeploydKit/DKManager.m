@@ -14,6 +14,8 @@
 #import "DKRequest.h"
 #import "DKReachability.h"
 #import "EGOCache.h"
+#import "DKCacheIndex.h"
+#import "DKFile.h"
 
 @implementation DKManager
 
@@ -23,6 +25,7 @@ static NSString *kDKManagerAPISecret;
 static NSString *kDKManagerSessionId;
 static BOOL kDKManagerReachable;
 static NSTimeInterval kDKManagerMaxCacheAge;
+static NSUInteger kDKManagerQueryPOSTThreshold = 4096;
 
 + (void)setAPIEndpoint:(NSString *)absoluteString {
   NSURL *ep = [NSURL URLWithString:absoluteString];
@@ -96,6 +99,14 @@ static NSTimeInterval kDKManagerMaxCacheAge;
   return q;
 }
 
++ (void)setQueryPOSTThreshold:(NSUInteger)length {
+  kDKManagerQueryPOSTThreshold = length;
+}
+
++ (NSUInteger)queryPOSTThreshold {
+  return kDKManagerQueryPOSTThreshold;
+}
+
 + (void)setRequestLogEnabled:(BOOL)flag {
   kDKManagerRequestLogEnabled = flag;
 }
@@ -118,6 +129,17 @@ static NSTimeInterval kDKManagerMaxCacheAge;
 
 + (void)clearAllCachedResults{
   [[EGOCache globalCache] clearCache];
+  [[DKCacheIndex sharedIndex] removeAllTags];
+  [DKFile removeDownloadedFiles];
+}
+
++ (void)clearCachedResultsForEntityName:(NSString *)entityName {
+  [[DKCacheIndex sharedIndex] invalidateTags:@[[DKCacheIndex tagForEntityName:entityName]]];
+}
+
++ (void)clearCachedResultsForEntityName:(NSString *)entityName entityId:(NSString *)entityId {
+  [[DKCacheIndex sharedIndex] invalidateTags:@[[DKCacheIndex tagForEntityName:entityName],
+                                               [DKCacheIndex tagForEntityName:entityName entityId:entityId]]];
 }
 
 //Called by DKReachability whenever status changes.
@@ -0,0 +1,102 @@
+//
+//  DKPreparedQuery.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKQuery;
+
+/**
+ A named placeholder for a condition value, bound when a <DKPreparedQuery> is executed.
+ */
+@interface DKQueryParameter : NSObject <NSCopying>
+
+/**
+ The parameter name
+ */
+@property (nonatomic, copy, readonly) NSString *name;
+
+/**
+ Creates a parameter placeholder
+ @param name The parameter name
+ @return The initialized parameter
+ */
++ (DKQueryParameter *)parameterNamed:(NSString *)name;
+
+@end
+
+/**
+ A query compiled once into a pre-encoded, pre-escaped template.
+
+ Executing a prepared query only encodes the bound parameter values, the query shape is never
+ rebuilt or serialized again. Use it for queries that are executed often with different values.
+
+    DKQuery *query = [DKQuery queryWithEntityName:@"post"];
+    [query whereKey:@"visits" greaterThan:[DKQuery parameterNamed:@"minVisits"]];
+    DKPreparedQuery *prepared = [query prepare];
+    NSArray *results = [prepared findAllWithParameters:@{@"minVisits" : @10} error:&error];
+ */
+@interface DKPreparedQuery : NSObject
+
+/**
+ The entity name to perform the query on
+ */
+@property (nonatomic, copy, readonly) NSString *entityName;
+
+/**
+ The names of the parameters in the query
+ */
+@property (nonatomic, copy, readonly) NSArray *parameterNames;
+
+/**
+ The cache policy to use for the query.
+ */
+@property (nonatomic, assign) DKCachePolicy cachePolicy;
+
+/**
+ The age after which a cached value will be ignored
+ */
+@property (readwrite, assign) NSTimeInterval maxCacheAge;
+
+/** @name Creating Prepared Queries */
+
+/**
+ Compiles a query containing <DKQueryParameter> values
+ @param query The query to compile
+ @return The initialized prepared query
+ */
+- (id)initWithQuery:(DKQuery *)query;
+
+/** @name Executing Queries */
+
+/**
+ Returns the JSON encoded and percent escaped query for the parameter values
+ @param parameters The parameter values keyed by parameter name, all parameters must have a value
+ @return The encoded query
+ @exception NSInvalidArgumentException Raised if a parameter has no value, or a value is NaN or infinite
+ */
+- (NSString *)encodedQueryWithParameters:(NSDictionary *)parameters;
+
+/**
+ Finds all matching entities
+ @param parameters The parameter values keyed by parameter name, all parameters must have a value
+ @param error The error object to set on error, NaN and infinite values are a `DKErrorInvalidParams` error
+ @return The matching entities
+ */
+- (NSArray *)findAllWithParameters:(NSDictionary *)parameters error:(NSError **)error;
+
+/**
+ Finds all matching entities in the background and returns them to the callback block
+ @param parameters The parameter values keyed by parameter name, all parameters must have a value
+ @param block The result callback
+ */
+- (void)findAllWithParameters:(NSDictionary *)parameters inBackgroundWithBlock:(void (^)(NSArray *results, NSError *error))block;
+
++ (id)new UNAVAILABLE_ATTRIBUTE;
+- (id)init UNAVAILABLE_ATTRIBUTE;
+
+@end
@@ -0,0 +1,310 @@
+//
+//  DKPreparedQuery.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKPreparedQuery.h"
+#import "DKQuery.h"
+#import "DKQuery-Private.h"
+#import "DKRequest.h"
+#import "DKManager.h"
+#import "NSError+DeploydKit.h"
+
+@interface DKQueryParameter ()
+@property (nonatomic, copy, readwrite) NSString *name;
+@end
+
+@implementation DKQueryParameter
+
++ (DKQueryParameter *)parameterNamed:(NSString *)name {
+  NSParameterAssert(name.length > 0);
+  DKQueryParameter *parameter = [self new];
+  parameter.name = name;
+  return parameter;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+  return self;
+}
+
+- (BOOL)isEqual:(id)object {
+  return [object isKindOfClass:[DKQueryParameter class]] && [[object name] isEqualToString:self.name];
+}
+
+- (NSUInteger)hash {
+  return [self.name hash];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"<%@ %@>", NSStringFromClass([self class]), self.name];
+}
+
+@end
+
+// Encodes a string as a JSON string literal
+static NSString *DKEncodeJSONString(NSString *string) {
+  NSUInteger length = string.length;
+  unichar *chars = malloc(sizeof(unichar) * length);
+  unichar *encoded = malloc(sizeof(unichar) * (length * 6 + 2));
+  [string getCharacters:chars range:NSMakeRange(0, length)];
+
+  static const unichar hex[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+  NSUInteger pos = 0;
+  encoded[pos++] = '"';
+  for (NSUInteger i = 0; i < length; i++) {
+    unichar c = chars[i];
+    switch (c) {
+      case '"':  encoded[pos++] = '\\'; encoded[pos++] = '"';  break;
+      case '\\': encoded[pos++] = '\\'; encoded[pos++] = '\\'; break;
+      case '/':  encoded[pos++] = '\\'; encoded[pos++] = '/';  break;
+      case '\n': encoded[pos++] = '\\'; encoded[pos++] = 'n';  break;
+      case '\r': encoded[pos++] = '\\'; encoded[pos++] = 'r';  break;
+      case '\t': encoded[pos++] = '\\'; encoded[pos++] = 't';  break;
+      default:
+        if (c < 0x20) {
+          encoded[pos++] = '\\';
+          encoded[pos++] = 'u';
+          encoded[pos++] = '0';
+          encoded[pos++] = '0';
+          encoded[pos++] = hex[c >> 4];
+          encoded[pos++] = hex[c & 0xf];
+        }
+        else {
+          encoded[pos++] = c;
+        }
+    }
+  }
+  encoded[pos++] = '"';
+
+  NSString *result = [[NSString alloc] initWithCharacters:encoded length:pos];
+  free(chars);
+  free(encoded);
+  return result;
+}
+
+// NaN and infinity have no JSON representation
+static BOOL DKIsFiniteJSONValue(id value) {
+  if ([value isKindOfClass:[NSNumber class]]) {
+    double number = [value doubleValue];
+    return !isnan(number) && !isinf(number);
+  }
+  else if ([value isKindOfClass:[NSArray class]]) {
+    for (id obj in value) {
+      if (!DKIsFiniteJSONValue(obj)) {
+        return NO;
+      }
+    }
+  }
+  else if ([value isKindOfClass:[NSDictionary class]]) {
+    for (id obj in [value allValues]) {
+      if (!DKIsFiniteJSONValue(obj)) {
+        return NO;
+      }
+    }
+  }
+  return YES;
+}
+
+// Encodes a bound value as a JSON fragment, avoiding NSJSONSerialization for scalars
+static NSString *DKEncodeJSONValue(id value) {
+  if (!DKIsFiniteJSONValue(value)) {
+    [NSException raise:NSInvalidArgumentException
+                format:NSLocalizedString(@"Query parameter value %@ is not a finite number", nil), value];
+    return nil;
+  }
+  if ([value isKindOfClass:[NSString class]]) {
+    return DKEncodeJSONString(value);
+  }
+  else if ([value isKindOfClass:[NSNumber class]]) {
+    if ((__bridge CFBooleanRef)value == kCFBooleanTrue) {
+      return @"true";
+    }
+    else if ((__bridge CFBooleanRef)value == kCFBooleanFalse) {
+      return @"false";
+    }
+    return [value stringValue];
+  }
+  else if (value == nil || value == [NSNull null]) {
+    return @"null";
+  }
+
+  // Fragments can't be top level objects, encode the value inside an array
+  NSData *data = [NSJSONSerialization dataWithJSONObject:@[[DKRequest wrapSpecialObjectsInJSON:value]] options:0 error:NULL];
+  NSString *string = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+  if (string.length < 2) {
+    [NSException raise:NSInvalidArgumentException
+                format:NSLocalizedString(@"Could not JSON encode query parameter value %@", nil), value];
+    return nil;
+  }
+  return [string substringWithRange:NSMakeRange(1, string.length - 2)];
+}
+
+@interface DKPreparedQuery ()
+@property (nonatomic, copy, readwrite) NSString *entityName;
+@property (nonatomic, copy, readwrite) NSArray *parameterNames;
+@property (nonatomic, strong) DKQuery *query;
+@property (nonatomic, copy) NSArray *segments;
+@property (nonatomic, copy) NSArray *segmentParameters;
+@property (nonatomic, assign) NSUInteger encodedLength;
+@end
+
+@implementation DKPreparedQuery
+
+- (id)initWithQuery:(DKQuery *)query {
+  NSParameterAssert(query != nil);
+
+  self = [super init];
+  if (self) {
+    self.query = [query copy];
+    self.entityName = query.entityName;
+    self.cachePolicy = query.cachePolicy;
+    self.maxCacheAge = query.maxCacheAge;
+
+    [self compile];
+  }
+  return self;
+}
+
+- (void)compile {
+  // Replace parameters with unique placeholder strings
+  NSString *token = [[NSProcessInfo processInfo] globallyUniqueString];
+  NSMutableArray *names = [NSMutableArray new];
+  id requestDict = [DKRequest iterateJSON:[DKRequest wrapSpecialObjectsInJSON:[self.query requestDict]] modify:^id(id obj) {
+    if ([obj isKindOfClass:[DKQueryParameter class]]) {
+      NSString *name = [obj name];
+      NSUInteger idx = [names indexOfObject:name];
+      if (idx == NSNotFound) {
+        idx = names.count;
+        [names addObject:name];
+      }
+      return [NSString stringWithFormat:@"%@:%u", token, (unsigned int)idx];
+    }
+    return obj;
+  }];
+  self.parameterNames = names;
+
+  NSError *JSONError = nil;
+  NSData *JSONData = [NSJSONSerialization dataWithJSONObject:requestDict options:0 error:&JSONError];
+  if (JSONError != nil) {
+    [NSException raise:NSInvalidArgumentException
+                format:NSLocalizedString(@"Could not JSON encode query: %@", nil), JSONError.localizedDescription];
+    return;
+  }
+  NSString *JSONString = [[NSString alloc] initWithData:JSONData encoding:NSUTF8StringEncoding];
+
+  // An empty query is sent without a query string
+  if (JSONData.length <= 2) {
+    self.segments = @[];
+    self.segmentParameters = @[];
+    return;
+  }
+
+  // Split the JSON at the placeholders and escape the literal segments once
+  NSString *pattern = [NSString stringWithFormat:@"\"%@:([0-9]+)\"", [NSRegularExpression escapedPatternForString:token]];
+  NSRegularExpression *regex = [NSRegularExpression regularExpressionWithPattern:pattern options:0 error:NULL];
+  NSMutableArray *segments = [NSMutableArray new];
+  NSMutableArray *segmentParameters = [NSMutableArray new];
+  __block NSUInteger location = 0;
+  __block NSUInteger encodedLength = 0;
+  [regex enumerateMatchesInString:JSONString options:0 range:NSMakeRange(0, JSONString.length) usingBlock:^(NSTextCheckingResult *result, NSMatchingFlags flags, BOOL *stop) {
+    NSString *segment = [JSONString substringWithRange:NSMakeRange(location, result.range.location - location)];
+    segment = [segment stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+    [segments addObject:segment];
+    encodedLength += segment.length;
+
+    NSUInteger idx = (NSUInteger)[[JSONString substringWithRange:[result rangeAtIndex:1]] integerValue];
+    [segmentParameters addObject:names[idx]];
+
+    location = NSMaxRange(result.range);
+  }];
+  NSString *segment = [[JSONString substringFromIndex:location] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+  [segments addObject:segment];
+  encodedLength += segment.length;
+
+  self.segments = segments;
+  self.segmentParameters = segmentParameters;
+  self.encodedLength = encodedLength;
+}
+
+- (NSString *)encodedQueryWithParameters:(NSDictionary *)parameters {
+  NSArray *segments = self.segments;
+  if (segments.count == 0) {
+    return nil;
+  }
+
+  NSArray *segmentParameters = self.segmentParameters;
+  NSMutableString *encoded = [NSMutableString stringWithCapacity:self.encodedLength + segmentParameters.count * 16];
+  for (NSUInteger i = 0; i < segmentParameters.count; i++) {
+    [encoded appendString:segments[i]];
+
+    NSString *name = segmentParameters[i];
+    id value = parameters[name];
+    if (value == nil) {
+      [NSException raise:NSInvalidArgumentException
+                  format:NSLocalizedString(@"No value bound for query parameter '%@'", nil), name];
+      return nil;
+    }
+    NSString *fragment = DKEncodeJSONValue(value);
+    if (![value isKindOfClass:[NSNumber class]]) {
+      fragment = [fragment stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+    }
+    [encoded appendString:fragment];
+  }
+  [encoded appendString:[segments lastObject]];
+
+  return encoded;
+}
+
+- (NSArray *)findAllWithParameters:(NSDictionary *)parameters error:(NSError **)error {
+  for (NSString *name in parameters) {
+    if (!DKIsFiniteJSONValue(parameters[name])) {
+      [NSError writeToError:error
+                       code:DKErrorInvalidParams
+                description:[NSString stringWithFormat:NSLocalizedString(@"Query parameter '%@' is not a finite number", nil), name]
+                   original:nil];
+      return nil;
+    }
+  }
+
+  DKRequest *request = [DKRequest request];
+  request.cachePolicy = self.cachePolicy;
+  request.maxCacheAge = self.maxCacheAge;
+
+  NSError *requestError = nil;
+  id results = [request sendRequestWithEncodedQuery:[self encodedQueryWithParameters:parameters]
+                                             entity:self.entityName
+                                              error:&requestError];
+  if (requestError != nil) {
+    if (error != nil) {
+      *error = requestError;
+    }
+    return nil;
+  }
+
+  if ([results isKindOfClass:[NSArray class]]) {
+    return [self.query entitiesFromResults:results];
+  }
+  else if ([results isKindOfClass:[NSDictionary class]]) {
+    return [self.query entitiesFromResults:@[results]];
+  }
+  return nil;
+}
+
+- (void)findAllWithParameters:(NSDictionary *)parameters inBackgroundWithBlock:(void (^)(NSArray *results, NSError *error))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    NSArray *entities = [self findAllWithParameters:parameters error:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(entities, error);
+      });
+    }
+  });
+}
+
+@end
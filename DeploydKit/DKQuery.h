@@ -14,11 +14,17 @@
 
 
 @class DKEntity;
+@class DKQueryCursor;
+@class DKQueryParameter;
+@class DKPreparedQuery;
+@class DKLiveQuery;
+@class DKSpatialIndex;
+@class DKTextIndex;
 
 /**
  Class for performing queries on entity collections.
  */
-@interface DKQuery : NSObject
+@interface DKQuery : NSObject <NSCopying>
 
 /** @name Options */
 
@@ -263,11 +269,23 @@
 
 /**
  Checks objects with key point values near the point given and within the maximum distance given in radians
- Require a "2d" spatial index created on the key
+ Require a "2d" spatial index created on the key. Results are ordered by distance unless the query is sorted.
  (IT WORK, NOT DOCUMENTED IN DEPLOYD 0.6.9v, MAY NOT WORK IN FUTURE VERSIONS) 
- @param sequenceNum The sequence number to match
+ @param key The entity key holding [x, y] points
+ @param point The [x, y] point to search near
+ @param distance The maximum distance from the point
+ */
+-(void)whereKey:(NSString *)key nearPoint:(NSArray*)point withinDistance:(NSNumber*)distance;
+
+/**
+ Checks objects with key point values inside the box given by two opposite corners
+ Require a "2d" spatial index created on the key
+ (NOT DOCUMENTED IN DEPLOYD 0.6.9v, MAY NOT WORK IN FUTURE VERSIONS)
+ @param key The entity key holding [x, y] points
+ @param lowerLeft The [x, y] lower left corner of the box
+ @param upperRight The [x, y] upper right corner of the box
  */
-//-(void)whereKey:(NSString *)key nearPoint:(NSArray*)point withinDistance:(NSNumber*)distance;
+- (void)whereKey:(NSString *)key withinBoxFrom:(NSArray *)lowerLeft to:(NSArray *)upperRight;
 
 /** @name Entity Key Subsets */
 
@@ -308,6 +326,127 @@
  */
 - (void)findAllInBackgroundWithBlock:(void (^)(NSArray *results, NSError *error))block;
 
+/** @name Prepared Queries */
+
+/**
+ Returns a placeholder to use as a condition value in queries that are prepared
+ 
+ Queries containing parameters can only be executed through <prepare>.
+ @param name The parameter name
+ @return The parameter placeholder
+ */
++ (DKQueryParameter *)parameterNamed:(NSString *)name;
+
+/**
+ Compiles the query into a template that is executed with bound parameter values
+ 
+ Changes made to the query afterwards don't affect the prepared query.
+ @return The prepared query
+ */
+- (DKPreparedQuery *)prepare;
+
+/** @name Evaluating Queries Locally */
+
+/**
+ Finds all matching entities in a locally held set of entities without a round trip
+ 
+ Supports the same conditions, sorting, <skip>, <limit> and field subsets as the server.
+ Distances of `nearPoint` and box conditions are planar. Conditions that cannot be evaluated locally return an error.
+ @param entities The entities to search, of type <DKEntity> or NSDictionary
+ @param error The error object to set on error
+ @return The matching entities
+ */
+- (NSArray *)findAllInEntities:(NSArray *)entities error:(NSError **)error;
+
+/**
+ Finds all matching entities in a spatial index without a round trip
+ 
+ A `nearPoint` or box condition on the indexed key only visits the grid cells around the point or box,
+ the other conditions are evaluated as in <findAllInEntities:error:>.
+ @param index The spatial index to search
+ @param error The error object to set on error
+ @return The matching entities
+ */
+- (NSArray *)findAllInSpatialIndex:(DKSpatialIndex *)index error:(NSError **)error;
+
+/**
+ Finds all matching entities in a text index without a round trip, if the index is complete
+ 
+ String equality and `containsString`, `hasPrefix` or `hasSuffix` conditions on the indexed keys only visit
+ the entities containing their words, the other conditions are evaluated as in <findAllInEntities:error:>.
+ Without a sort order the best matches come first. The query is sent to the server while the index is
+ not complete.
+ @param index The text index to search
+ @param error The error object to set on error
+ @return The matching entities
+ */
+- (NSArray *)findAllInTextIndex:(DKTextIndex *)index error:(NSError **)error;
+
+/**
+ Finds all matching entities in the cached result of an unconstrained query on the collection
+ 
+ The collection is cached when an unconstrained query is executed with a cache policy other than `DKCachePolicyIgnoreCache`. Writes to the collection invalidate it.
+ @param error The error object to set on error
+ @return The matching entities, or `nil` if the collection is not cached
+ */
+- (NSArray *)findAllInCachedCollection:(NSError **)error;
+
+/** @name Paging Results */
+
+/**
+ Returns a cursor that pages through the matching entities by the last seen sort key
+ 
+ Unlike <skip>, deep pages are as cheap as the first one. See <DKQueryCursor>.
+ @param pageSize The number of entities fetched per page
+ @return The initialized cursor
+ */
+- (DKQueryCursor *)cursorWithPageSize:(NSUInteger)pageSize;
+
+/** @name Partitioned Fetching */
+
+/**
+ Finds all matching entities by splitting the key range into partitions fetched concurrently
+ 
+ The partition key can be `id`, `createdAt`, `updatedAt` or any numeric key. Numeric ranges are
+ split evenly between the lowest and highest matching value, IDs are split by their hex prefix.
+ Entities without a value for the key are not returned. <limit> and <skip> are ignored.
+ 
+ The results are merged in the query sort order, or in partition key order if the query is unsorted.
+ @param key The key used to partition the results
+ @param partitions The number of sub-queries to run
+ @param maxConcurrent The maximum number of sub-queries running at the same time
+ @param error The error object to set on error
+ @return The matching entities
+ */
+- (NSArray *)findAllPartitionedByKey:(NSString *)key partitions:(NSUInteger)partitions maxConcurrent:(NSUInteger)maxConcurrent error:(NSError **)error;
+
+/**
+ Finds all matching entities by splitting the key range into partitions fetched concurrently, and returns each partition to the callback block as soon as it is fetched
+ 
+ Partitions are returned unordered. See <findAllPartitionedByKey:partitions:maxConcurrent:error:>.
+ @param key The key used to partition the results
+ @param partitions The number of sub-queries to run
+ @param maxConcurrent The maximum number of sub-queries running at the same time
+ @param partitionBlock The callback block for each fetched partition
+ @param block The callback block called when all partitions were fetched, or on error
+ */
+- (void)findAllPartitionedByKey:(NSString *)key
+                     partitions:(NSUInteger)partitions
+                  maxConcurrent:(NSUInteger)maxConcurrent
+ inBackgroundWithPartitionBlock:(void (^)(NSArray *results))partitionBlock
+                completionBlock:(void (^)(NSError *error))block;
+
+/** @name Live Queries */
+
+/**
+ Subscribes to the changes of the matching entities, pushed by the server as they are written
+ 
+ <limit>, <skip> and the sort order don't apply to the delivered changes. See <DKLiveQuery>.
+ @param block The block called with each change, on the current queue
+ @return The started subscription, cancel it when no longer needed
+ */
+- (DKLiveQuery *)subscribeWithBlock:(void (^)(DKLiveQueryEvent event, DKEntity *entity))block;
+
 /** @name Aggregation */
 
 /**
@@ -332,6 +471,74 @@
  */
 //- (void)countAllInBackgroundWithBlock:(void (^)(NSUInteger count, NSError *error))block;
 
+/**
+ Aggregates the matching entities on the server and returns only the aggregated rows
+ 
+ Requires the aggregate resource (see `Deployd-Modules/node_modules/aggregate`). The aggregates map
+ a result name to an operator and key, the operators are `$sum`, `$min`, `$max`, `$avg` and `$count`.
+ `$count` counts the entities with a value for the key, or all entities for a non-string operand.
+ 
+    [query aggregate:@{@"visits" : @{@"$sum" : @"visits"}, @"posts" : @{@"$count" : @YES}}
+       groupedByKeys:@[@"creatorId"]
+               error:&error];
+ 
+ Each row contains the group keys and the aggregate results. Rows are ordered by the query sort,
+ which can use group keys and aggregate names. <limit>, <skip> and key subsets are ignored.
+ @param aggregates The aggregates to compute, keyed by result name
+ @param keys The keys to group by, `nil` to aggregate all matching entities in one row
+ @param error The error object that is written on error
+ @return The aggregated rows, as dictionaries
+ */
+- (NSArray *)aggregate:(NSDictionary *)aggregates groupedByKeys:(NSArray *)keys error:(NSError **)error;
+
+/**
+ Aggregates the matching entities on the server in the background and returns the rows to the block
+ @param aggregates The aggregates to compute, keyed by result name
+ @param keys The keys to group by, `nil` to aggregate all matching entities in one row
+ @param block The result callback block
+ */
+- (void)aggregate:(NSDictionary *)aggregates groupedByKeys:(NSArray *)keys inBackgroundWithBlock:(void (^)(NSArray *rows, NSError *error))block;
+
+/**
+ Counts the matching entities per distinct combination of the keys, on the server
+ @param keys The keys to group by
+ @param error The error object that is written on error
+ @return The rows containing the group keys and the `count`
+ */
+- (NSArray *)countGroupedByKeys:(NSArray *)keys error:(NSError **)error;
+
+/**
+ Returns the sum of the numeric values of the key in the matching entities
+ @param key The entity key
+ @param error The error object that is written on error
+ @return The sum
+ */
+- (NSNumber *)sumOfKey:(NSString *)key error:(NSError **)error;
+
+/**
+ Returns the average of the numeric values of the key in the matching entities
+ @param key The entity key
+ @param error The error object that is written on error
+ @return The average, `nil` if no entity has a numeric value
+ */
+- (NSNumber *)averageOfKey:(NSString *)key error:(NSError **)error;
+
+/**
+ Returns the lowest value of the key in the matching entities, numbers sort before strings
+ @param key The entity key
+ @param error The error object that is written on error
+ @return The lowest value, `nil` if no entity has a value
+ */
+- (id)minimumOfKey:(NSString *)key error:(NSError **)error;
+
+/**
+ Returns the highest value of the key in the matching entities, numbers sort before strings
+ @param key The entity key
+ @param error The error object that is written on error
+ @return The highest value, `nil` if no entity has a value
+ */
+- (id)maximumOfKey:(NSString *)key error:(NSError **)error;
+
 /** @name Controlling Caching Behavior (only used for GET requests)*/
 
 /**
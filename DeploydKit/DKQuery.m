@@ -12,12 +12,39 @@
 
 #import "DKQuery.h"
 #import "DKQuery-Private.h"
+#import "DKQueryCursor.h"
+#import "DKQueryEvaluator.h"
+#import "DKPreparedQuery.h"
+#import "DKLiveQuery.h"
+#import "DKSpatialIndex.h"
+#import "DKSpatialIndex-Private.h"
+#import "DKTextIndex.h"
+#import "DKTextIndex-Private.h"
 #import "DKRequest.h"
 #import "DKEntity.h"
 #import "DKEntity-Private.h"
 #import "DKManager.h"
 #import "EGOCache.h"
 
+// Copies the nested condition containers so they can be modified independently
+static id DKMutableDeepCopy(id obj) {
+  if ([obj isKindOfClass:[NSDictionary class]]) {
+    NSMutableDictionary *dict = [NSMutableDictionary new];
+    for (id key in obj) {
+      dict[key] = DKMutableDeepCopy(obj[key]);
+    }
+    return dict;
+  }
+  else if ([obj isKindOfClass:[NSArray class]]) {
+    NSMutableArray *ary = [NSMutableArray new];
+    for (id item in obj) {
+      [ary addObject:DKMutableDeepCopy(item)];
+    }
+    return ary;
+  }
+  return obj;
+}
+
 @interface DKQueryConditionProxy : NSProxy
 
 + (id)proxyForQuery:(DKQuery *)query conditionArray:(NSMutableArray *)array;
@@ -182,6 +209,10 @@
    [self queryDictForKey:key][@"$maxDistance"] = distance;
 }
 
+- (void)whereKey:(NSString *)key withinBoxFrom:(NSArray *)lowerLeft to:(NSArray *)upperRight {
+  [self queryDictForKey:key][@"$within"] = @{@"$box" : @[lowerLeft, upperRight]};
+}
+
 - (void)excludeKeys:(NSArray *)keys {
   [self.fieldInclExcl removeAllObjects];
   for (NSString *key in keys) {
@@ -198,35 +229,7 @@
 
 - (id)find:(NSError **)error one:(BOOL)findOne count:(NSUInteger *)countOut {  
   // Create request dict
-  NSMutableDictionary *requestDict = [NSMutableDictionary dictionaryWithObjectsAndKeys: nil];
-  
-  if (self.queryMap.count > 0) {
-        for (id key in self.queryMap) {
-             id value = (self.queryMap)[key];
-             requestDict[key] = value;
-        }
-  }
-  if (self.ors.count > 0) {
-    requestDict[@"$or"] = self.ors;
-  }
-  if (self.ands.count > 0) {
-    requestDict[@"$and"] = self.ands;
-  }
-  if (self.fieldInclExcl.count > 0) {
-    requestDict[@"$fields"] = self.fieldInclExcl;
-  }
-  if (self.sort.count > 0) {
-    requestDict[@"$sort"] = self.sort;
-  }
-  if (self.limit > 0) {
-    requestDict[@"$limit"] = @(self.limit);
-  }
-  if (self.limitRecursion > 0) {
-    requestDict[@"$limitRecursion"] = @(self.limitRecursion);
-  }
-  if (self.skip > 0) {
-    requestDict[@"$skip"] = @(self.skip);
-  }
+  NSMutableDictionary *requestDict = [self requestDict];
   
   NSMutableString * queryParams = [NSMutableString stringWithString:self.entityName];
   if (countOut != NULL) {
@@ -249,17 +252,12 @@
     
   // Query returned results
   else if ([results isKindOfClass:[NSArray class]]) {
-    NSMutableArray *entities = [NSMutableArray new];
-    for (NSDictionary *objDict in results) {
-      if ([objDict isKindOfClass:[NSDictionary class]]) {
-        DKEntity *entity = [[DKEntity alloc] initWithName:self.entityName];
-        entity.resultMap = objDict;
-        
-        [entities addObject:entity];
-      }
+    // Only complete entities can replace indexed ones
+    if (self.fieldInclExcl.count == 0) {
+      [DKSpatialIndex updateIndexesWithEntities:results entityName:self.entityName];
+      [DKTextIndex updateIndexesWithEntities:results entityName:self.entityName];
     }
-    
-    return [NSArray arrayWithArray:entities];
+    return [self entitiesFromResults:results];
   }
   
   // Query returned object count
@@ -271,7 +269,7 @@
     
   else if([results isKindOfClass:[NSDictionary class]]){
       NSMutableArray *entities = [NSMutableArray new];
-      DKEntity *entity = [[DKEntity alloc] initWithName:self.entityName];
+      DKEntity *entity = [[[DKEntity classForEntityName:self.entityName] alloc] initWithName:self.entityName];
       entity.resultMap = (NSDictionary*)results;      
       [entities addObject:entity];
       return [NSArray arrayWithArray:entities];
@@ -333,6 +331,257 @@
     return [self.request hasCachedResult];
 }
 
++ (DKQueryParameter *)parameterNamed:(NSString *)name {
+  return [DKQueryParameter parameterNamed:name];
+}
+
+- (DKPreparedQuery *)prepare {
+  return [[DKPreparedQuery alloc] initWithQuery:self];
+}
+
+- (NSArray *)findAllInEntities:(NSArray *)entities error:(NSError **)error {
+  NSMutableArray *objects = [NSMutableArray new];
+  for (id entity in entities) {
+    if ([entity isKindOfClass:[DKEntity class]]) {
+      NSDictionary *resultMap = [entity resultMap];
+      if (resultMap != nil) {
+        [objects addObject:resultMap];
+      }
+    }
+    else if ([entity isKindOfClass:[NSDictionary class]]) {
+      [objects addObject:entity];
+    }
+  }
+  
+  DKQueryEvaluator *evaluator = [[DKQueryEvaluator alloc] initWithRequestDict:[self requestDict]];
+  NSArray *results = [evaluator evaluateObjects:objects error:error];
+  if (results == nil) {
+    return nil;
+  }
+  return [self entitiesFromResults:results];
+}
+
+- (NSArray *)findAllInSpatialIndex:(DKSpatialIndex *)index error:(NSError **)error {
+  NSParameterAssert(index != nil);
+  
+  // Without another sort the nearest entities come first, only skip + limit of them can match
+  id condition = self.queryMap[index.key];
+  NSUInteger limit = 0;
+  if (self.sort.count == 0 && self.limit > 0 && [condition isKindOfClass:[NSDictionary class]] && condition[@"$near"] != nil &&
+      self.queryMap.count == 1 && self.ors.count == 0 && self.ands.count == 0) {
+    limit = self.skip + self.limit;
+  }
+  NSArray *objects = [index candidateObjectsForCondition:condition limit:limit];
+  
+  DKQueryEvaluator *evaluator = [[DKQueryEvaluator alloc] initWithRequestDict:[self requestDict]];
+  NSArray *results = [evaluator evaluateObjects:objects error:error];
+  if (results == nil) {
+    return nil;
+  }
+  return [self entitiesFromResults:results];
+}
+
+- (NSArray *)findAllInTextIndex:(DKTextIndex *)index error:(NSError **)error {
+  NSParameterAssert(index != nil);
+  
+  // An incomplete index can miss matching entities
+  if (!index.isComplete) {
+    return [self findAll:error];
+  }
+  NSArray *objects = [index candidateObjectsForConditions:self.queryMap];
+  
+  DKQueryEvaluator *evaluator = [[DKQueryEvaluator alloc] initWithRequestDict:[self requestDict]];
+  NSArray *results = [evaluator evaluateObjects:objects error:error];
+  if (results == nil) {
+    return nil;
+  }
+  return [self entitiesFromResults:results];
+}
+
+- (NSArray *)findAllInCachedCollection:(NSError **)error {
+  NSError *cacheError = nil;
+  id results = [[DKRequest request] cachedResultForEntity:self.entityName error:&cacheError];
+  if (cacheError != nil) {
+    if (error != NULL) {
+      *error = cacheError;
+    }
+    return nil;
+  }
+  if (![results isKindOfClass:[NSArray class]]) {
+    return nil;
+  }
+  return [self findAllInEntities:results error:error];
+}
+
+- (DKQueryCursor *)cursorWithPageSize:(NSUInteger)pageSize {
+  return [DKQueryCursor cursorWithQuery:self pageSize:pageSize];
+}
+
+- (NSArray *)findAllPartitionedByKey:(NSString *)key partitions:(NSUInteger)partitions maxConcurrent:(NSUInteger)maxConcurrent error:(NSError **)error {
+  NSArray *queries = [self partitionQueriesForKey:key count:partitions error:error];
+  if (queries == nil) {
+    return nil;
+  }
+  
+  NSMutableArray *partitionResults = [NSMutableArray new];
+  for (NSUInteger i = 0; i < queries.count; i++) {
+    [partitionResults addObject:@[]];
+  }
+  BOOL success = [self runQueries:queries maxConcurrent:maxConcurrent resultBlock:^(NSUInteger idx, NSArray *results) {
+    partitionResults[idx] = results;
+  } error:error];
+  if (!success) {
+    return nil;
+  }
+  
+  // Partitions are in ascending key order, concatenating them keeps a sort on the partition key
+  NSMutableArray *entities = [NSMutableArray new];
+  NSNumber *keyOrder = self.sort[key];
+  if (self.sort.count == 0 || (self.sort.count == 1 && keyOrder != nil)) {
+    NSEnumerator *enumerator = ([keyOrder integerValue] < 0) ? [partitionResults reverseObjectEnumerator] : [partitionResults objectEnumerator];
+    for (NSArray *results in enumerator) {
+      [entities addObjectsFromArray:results];
+    }
+    return [NSArray arrayWithArray:entities];
+  }
+  
+  for (NSArray *results in partitionResults) {
+    [entities addObjectsFromArray:results];
+  }
+  return [entities sortedArrayWithOptions:NSSortStable usingComparator:[isa comparatorForSort:self.sort]];
+}
+
+- (void)findAllPartitionedByKey:(NSString *)key
+                     partitions:(NSUInteger)partitions
+                  maxConcurrent:(NSUInteger)maxConcurrent
+ inBackgroundWithPartitionBlock:(void (^)(NSArray *results))partitionBlock
+                completionBlock:(void (^)(NSError *error))block {
+  partitionBlock = [partitionBlock copy];
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    NSArray *queries = [self partitionQueriesForKey:key count:partitions error:&error];
+    if (queries != nil) {
+      [self runQueries:queries maxConcurrent:maxConcurrent resultBlock:^(NSUInteger idx, NSArray *results) {
+        if (partitionBlock != NULL) {
+          dispatch_async(q, ^{
+            partitionBlock(results);
+          });
+        }
+      } error:&error];
+    }
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(error);
+      });
+    }
+  });
+}
+
+- (NSArray *)aggregate:(NSDictionary *)aggregates groupedByKeys:(NSArray *)keys error:(NSError **)error {
+  NSParameterAssert(aggregates.count > 0);
+  
+  NSDictionary *body = @{@"collection" : self.entityName,
+                         @"query" : [self conditionsDict],
+                         @"groupBy" : (keys != nil) ? keys : @[],
+                         @"aggregates" : aggregates};
+  
+  NSError *requestError = nil;
+  id rows = [[DKRequest request] sendRequestWithObject:body method:@"aggregate" entity:kDKRequestAggregate error:&requestError];
+  if (requestError != nil) {
+    if (error != NULL) {
+      *error = requestError;
+    }
+    return nil;
+  }
+  if (![rows isKindOfClass:[NSArray class]]) {
+    [NSError writeToError:error
+                     code:DKErrorInvalidResponse
+              description:NSLocalizedString(@"Aggregation did not return a row list", nil)
+                 original:nil];
+    return nil;
+  }
+  
+  // Rows are sorted by group keys and aggregate names
+  if (self.sort.count > 0) {
+    rows = [rows sortedArrayWithOptions:NSSortStable usingComparator:[isa comparatorForSort:self.sort]];
+  }
+  return rows;
+}
+
+- (void)aggregate:(NSDictionary *)aggregates groupedByKeys:(NSArray *)keys inBackgroundWithBlock:(void (^)(NSArray *rows, NSError *error))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    NSArray *rows = [self aggregate:aggregates groupedByKeys:keys error:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(rows, error);
+      });
+    }
+  });
+}
+
+- (NSArray *)countGroupedByKeys:(NSArray *)keys error:(NSError **)error {
+  return [self aggregate:@{@"count" : @{@"$count" : @YES}} groupedByKeys:keys error:error];
+}
+
+- (id)aggregateValueWithOperator:(NSString *)op key:(NSString *)key error:(NSError **)error {
+  NSParameterAssert(key != nil);
+  NSArray *rows = [self aggregate:@{@"value" : @{op : key}} groupedByKeys:nil error:error];
+  if (rows == nil) {
+    return nil;
+  }
+  id value = [[rows lastObject] objectForKey:@"value"];
+  if (value == [NSNull null]) {
+    return nil;
+  }
+  // No matching entities
+  if (value == nil && [op isEqualToString:@"$sum"]) {
+    return @0;
+  }
+  return value;
+}
+
+- (NSNumber *)sumOfKey:(NSString *)key error:(NSError **)error {
+  return [self aggregateValueWithOperator:@"$sum" key:key error:error];
+}
+
+- (NSNumber *)averageOfKey:(NSString *)key error:(NSError **)error {
+  return [self aggregateValueWithOperator:@"$avg" key:key error:error];
+}
+
+- (id)minimumOfKey:(NSString *)key error:(NSError **)error {
+  return [self aggregateValueWithOperator:@"$min" key:key error:error];
+}
+
+- (id)maximumOfKey:(NSString *)key error:(NSError **)error {
+  return [self aggregateValueWithOperator:@"$max" key:key error:error];
+}
+
+- (DKLiveQuery *)subscribeWithBlock:(void (^)(DKLiveQueryEvent event, DKEntity *entity))block {
+  DKLiveQuery *liveQuery = [[DKLiveQuery alloc] initWithQuery:self block:block];
+  [liveQuery start];
+  return liveQuery;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+  DKQuery *query = [[isa allocWithZone:zone] initWithEntityName:self.entityName];
+  query.queryMap = DKMutableDeepCopy(self.queryMap);
+  query.sort = DKMutableDeepCopy(self.sort);
+  query.ors = DKMutableDeepCopy(self.ors);
+  query.ands = DKMutableDeepCopy(self.ands);
+  query.fieldInclExcl = DKMutableDeepCopy(self.fieldInclExcl);
+  query.limit = self.limit;
+  query.limitRecursion = self.limitRecursion;
+  query.skip = self.skip;
+  query.cachePolicy = self.cachePolicy;
+  query.maxCacheAge = self.maxCacheAge;
+  return query;
+}
+
 @end
 
 @implementation DKQueryConditionProxy {
@@ -365,8 +614,198 @@
 }
 @end
 
+// Orders missing values first, then numbers, strings and other values
+static NSInteger DKSortTypeRank(id value) {
+  if (value == nil || value == [NSNull null]) {
+    return 0;
+  }
+  else if ([value isKindOfClass:[NSNumber class]]) {
+    return 1;
+  }
+  else if ([value isKindOfClass:[NSString class]]) {
+    return 2;
+  }
+  return 3;
+}
+
+static NSComparisonResult DKCompareSortValues(id value1, id value2) {
+  NSInteger rank1 = DKSortTypeRank(value1);
+  NSInteger rank2 = DKSortTypeRank(value2);
+  if (rank1 != rank2) {
+    return (rank1 < rank2) ? NSOrderedAscending : NSOrderedDescending;
+  }
+  if (rank1 == 1 || rank1 == 2) {
+    return [value1 compare:value2];
+  }
+  return NSOrderedSame;
+}
+
 @implementation DKQuery (Private)
 
++ (NSComparator)comparatorForSort:(NSDictionary *)sort {
+  // Keys are compared in the order they are sent to the server
+  NSArray *keys = [sort allKeys];
+  NSArray *orders = [sort objectsForKeys:keys notFoundMarker:@1];
+  return [^NSComparisonResult(id obj1, id obj2) {
+    for (NSUInteger i = 0; i < keys.count; i++) {
+      NSString *key = keys[i];
+      NSComparisonResult result = DKCompareSortValues([obj1 objectForKey:key], [obj2 objectForKey:key]);
+      if (result != NSOrderedSame) {
+        return ([orders[i] integerValue] < 0) ? (NSComparisonResult)-result : result;
+      }
+    }
+    return NSOrderedSame;
+  } copy];
+}
+
+- (id)boundaryValueForKey:(NSString *)key ascending:(BOOL)ascending error:(NSError **)error {
+  DKQuery *query = [self copy];
+  [query.sort removeAllObjects];
+  query.sort[key] = ascending ? @1 : @-1;
+  [query queryDictForKey:key][@"$exists"] = @YES;
+  // Keep the caller's projection, an inclusive one also returns the key
+  NSMutableDictionary *fields = query.fieldInclExcl;
+  if ([[fields allValues] containsObject:@1]) {
+    fields[key] = @1;
+  }
+  else {
+    [fields removeObjectForKey:key];
+  }
+  query.skip = 0;
+  query.limit = 1;
+  
+  DKEntity *entity = [[query findAll:error] lastObject];
+  return [entity objectForKey:key];
+}
+
+- (NSArray *)partitionQueriesForKey:(NSString *)key count:(NSUInteger)count error:(NSError **)error {
+  NSParameterAssert(key.length > 0);
+  
+  DKQuery *base = [self copy];
+  base.skip = 0;
+  base.limit = 0;
+  if (base.sort.count == 0) {
+    base.sort[key] = @1;
+  }
+  
+  // An equality condition on the key leaves nothing to split
+  id condition = base.queryMap[key];
+  if (count < 2 || (condition != nil && ![condition isKindOfClass:[NSDictionary class]])) {
+    return @[base];
+  }
+  
+  NSMutableArray *bounds = [NSMutableArray new];
+  if ([key isEqualToString:kDKEntityIDField]) {
+    // IDs are random hex strings, split them on the first four digits
+    for (NSUInteger i = 1; i < count; i++) {
+      [bounds addObject:[NSString stringWithFormat:@"%04x", (unsigned int)(0x10000 * i / count)]];
+    }
+  }
+  else {
+    NSError *boundsError = nil;
+    id min = [self boundaryValueForKey:key ascending:YES error:&boundsError];
+    id max = nil;
+    if (boundsError == nil) {
+      max = [self boundaryValueForKey:key ascending:NO error:&boundsError];
+    }
+    if (boundsError != nil) {
+      if (error != NULL) {
+        *error = boundsError;
+      }
+      return nil;
+    }
+    if (min == nil || max == nil) {
+      return @[base];
+    }
+    if (![min isKindOfClass:[NSNumber class]] || ![max isKindOfClass:[NSNumber class]]) {
+      [NSException raise:NSInvalidArgumentException
+                  format:NSLocalizedString(@"Partition key '%@' must be numeric or 'id'", nil), key];
+      return nil;
+    }
+    double lower = [min doubleValue];
+    double upper = [max doubleValue];
+    if (upper <= lower) {
+      return @[base];
+    }
+    for (NSUInteger i = 1; i < count; i++) {
+      [bounds addObject:@(lower + (upper - lower) * i / count)];
+    }
+  }
+  
+  // Deployd doesn't support $and, merge the ranges with the query's own conditions on the key
+  NSMutableArray *queries = [NSMutableArray new];
+  for (NSUInteger i = 0; i < count; i++) {
+    DKQuery *query = [base copy];
+    NSMutableDictionary *condition = [query queryDictForKey:key];
+    if (i > 0) {
+      id lower = condition[@"$gte"];
+      if (lower == nil || [lower compare:bounds[i - 1]] == NSOrderedAscending) {
+        condition[@"$gte"] = bounds[i - 1];
+      }
+    }
+    if (i < count - 1) {
+      id upper = condition[@"$lt"];
+      if (upper == nil || [upper compare:bounds[i]] == NSOrderedDescending) {
+        condition[@"$lt"] = bounds[i];
+      }
+    }
+    [queries addObject:query];
+  }
+  
+  return [NSArray arrayWithArray:queries];
+}
+
+- (BOOL)runQueries:(NSArray *)queries maxConcurrent:(NSUInteger)maxConcurrent resultBlock:(void (^)(NSUInteger idx, NSArray *results))block error:(NSError **)error {
+  dispatch_semaphore_t sema = dispatch_semaphore_create(MAX(maxConcurrent, 1));
+  dispatch_group_t group = dispatch_group_create();
+  dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+  NSObject *lock = [NSObject new];
+  __block NSError *firstError = nil;
+  
+  for (NSUInteger i = 0; i < queries.count; i++) {
+    dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
+    
+    // Don't start more queries after a failure
+    BOOL failed = NO;
+    @synchronized(lock) {
+      failed = (firstError != nil);
+    }
+    if (failed) {
+      dispatch_semaphore_signal(sema);
+      break;
+    }
+    
+    DKQuery *query = queries[i];
+    dispatch_group_async(group, queue, ^{
+      NSError *queryError = nil;
+      NSArray *results = [query findAll:&queryError];
+      @synchronized(lock) {
+        if (queryError != nil) {
+          if (firstError == nil) {
+            firstError = queryError;
+          }
+        }
+        else {
+          block(i, results);
+        }
+      }
+      dispatch_semaphore_signal(sema);
+    });
+  }
+  
+  dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+  dispatch_release(group);
+  dispatch_release(sema);
+  
+  if (firstError != nil) {
+    if (error != NULL) {
+      *error = firstError;
+    }
+    return NO;
+  }
+  return YES;
+}
+
 - (NSMutableDictionary*)queryDictForKey:(NSString *)key {
   NSMutableDictionary *dict = (self.queryMap)[key];
   if (dict == nil) {
@@ -377,6 +816,64 @@
   return dict;
 }
 
+- (NSMutableDictionary *)requestDict {
+  NSMutableDictionary *requestDict = [NSMutableDictionary dictionaryWithObjectsAndKeys: nil];
+  
+  if (self.queryMap.count > 0) {
+        for (id key in self.queryMap) {
+             id value = (self.queryMap)[key];
+             requestDict[key] = value;
+        }
+  }
+  if (self.ors.count > 0) {
+    requestDict[@"$or"] = self.ors;
+  }
+  if (self.ands.count > 0) {
+    requestDict[@"$and"] = self.ands;
+  }
+  if (self.fieldInclExcl.count > 0) {
+    requestDict[@"$fields"] = self.fieldInclExcl;
+  }
+  if (self.sort.count > 0) {
+    requestDict[@"$sort"] = self.sort;
+  }
+  if (self.limit > 0) {
+    requestDict[@"$limit"] = @(self.limit);
+  }
+  if (self.limitRecursion > 0) {
+    requestDict[@"$limitRecursion"] = @(self.limitRecursion);
+  }
+  if (self.skip > 0) {
+    requestDict[@"$skip"] = @(self.skip);
+  }
+  return requestDict;
+}
+
+- (NSMutableDictionary *)conditionsDict {
+  // Only the conditions, without sort, paging and key subsets
+  NSMutableDictionary *conditions = [self requestDict];
+  for (NSString *key in [conditions allKeys]) {
+    if ([key hasPrefix:@"$"] && ![key isEqualToString:@"$or"] && ![key isEqualToString:@"$and"]) {
+      [conditions removeObjectForKey:key];
+    }
+  }
+  return conditions;
+}
+
+- (NSArray *)entitiesFromResults:(NSArray *)results {
+  NSMutableArray *entities = [NSMutableArray new];
+  for (NSDictionary *objDict in results) {
+    if ([objDict isKindOfClass:[NSDictionary class]]) {
+      DKEntity *entity = [[[DKEntity classForEntityName:self.entityName] alloc] initWithName:self.entityName];
+      entity.resultMap = objDict;
+      
+      [entities addObject:entity];
+    }
+  }
+  
+  return [NSArray arrayWithArray:entities];
+}
+
 - (NSString *)makeRegexSafeString:(NSString *)string {
   // There are 11 special regex characters we need to escape!
   // 1: the opening square bracket [
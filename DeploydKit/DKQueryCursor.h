@@ -0,0 +1,106 @@
+//
+//  DKQueryCursor.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKQuery;
+@class DKEntity;
+
+/**
+ Pages through the results of a query by the last seen sort key instead of `$skip`.
+
+ Each page asks for the entities after the sort value of the previous page's last entity,
+ so the server never scans the skipped entities. Entities sharing a sort value are paged
+ by entity ID. The next page is prefetched in the background while the current one is consumed.
+
+ The cursor sorts by the query's sort key, or by entity ID if the query is unsorted or
+ tests the sort key for equality. Queries sorted by a key other than the ID are paged
+ with `$skip`/`$limit` unless `assumesSortKeyExists` is set, entities without a value
+ for the sort key can't be paged by it. Queries that sort by more than one key are always
+ paged with `$skip`/`$limit`. The query's own <[DKQuery skip]> and <[DKQuery limit]>
+ are ignored.
+ */
+@interface DKQueryCursor : NSObject <NSFastEnumeration>
+
+/**
+ A copy of the query the cursor was created with
+ */
+@property (nonatomic, strong, readonly) DKQuery *query;
+
+/**
+ The number of entities fetched per page
+ */
+@property (nonatomic, assign, readonly) NSUInteger pageSize;
+
+/**
+ Set to `YES` if every matching entity has a value for the sort key, pages are then fetched
+ by sort key instead of `$skip`. Entities without a value for it are not returned.
+ `NO` by default, set it before fetching the first page.
+ */
+@property (nonatomic, assign) BOOL assumesSortKeyExists;
+
+/**
+ `NO` once the last page was returned
+ */
+@property (nonatomic, assign, readonly) BOOL hasMore;
+
+/**
+ The error of the last page fetch, fast enumeration stops on error
+ */
+@property (nonatomic, strong, readonly) NSError *lastError;
+
+/** @name Creating Cursors */
+
+/**
+ Creates a new cursor for the query
+ @param query The query to page through, it is copied
+ @param pageSize The number of entities fetched per page
+ @return The initialized cursor
+ */
++ (DKQueryCursor *)cursorWithQuery:(DKQuery *)query pageSize:(NSUInteger)pageSize;
+
+/**
+ Initializes a new cursor for the query
+ @param query The query to page through, it is copied
+ @param pageSize The number of entities fetched per page
+ @return The initialized cursor
+ */
+- (id)initWithQuery:(DKQuery *)query pageSize:(NSUInteger)pageSize;
+
+/** @name Fetching Pages */
+
+/**
+ Returns the next page of entities
+ @param error The error object to set on error
+ @return The next page, or `nil` if there are no more entities or on error
+ */
+- (NSArray *)nextPage:(NSError **)error;
+
+/**
+ Returns the next page of entities in the background
+ @param block The callback block, results are `nil` if there are no more entities
+ */
+- (void)nextPageInBackgroundWithBlock:(void (^)(NSArray *results, NSError *error))block;
+
+/**
+ Enumerates the remaining entities, fetching pages as needed
+ @param block The block called for each entity, set `stop` to `YES` to stop enumerating
+ @param error The error object to set on error
+ @return `YES` if the enumeration finished or was stopped, `NO` on error
+ */
+- (BOOL)enumerateEntitiesUsingBlock:(void (^)(DKEntity *entity, BOOL *stop))block error:(NSError **)error;
+
+/**
+ Rewinds the cursor to the first page
+ */
+- (void)reset;
+
++ (id)new UNAVAILABLE_ATTRIBUTE;
+- (id)init UNAVAILABLE_ATTRIBUTE;
+
+@end
@@ -0,0 +1,325 @@
+//
+//  DKQueryCursor.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKQueryCursor.h"
+#import "DKQuery.h"
+#import "DKQuery-Private.h"
+#import "DKEntity.h"
+#import "DKManager.h"
+
+@interface DKQueryCursor ()
+@property (nonatomic, strong, readwrite) DKQuery *query;
+@property (nonatomic, assign, readwrite) NSUInteger pageSize;
+@property (nonatomic, assign, readwrite) BOOL hasMore;
+@property (nonatomic, strong, readwrite) NSError *lastError;
+@end
+
+@implementation DKQueryCursor {
+@private
+  dispatch_queue_t  queue_;
+  NSString         *sortKey_;
+  BOOL              ascending_;
+  BOOL              keyset_;
+  // Page state, only accessed on queue_
+  id                lastValue_;
+  NSString         *lastId_;
+  NSUInteger        offset_;
+  BOOL              exhausted_;
+  BOOL              hasPrefetched_;
+  NSArray          *prefetchedPage_;
+  NSError          *prefetchedError_;
+  // Fast enumeration state
+  NSArray          *enumPage_;
+  NSUInteger        enumIndex_;
+}
+
++ (DKQueryCursor *)cursorWithQuery:(DKQuery *)query pageSize:(NSUInteger)pageSize {
+  return [[self alloc] initWithQuery:query pageSize:pageSize];
+}
+
+- (id)initWithQuery:(DKQuery *)query pageSize:(NSUInteger)pageSize {
+  NSParameterAssert(query != nil);
+  NSParameterAssert(pageSize > 0);
+
+  self = [super init];
+  if (self) {
+    self.query = [query copy];
+    self.pageSize = pageSize;
+    self.hasMore = YES;
+
+    queue_ = dispatch_queue_create("DeploydKit query cursor queue", DISPATCH_QUEUE_SERIAL);
+
+    [self setupSortKey];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  dispatch_release(queue_);
+}
+
+- (void)setupSortKey {
+  NSMutableDictionary *sort = self.query.sort;
+
+  // Paging by sort key needs a single, ordered key
+  if (sort.count > 1) {
+    keyset_ = NO;
+    return;
+  }
+
+  keyset_ = YES;
+  sortKey_ = [[sort allKeys] lastObject];
+  ascending_ = (sortKey_ == nil || [sort[sortKey_] integerValue] >= 0);
+
+  // All matches share the same value, any order is valid so use the unique ID
+  id condition = self.query.queryMap[sortKey_];
+  if (sortKey_ == nil || (condition != nil && ![condition isKindOfClass:[NSDictionary class]])) {
+    sortKey_ = kDKEntityIDField;
+    [sort removeAllObjects];
+    sort[sortKey_] = ascending_ ? @1 : @-1;
+  }
+
+  // The sort value and ID of each result are needed for the next page
+  NSMutableDictionary *fields = self.query.fieldInclExcl;
+  if ([[fields allValues] containsObject:@1]) {
+    fields[sortKey_] = @1;
+    fields[kDKEntityIDField] = @1;
+  }
+  else {
+    [fields removeObjectForKey:sortKey_];
+    [fields removeObjectForKey:kDKEntityIDField];
+  }
+}
+
+- (void)fetchPage {
+  hasPrefetched_ = YES;
+  prefetchedPage_ = nil;
+  prefetchedError_ = nil;
+
+  // Entities without a value for the sort key would be skipped, only IDs always exist
+  BOOL unique = [sortKey_ isEqualToString:kDKEntityIDField];
+  BOOL keyset = keyset_ && (unique || self.assumesSortKeyExists);
+
+  // The page state is only updated once the page was fetched
+  NSMutableArray *entities = [NSMutableArray new];
+  id lastValue = lastValue_;
+  NSString *lastId = lastId_;
+  NSUInteger offset = offset_;
+  BOOL exhausted = exhausted_;
+  NSError *error = nil;
+
+  // Holding back the entities of the last sort value can leave a page empty, fetch until it isn't
+  while (!exhausted && entities.count == 0) {
+    NSUInteger limit = self.pageSize;
+
+    if (!keyset) {
+      NSArray *results = [self findEntitiesAfterValue:nil skip:offset limit:limit error:&error];
+      if (error != nil) {
+        break;
+      }
+      [entities addObjectsFromArray:results];
+      offset += results.count;
+      exhausted = (results.count < limit);
+      continue;
+    }
+
+    // The rest of the entities sharing the last sort value, in ID order
+    if (!unique && lastValue != nil) {
+      NSArray *ties = [self findEntitiesWithValue:lastValue afterId:lastId limit:limit error:&error];
+      if (error != nil) {
+        break;
+      }
+      [entities addObjectsFromArray:ties];
+      lastId = [[ties lastObject] entityId] ?: lastId;
+      limit -= ties.count;
+      if (limit == 0) {
+        continue;
+      }
+    }
+
+    NSArray *results = [self findEntitiesAfterValue:lastValue skip:0 limit:limit error:&error];
+    if (error != nil) {
+      break;
+    }
+    exhausted = (results.count < limit);
+
+    NSUInteger count = results.count;
+    if (count > 0) {
+      lastValue = [results[count - 1] objectForKey:sortKey_];
+      lastId = nil;
+    }
+    // The server orders entities sharing a sort value arbitrarily, the ones of the last value
+    // are held back and fetched by ID with the next page
+    if (!unique && !exhausted) {
+      while (count > 0 && [[results[count - 1] objectForKey:sortKey_] isEqual:lastValue]) {
+        count--;
+      }
+    }
+    [entities addObjectsFromArray:[results subarrayWithRange:NSMakeRange(0, count)]];
+  }
+
+  if (error != nil) {
+    prefetchedError_ = error;
+    return;
+  }
+
+  lastValue_ = lastValue;
+  lastId_ = lastId;
+  offset_ = offset;
+  exhausted_ = exhausted;
+  prefetchedPage_ = [NSArray arrayWithArray:entities];
+}
+
+- (NSArray *)findEntitiesAfterValue:(id)value skip:(NSUInteger)skip limit:(NSUInteger)limit error:(NSError **)error {
+  DKQuery *page = [self.query copy];
+  page.skip = skip;
+  page.limit = limit;
+
+  if (keyset_ && self.assumesSortKeyExists && ![sortKey_ isEqualToString:kDKEntityIDField]) {
+    [page queryDictForKey:sortKey_][@"$exists"] = @YES;
+  }
+  if (value != nil) {
+    [page queryDictForKey:sortKey_][ascending_ ? @"$gt" : @"$lt"] = value;
+  }
+  return [page findAll:error];
+}
+
+- (NSArray *)findEntitiesWithValue:(id)value afterId:(NSString *)entityId limit:(NSUInteger)limit error:(NSError **)error {
+  DKQuery *page = [self.query copy];
+  page.skip = 0;
+  page.limit = limit;
+
+  [page.ands addObject:[NSMutableDictionary dictionaryWithObject:value forKey:sortKey_]];
+  if (entityId != nil) {
+    [page queryDictForKey:kDKEntityIDField][@"$gt"] = entityId;
+  }
+  [page.sort removeAllObjects];
+  page.sort[kDKEntityIDField] = @1;
+  return [page findAll:error];
+}
+
+- (NSArray *)nextPage:(NSError **)error {
+  __block NSArray *page = nil;
+  __block NSError *pageError = nil;
+  __block BOOL more = NO;
+
+  // Waits for a prefetch in progress, or fetches the page now
+  dispatch_sync(queue_, ^{
+    if (!hasPrefetched_) {
+      [self fetchPage];
+    }
+    page = prefetchedPage_;
+    pageError = prefetchedError_;
+    more = !exhausted_;
+
+    hasPrefetched_ = NO;
+    prefetchedPage_ = nil;
+    prefetchedError_ = nil;
+  });
+
+  self.lastError = pageError;
+  self.hasMore = (pageError != nil || more);
+
+  if (pageError != nil) {
+    if (error != NULL) {
+      *error = pageError;
+    }
+    return nil;
+  }
+
+  // Fetch the next page while this one is consumed
+  if (more) {
+    dispatch_async(queue_, ^{
+      if (!hasPrefetched_) {
+        [self fetchPage];
+      }
+    });
+  }
+
+  return (page.count > 0) ? page : nil;
+}
+
+- (void)nextPageInBackgroundWithBlock:(void (^)(NSArray *results, NSError *error))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    NSArray *results = [self nextPage:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(results, error);
+      });
+    }
+  });
+}
+
+- (BOOL)enumerateEntitiesUsingBlock:(void (^)(DKEntity *entity, BOOL *stop))block error:(NSError **)error {
+  NSParameterAssert(block != NULL);
+
+  BOOL stop = NO;
+  while (!stop) {
+    NSArray *page = [self nextPage:error];
+    if (page == nil) {
+      return (self.lastError == nil);
+    }
+    for (DKEntity *entity in page) {
+      block(entity, &stop);
+      if (stop) {
+        break;
+      }
+    }
+  }
+  return YES;
+}
+
+- (void)reset {
+  dispatch_sync(queue_, ^{
+    lastValue_ = nil;
+    lastId_ = nil;
+    offset_ = 0;
+    exhausted_ = NO;
+    hasPrefetched_ = NO;
+    prefetchedPage_ = nil;
+    prefetchedError_ = nil;
+  });
+
+  self.hasMore = YES;
+  self.lastError = nil;
+  enumPage_ = nil;
+  enumIndex_ = 0;
+}
+
+#pragma mark NSFastEnumeration
+
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state objects:(id __unsafe_unretained [])buffer count:(NSUInteger)len {
+  if (state->state == 0) {
+    state->state = 1;
+    state->mutationsPtr = &state->extra[0];
+    enumPage_ = nil;
+    enumIndex_ = 0;
+  }
+
+  if (enumIndex_ >= enumPage_.count) {
+    enumPage_ = [self nextPage:NULL];
+    enumIndex_ = 0;
+    if (enumPage_.count == 0) {
+      return 0;
+    }
+  }
+
+  NSUInteger count = MIN(len, enumPage_.count - enumIndex_);
+  for (NSUInteger i = 0; i < count; i++) {
+    buffer[i] = enumPage_[enumIndex_ + i];
+  }
+  enumIndex_ += count;
+  state->itemsPtr = buffer;
+
+  return count;
+}
+
+@end
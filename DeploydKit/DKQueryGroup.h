@@ -0,0 +1,68 @@
+//
+//  DKQueryGroup.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKQuery;
+
+/**
+ Executes several queries, across collections, in a single round trip.
+
+ The queries are sent to the query batch resource (see `Deployd-Modules/node_modules/query-batch`),
+ which runs them concurrently on the server. Each query's block receives its results as if the
+ query had run alone. Batched queries are not cached.
+ */
+@interface DKQueryGroup : NSObject
+
+/**
+ The number of queries in the group
+ */
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/** @name Creating Groups */
+
+/**
+ Creates a new, empty query group
+ @return The initialized group
+ */
++ (DKQueryGroup *)group;
+
+/** @name Adding Queries */
+
+/**
+ Adds a query whose matching entities are returned to the block
+ @param query The query to add
+ @param block The result block
+ */
+- (void)addQuery:(DKQuery *)query resultBlock:(void (^)(NSArray *results, NSError *error))block;
+
+/**
+ Adds a query whose matching entity count is returned to the block
+ @param query The query to add, <[DKQuery limit]> and <[DKQuery skip]> are ignored
+ @param block The count block
+ */
+- (void)addCountQuery:(DKQuery *)query countBlock:(void (^)(NSUInteger count, NSError *error))block;
+
+/** @name Executing Queries */
+
+/**
+ Executes all queries in one request and calls their blocks before returning
+ @param error The error object to set if the request failed
+ @return `YES` if the request succeeded, individual queries may still have failed
+ */
+- (BOOL)execute:(NSError **)error;
+
+/**
+ Executes all queries in one request in the background
+ 
+ The query blocks are called on the calling queue, before the completion block.
+ @param block The completion block
+ */
+- (void)executeInBackgroundWithBlock:(void (^)(NSError *error))block;
+
+@end
@@ -0,0 +1,169 @@
+//
+//  DKQueryGroup.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKQueryGroup.h"
+#import "DKQuery.h"
+#import "DKQuery-Private.h"
+#import "DKRequest.h"
+#import "DKManager.h"
+#import "NSError+DeploydKit.h"
+
+@interface DKQueryGroup ()
+@property (nonatomic, strong) NSMutableArray *queries;
+@property (nonatomic, strong) NSMutableArray *blocks;
+@property (nonatomic, strong) NSMutableArray *countFlags;
+@end
+
+@implementation DKQueryGroup
+
++ (DKQueryGroup *)group {
+  return [[self alloc] init];
+}
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    self.queries = [NSMutableArray new];
+    self.blocks = [NSMutableArray new];
+    self.countFlags = [NSMutableArray new];
+  }
+  return self;
+}
+
+- (NSUInteger)count {
+  return self.queries.count;
+}
+
+- (void)addQuery:(DKQuery *)query resultBlock:(void (^)(NSArray *results, NSError *error))block {
+  [self addQuery:query block:block count:NO];
+}
+
+- (void)addCountQuery:(DKQuery *)query countBlock:(void (^)(NSUInteger count, NSError *error))block {
+  [self addQuery:query block:block count:YES];
+}
+
+- (void)addQuery:(DKQuery *)query block:(id)block count:(BOOL)count {
+  NSParameterAssert(query != nil);
+  [self.queries addObject:query];
+  [self.blocks addObject:(block != nil) ? [block copy] : [NSNull null]];
+  [self.countFlags addObject:@(count)];
+}
+
+- (NSString *)keyForQueryAtIndex:(NSUInteger)idx {
+  return [NSString stringWithFormat:@"q%u", (unsigned int)idx];
+}
+
+- (BOOL)execute:(NSError **)error {
+  return [self executeWithCallbackQueue:NULL error:error];
+}
+
+- (void)executeInBackgroundWithBlock:(void (^)(NSError *error))block {
+  block = [block copy];
+  dispatch_queue_t q = dispatch_get_current_queue();
+  dispatch_async([DKManager queue], ^{
+    NSError *error = nil;
+    [self executeWithCallbackQueue:q error:&error];
+    if (block != NULL) {
+      dispatch_async(q, ^{
+        block(error);
+      });
+    }
+  });
+}
+
+- (BOOL)executeWithCallbackQueue:(dispatch_queue_t)q error:(NSError **)error {
+  NSArray *queries = [NSArray arrayWithArray:self.queries];
+  NSArray *blocks = [NSArray arrayWithArray:self.blocks];
+  NSArray *countFlags = [NSArray arrayWithArray:self.countFlags];
+  if (queries.count == 0) {
+    return YES;
+  }
+
+  // Create request dict
+  NSMutableDictionary *requestDict = [NSMutableDictionary new];
+  for (NSUInteger i = 0; i < queries.count; i++) {
+    DKQuery *query = queries[i];
+    requestDict[[self keyForQueryAtIndex:i]] = @{@"collection" : query.entityName,
+                                                 @"query" : [query requestDict],
+                                                 @"count" : countFlags[i]};
+  }
+
+  // Send request synchronously
+  DKRequest *request = [DKRequest request];
+  request.cachePolicy = DKCachePolicyIgnoreCache;
+
+  NSError *requestError = nil;
+  id results = [request sendRequestWithObject:requestDict method:@"batch" entity:kDKRequestQueryBatch error:&requestError];
+  if (requestError == nil && ![results isKindOfClass:[NSDictionary class]]) {
+    [NSError writeToError:&requestError
+                     code:DKErrorInvalidResponse
+              description:NSLocalizedString(@"Query batch did not return a result NSDictionary", nil)
+                 original:nil];
+  }
+
+  for (NSUInteger i = 0; i < queries.count; i++) {
+    DKQuery *query = queries[i];
+    id block = blocks[i];
+    BOOL count = [countFlags[i] boolValue];
+    NSDictionary *entry = requestError ? nil : results[[self keyForQueryAtIndex:i]];
+
+    NSError *queryError = requestError;
+    id errorObj = entry[@"error"];
+    if (queryError == nil && (![entry isKindOfClass:[NSDictionary class]] || errorObj != nil)) {
+      NSString *message = [errorObj isKindOfClass:[NSDictionary class]] ? errorObj[@"message"] : [errorObj description];
+      [NSError writeToError:&queryError
+                       code:DKErrorOperationFailed
+                description:(message.length > 0) ? message : NSLocalizedString(@"Query failed", nil)
+                   original:nil];
+    }
+
+    id result = queryError ? nil : entry[@"result"];
+    dispatch_block_t callback = nil;
+    if (count) {
+      NSUInteger matched = [result isKindOfClass:[NSNumber class]] ? [result unsignedIntegerValue] : 0;
+      void (^countBlock)(NSUInteger, NSError *) = (block != [NSNull null]) ? block : nil;
+      callback = ^{
+        if (countBlock != NULL) {
+          countBlock(matched, queryError);
+        }
+      };
+    }
+    else {
+      NSArray *entities = nil;
+      if ([result isKindOfClass:[NSArray class]]) {
+        entities = [query entitiesFromResults:result];
+      }
+      else if ([result isKindOfClass:[NSDictionary class]]) {
+        entities = [query entitiesFromResults:@[result]];
+      }
+      void (^resultBlock)(NSArray *, NSError *) = (block != [NSNull null]) ? block : nil;
+      callback = ^{
+        if (resultBlock != NULL) {
+          resultBlock(entities, queryError);
+        }
+      };
+    }
+
+    if (q != NULL) {
+      dispatch_async(q, callback);
+    }
+    else {
+      callback();
+    }
+  }
+
+  if (requestError != nil) {
+    if (error != NULL) {
+      *error = requestError;
+    }
+    return NO;
+  }
+  return YES;
+}
+
+@end
@@ -12,6 +12,7 @@
 
 #import "DKQuery.h"
 #import "DKEntity.h"
+#import "DKImagePipeline.h"
 
 /**
  A table view to display a specified entity paginated
@@ -49,14 +50,40 @@
 
 /**
  The entity key to use for the cell image data
+
+ Images are decoded in the background and downsampled to the row height, see <DKImagePipeline>.
  */
 @property (nonatomic, copy) NSString *displayedImageKey;
 
+/**
+ The pipeline decoding and caching the cell images, the shared pipeline by default
+ */
+@property (nonatomic, strong) DKImagePipeline *imagePipeline;
+
+/**
+ The image displayed while the cell image is decoded, `nil` by default
+ */
+@property (nonatomic, strong) UIImage *placeholderImage;
+
 /**
  The number of objects displayed per page
  */
 @property (nonatomic, assign) NSUInteger objectsPerPage;
 
+/**
+ Set to `YES` if every object has a value for the table query's sort key, pages are then fetched
+ by sort key instead of `$skip`. Takes effect on the next reload. Defaults to `NO`. See <[DKQueryCursor assumesSortKeyExists]>.
+ */
+@property (nonatomic, assign) BOOL assumesSortKeyExists;
+
+/**
+ If the table subscribes to the query and applies inserts, updates and deletes pushed by the server
+
+ Changes are applied to the loaded objects in place, the table reloads if the subscription
+ reconnects. Takes effect on the next reload. Defaults to `NO`. See <DKLiveQuery>.
+ */
+@property (nonatomic, assign) BOOL liveUpdatesEnabled;
+
 /**
  If the table view is currently fetching a page
  */
@@ -12,15 +12,20 @@
 
 #import "DKQueryTableViewController.h"
 #import "DKEntity.h"
+#import "DKQueryCursor.h"
+#import "DKLiveQuery.h"
+#import "DKQuery-Private.h"
 
 @interface DKQueryTableViewController ()
 @property (nonatomic, assign) BOOL hasMore;
 @property (nonatomic, assign, readwrite) BOOL isLoading;
-@property (nonatomic, assign) NSUInteger currentOffset;
+@property (nonatomic, strong) DKQueryCursor *cursor;
+@property (nonatomic, strong) DKLiveQuery *liveQuery;
 @property (nonatomic, strong, readwrite) NSMutableArray *objects;
 @property (nonatomic, strong, readwrite) UISearchBar *searchBar;
 @property (nonatomic, strong) UIButton *searchOverlay;
 @property (nonatomic, assign) BOOL searchTextChanged;
+@property (nonatomic, strong) NSMutableDictionary *imageOperations;
 @end
 
 @interface DKEntityTableNextPageCell : UITableViewCell
@@ -37,9 +42,10 @@
   self = [super initWithStyle:style];
   if (self) {
     self.objectsPerPage = 25;
-    self.currentOffset = 0;
     self.entityName = entityName;
     self.objects = [NSMutableArray new];
+    self.imagePipeline = [DKImagePipeline sharedPipeline];
+    self.imageOperations = [NSMutableDictionary new];
     
     // Search bar
     self.searchBar = [[UISearchBar alloc] initWithFrame:CGRectMake(0, 0, 320, 44)];
@@ -55,6 +61,11 @@
   return self;
 }
 
+- (void)dealloc {
+  [self.liveQuery cancel];
+  [self cancelImageOperations];
+}
+
 - (void)processQueryResults:(NSArray *)results error:(NSError *)error callback:(void (^)(NSError *error))callback {
   NSAssert(dispatch_get_current_queue() == dispatch_get_main_queue(), @"query results not processed on main queue");
   
@@ -72,12 +83,25 @@
     }
   }
   
+  // Live updates may already have inserted entities of the fetched page
+  if (self.liveQuery != nil && results.count > 0) {
+    NSMutableSet *loadedIds = [NSMutableSet new];
+    for (id object in self.objects) {
+      id objectId = [object objectForKey:kDKEntityIDField];
+      if (objectId != nil) {
+        [loadedIds addObject:objectId];
+      }
+    }
+    results = [results filteredArrayUsingPredicate:[NSPredicate predicateWithBlock:^BOOL(id obj, NSDictionary *bindings) {
+      return ![loadedIds containsObject:[obj objectForKey:kDKEntityIDField]];
+    }]];
+  }
+  
   if (results.count > 0) {
     [self.objects addObjectsFromArray:results];  
   }
   
-  self.currentOffset += results.count;
-  self.hasMore = (results.count == self.objectsPerPage);
+  self.hasMore = (error == nil && self.cursor.hasMore);
   self.isLoading = NO;
   self.tableView.userInteractionEnabled = YES;
   
@@ -114,6 +138,14 @@
   self.isLoading = YES;
   self.tableView.userInteractionEnabled = NO;
   
+  // Pages are fetched by the last loaded sort value, not by offset
+  if (self.cursor != nil) {
+    [self.cursor nextPageInBackgroundWithBlock:^(NSArray *results, NSError *error) {
+      [self processQueryResults:results error:error callback:callback];
+    }];
+    return;
+  }
+  
   DKQuery *q = nil;
   NSString *queryText = self.searchBar.text;
   
@@ -129,14 +161,71 @@
   
   NSAssert(q != nil, @"query cannot be nil");
   
-  q.skip = self.currentOffset;
-  q.limit = self.objectsPerPage;
+  if (self.liveUpdatesEnabled) {
+    [self subscribeToQuery:q];
+  }
   
-  [q findAllInBackgroundWithBlock:^(NSArray *results, NSError *error) {
-     [self processQueryResults:results error:error callback:callback];
+  self.cursor = [q cursorWithPageSize:self.objectsPerPage];
+  self.cursor.assumesSortKeyExists = self.assumesSortKeyExists;
+  [self.cursor nextPageInBackgroundWithBlock:^(NSArray *results, NSError *error) {
+    [self processQueryResults:results error:error callback:callback];
+  }];
+}
+
+- (void)subscribeToQuery:(DKQuery *)query {
+  __weak DKQueryTableViewController *weakSelf = self;
+  self.liveQuery = [query subscribeWithBlock:^(DKLiveQueryEvent event, DKEntity *entity) {
+    [weakSelf applyLiveQueryEvent:event entity:entity sort:query.sort];
   }];
 }
 
+- (void)applyLiveQueryEvent:(DKLiveQueryEvent)event entity:(DKEntity *)entity sort:(NSDictionary *)sort {
+  // Writes made while disconnected were missed
+  if (event == DKLiveQueryEventReconnected) {
+    if (!self.isLoading) {
+      [self reloadInBackground];
+    }
+    return;
+  }
+  
+  // Rows are matched by id
+  NSString *entityId = entity.entityId;
+  if (entityId == nil) {
+    return;
+  }
+  NSUInteger idx = [self.objects indexOfObjectPassingTest:^BOOL(id obj, NSUInteger i, BOOL *stop) {
+    return [[obj objectForKey:kDKEntityIDField] isEqual:entityId];
+  }];
+  if (idx != NSNotFound) {
+    [self.objects removeObjectAtIndex:idx];
+  }
+  
+  if (event != DKLiveQueryEventDeleted) {
+    NSUInteger insertIdx = NSNotFound;
+    if (sort.count > 0) {
+      insertIdx = [self.objects indexOfObject:entity
+                                inSortedRange:NSMakeRange(0, self.objects.count)
+                                      options:NSBinarySearchingInsertionIndex | NSBinarySearchingLastEqual
+                              usingComparator:[DKQuery comparatorForSort:sort]];
+    }
+    else if (idx != NSNotFound) {
+      insertIdx = idx;
+    }
+    else if (!self.hasMore) {
+      insertIdx = self.objects.count;
+    }
+    
+    // Entities sorting after the loaded pages show up when their page is fetched
+    if (insertIdx != NSNotFound && !(insertIdx == self.objects.count && self.hasMore)) {
+      [self.objects insertObject:entity atIndex:insertIdx];
+    }
+  }
+  
+  [self queryTableWillReload];
+  [self.tableView reloadData];
+  [self queryTableDidReload];
+}
+
 - (void)reloadInBackground {
   [self reloadInBackgroundWithBlock:NULL];
 }
@@ -151,7 +240,10 @@
   }
   
   self.hasMore = NO;
-  self.currentOffset = 0;
+  self.cursor = nil;
+  [self.liveQuery cancel];
+  self.liveQuery = nil;
+  [self cancelImageOperations];
   
   [self.objects removeAllObjects];
   [self.tableView reloadData];
@@ -236,12 +328,67 @@
   }
   if (self.displayedImageKey.length > 0) {
     // DKEntity and NSDictionary both implement objectForKey
-    cell.imageView.image = [UIImage imageWithData:object[self.displayedImageKey]];
+    [self displayImageData:object[self.displayedImageKey] object:object inCell:cell];
   }
   
   return cell;
 }
 
+#pragma mark Cell Images
+
+- (NSString *)imageKeyForObject:(id)object data:(NSData *)data {
+  // Updated entities get a new key, objects without ID aren't cached
+  id objectId = [object objectForKey:kDKEntityIDField];
+  if (objectId == nil) {
+    return nil;
+  }
+  return [NSString stringWithFormat:@"%@/%@/%@/%@/%u", self.entityName, objectId, self.displayedImageKey,
+          [object objectForKey:kDKEntityUpdatedAtField], data.length];
+}
+
+- (void)displayImageData:(NSData *)data object:(id)object inCell:(UITableViewCell *)cell {
+  // A reused cell doesn't display the image of its previous row anymore
+  NSValue *cellKey = [NSValue valueWithNonretainedObject:cell];
+  [self.imageOperations[cellKey] cancel];
+  [self.imageOperations removeObjectForKey:cellKey];
+  
+  if (![data isKindOfClass:[NSData class]] || data.length == 0) {
+    cell.imageView.image = nil;
+    return;
+  }
+  
+  CGFloat scale = [UIScreen mainScreen].scale;
+  CGFloat maxPixelSize = self.tableView.rowHeight * scale;
+  NSString *key = [self imageKeyForObject:object data:data];
+  CGImageRef cachedImage = [self.imagePipeline cachedImageForKey:key maxPixelSize:maxPixelSize];
+  if (cachedImage != NULL) {
+    cell.imageView.image = [UIImage imageWithCGImage:cachedImage scale:scale orientation:UIImageOrientationUp];
+    return;
+  }
+  
+  cell.imageView.image = self.placeholderImage;
+  __weak DKQueryTableViewController *weakSelf = self;
+  __weak UITableViewCell *weakCell = cell;
+  __block __weak NSOperation *weakOperation = nil;
+  NSOperation *operation = [self.imagePipeline decodeImageWithData:data key:key maxPixelSize:maxPixelSize block:^(CGImageRef image) {
+    // The cell may display another row by now, possibly with a cached image
+    NSMutableDictionary *imageOperations = weakSelf.imageOperations;
+    if (weakOperation == nil || imageOperations[cellKey] != weakOperation) {
+      return;
+    }
+    [imageOperations removeObjectForKey:cellKey];
+    weakCell.imageView.image = (image != NULL) ? [UIImage imageWithCGImage:image scale:scale orientation:UIImageOrientationUp] : nil;
+    [weakCell setNeedsLayout];
+  }];
+  weakOperation = operation;
+  self.imageOperations[cellKey] = operation;
+}
+
+- (void)cancelImageOperations {
+  [[self.imageOperations allValues] makeObjectsPerformSelector:@selector(cancel)];
+  [self.imageOperations removeAllObjects];
+}
+
 - (UITableViewCell *)tableViewNextPageCell:(UITableView *)tableView {
   static NSString *identifier = @"DKEntityTableNextPageCell";
   DKEntityTableNextPageCell *cell = [tableView dequeueReusableCellWithIdentifier:identifier];
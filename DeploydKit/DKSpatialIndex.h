@@ -0,0 +1,117 @@
+//
+//  DKSpatialIndex.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKEntity;
+
+/**
+ An in-memory grid index over the [x, y] point values of a key, for answering `$near`, `$maxDistance`
+ and `$within` box queries on local entities without a server round trip.
+
+ Distances are planar, like a MongoDB "2d" index, in the units of the points. Choose a cell size
+ close to the typical query distance, e.g. the span of a map view.
+
+ Entities are added explicitly, or kept up to date while the index is updating: entities fetched by
+ <DKQuery> `findAll` without key subsets, saved, refreshed or deleted are added to or
+ removed from the index.
+
+    DKSpatialIndex *index = [[DKSpatialIndex alloc] initWithEntityName:@"post" key:@"location" cellSize:0.05];
+    [index startUpdating];
+    // ...
+    DKQuery *query = [DKQuery queryWithEntityName:@"post"];
+    [query whereKey:@"location" nearPoint:@[@9.19, @45.46] withinDistance:@0.1];
+    NSArray *nearby = [query findAllInSpatialIndex:index error:&error];
+ */
+@interface DKSpatialIndex : NSObject
+
+/**
+ The entity name of the indexed collection
+ */
+@property (nonatomic, copy, readonly) NSString *entityName;
+
+/**
+ The entity key holding the [x, y] points
+ */
+@property (nonatomic, copy, readonly) NSString *key;
+
+/**
+ The width and height of a grid cell
+ */
+@property (nonatomic, assign, readonly) double cellSize;
+
+/**
+ The number of indexed entities
+ */
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/** @name Creating Indexes */
+
+/**
+ Initializes an empty index
+ @param entityName The entity name of the indexed collection
+ @param key The entity key holding the [x, y] points
+ @param cellSize The width and height of a grid cell, must be positive
+ @return The initialized index
+ */
+- (id)initWithEntityName:(NSString *)entityName key:(NSString *)key cellSize:(double)cellSize;
+
+/** @name Updating Indexes */
+
+/**
+ Adds or replaces entities, entities without a point value for the key are removed
+ @param entities The entities to index, of type <DKEntity> or NSDictionary
+ */
+- (void)addEntities:(NSArray *)entities;
+
+/**
+ Removes an entity
+ @param entityId The ID of the entity to remove
+ */
+- (void)removeEntityWithId:(NSString *)entityId;
+
+/**
+ Removes all entities
+ */
+- (void)removeAllEntities;
+
+/**
+ Starts adding and removing the entities fetched, saved or deleted in the collection
+
+ The index is retained until <stopUpdating> is called.
+ */
+- (void)startUpdating;
+
+/**
+ Stops updating the index
+ */
+- (void)stopUpdating;
+
+/** @name Searching Indexes */
+
+/**
+ Returns the indexed entities nearest to a point, ordered by distance
+ @param point The [x, y] point
+ @param maxDistance The maximum distance from the point, or a negative value for no maximum
+ @param limit The maximum number of entities returned, or 0 for no limit
+ @return The nearest entities
+ */
+- (NSArray *)entitiesNearPoint:(NSArray *)point maxDistance:(double)maxDistance limit:(NSUInteger)limit;
+
+/**
+ Returns the indexed entities inside a box
+ @param lowerLeft The [x, y] lower left corner of the box
+ @param upperRight The [x, y] upper right corner of the box
+ @return The entities inside the box, unordered
+ */
+- (NSArray *)entitiesWithinBoxFrom:(NSArray *)lowerLeft to:(NSArray *)upperRight;
+
++ (id)new UNAVAILABLE_ATTRIBUTE;
+- (id)init UNAVAILABLE_ATTRIBUTE;
+
+@end
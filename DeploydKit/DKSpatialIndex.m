@@ -0,0 +1,377 @@
+//
+//  DKSpatialIndex.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKSpatialIndex.h"
+#import "DKSpatialIndex-Private.h"
+#import "DKQueryEvaluator.h"
+#import "DKEntity.h"
+#import "DKEntity-Private.h"
+
+// Cell coordinates are clamped to 32 bits and packed into one key
+static NSNumber *DKCellKey(NSInteger i, NSInteger j) {
+  int32_t ci = (int32_t)MAX(MIN(i, INT32_MAX), INT32_MIN);
+  int32_t cj = (int32_t)MAX(MIN(j, INT32_MAX), INT32_MIN);
+  return @((int64_t)(((uint64_t)(uint32_t)ci << 32) | (uint32_t)cj));
+}
+
+static void DKCellCoordinates(NSNumber *cellKey, NSInteger *i, NSInteger *j) {
+  uint64_t key = (uint64_t)[cellKey longLongValue];
+  *i = (int32_t)(uint32_t)(key >> 32);
+  *j = (int32_t)(uint32_t)(key & 0xffffffff);
+}
+
+@interface DKSpatialIndex ()
+@property (nonatomic, copy, readwrite) NSString *entityName;
+@property (nonatomic, copy, readwrite) NSString *key;
+@property (nonatomic, assign, readwrite) double cellSize;
+@end
+
+@implementation DKSpatialIndex {
+@private
+  NSMutableDictionary *objects_;
+  NSMutableDictionary *cellKeys_;
+  NSMutableDictionary *cells_;
+}
+
++ (NSMutableArray *)updatingIndexes {
+  static NSMutableArray *indexes;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    indexes = [NSMutableArray new];
+  });
+  return indexes;
+}
+
+- (id)initWithEntityName:(NSString *)entityName key:(NSString *)key cellSize:(double)cellSize {
+  NSParameterAssert(entityName.length > 0);
+  NSParameterAssert(key.length > 0);
+  NSParameterAssert(cellSize > 0);
+
+  self = [super init];
+  if (self) {
+    self.entityName = entityName;
+    self.key = key;
+    self.cellSize = cellSize;
+
+    objects_ = [NSMutableDictionary new];
+    cellKeys_ = [NSMutableDictionary new];
+    cells_ = [NSMutableDictionary new];
+  }
+  return self;
+}
+
+- (NSUInteger)count {
+  @synchronized(self) {
+    return objects_.count;
+  }
+}
+
+- (NSNumber *)cellKeyForX:(double)x y:(double)y {
+  return DKCellKey((NSInteger)floor(x / self.cellSize), (NSInteger)floor(y / self.cellSize));
+}
+
+#pragma mark Updating
+
+- (void)addEntities:(NSArray *)entities {
+  @synchronized(self) {
+    for (id entity in entities) {
+      NSDictionary *object = [entity isKindOfClass:[DKEntity class]] ? [entity resultMap] : entity;
+      if (![object isKindOfClass:[NSDictionary class]]) {
+        continue;
+      }
+      NSString *entityId = object[kDKEntityIDField];
+      if (entityId == nil) {
+        continue;
+      }
+
+      [self removeObjectWithId:entityId];
+
+      double x = 0, y = 0;
+      id point = [DKQueryEvaluator valueForKeyPath:self.key inObject:object];
+      if (![DKQueryEvaluator getCoordinatesOfPoint:point x:&x y:&y]) {
+        continue;
+      }
+      NSNumber *cellKey = [self cellKeyForX:x y:y];
+      NSMutableSet *cell = cells_[cellKey];
+      if (cell == nil) {
+        cell = [NSMutableSet new];
+        cells_[cellKey] = cell;
+      }
+      [cell addObject:entityId];
+      cellKeys_[entityId] = cellKey;
+      objects_[entityId] = object;
+    }
+  }
+}
+
+- (void)removeObjectWithId:(NSString *)entityId {
+  NSNumber *cellKey = cellKeys_[entityId];
+  if (cellKey == nil) {
+    return;
+  }
+  NSMutableSet *cell = cells_[cellKey];
+  [cell removeObject:entityId];
+  if (cell.count == 0) {
+    [cells_ removeObjectForKey:cellKey];
+  }
+  [cellKeys_ removeObjectForKey:entityId];
+  [objects_ removeObjectForKey:entityId];
+}
+
+- (void)removeEntityWithId:(NSString *)entityId {
+  @synchronized(self) {
+    [self removeObjectWithId:entityId];
+  }
+}
+
+- (void)removeAllEntities {
+  @synchronized(self) {
+    [objects_ removeAllObjects];
+    [cellKeys_ removeAllObjects];
+    [cells_ removeAllObjects];
+  }
+}
+
+- (void)startUpdating {
+  NSMutableArray *indexes = [isa updatingIndexes];
+  @synchronized(indexes) {
+    if ([indexes indexOfObjectIdenticalTo:self] == NSNotFound) {
+      [indexes addObject:self];
+    }
+  }
+}
+
+- (void)stopUpdating {
+  NSMutableArray *indexes = [isa updatingIndexes];
+  @synchronized(indexes) {
+    [indexes removeObjectIdenticalTo:self];
+  }
+}
+
+#pragma mark Searching
+
+- (NSArray *)entitiesFromObjects:(NSArray *)objects {
+  NSMutableArray *entities = [NSMutableArray new];
+  for (NSDictionary *object in objects) {
+    DKEntity *entity = [[[DKEntity classForEntityName:self.entityName] alloc] initWithName:self.entityName];
+    entity.resultMap = object;
+    [entities addObject:entity];
+  }
+  return [NSArray arrayWithArray:entities];
+}
+
+- (NSArray *)entitiesNearPoint:(NSArray *)point maxDistance:(double)maxDistance limit:(NSUInteger)limit {
+  return [self entitiesFromObjects:[self objectsNearPoint:point maxDistance:maxDistance limit:limit]];
+}
+
+- (NSArray *)entitiesWithinBoxFrom:(NSArray *)lowerLeft to:(NSArray *)upperRight {
+  return [self entitiesFromObjects:[self objectsWithinBoxFrom:lowerLeft to:upperRight]];
+}
+
+@end
+
+@implementation DKSpatialIndex (Private)
+
++ (void)updateIndexesWithEntities:(NSArray *)entities entityName:(NSString *)entityName {
+  NSMutableArray *indexes = [self updatingIndexes];
+  NSArray *snapshot = nil;
+  @synchronized(indexes) {
+    snapshot = [indexes copy];
+  }
+  for (DKSpatialIndex *index in snapshot) {
+    if ([index.entityName isEqualToString:entityName]) {
+      [index addEntities:entities];
+    }
+  }
+}
+
++ (void)removeEntityId:(NSString *)entityId fromIndexesWithEntityName:(NSString *)entityName {
+  NSMutableArray *indexes = [self updatingIndexes];
+  NSArray *snapshot = nil;
+  @synchronized(indexes) {
+    snapshot = [indexes copy];
+  }
+  for (DKSpatialIndex *index in snapshot) {
+    if ([index.entityName isEqualToString:entityName]) {
+      [index removeEntityWithId:entityId];
+    }
+  }
+}
+
+- (NSArray *)allObjects {
+  @synchronized(self) {
+    return [objects_ allValues];
+  }
+}
+
+- (NSArray *)objectsNearPoint:(NSArray *)point maxDistance:(double)maxDistance limit:(NSUInteger)limit {
+  double x = 0, y = 0;
+  if (![DKQueryEvaluator getCoordinatesOfPoint:point x:&x y:&y]) {
+    return @[];
+  }
+
+  NSMutableArray *found = [NSMutableArray new];
+  NSMutableArray *distances = [NSMutableArray new];
+
+  @synchronized(self) {
+    NSInteger ci = (NSInteger)floor(x / self.cellSize);
+    NSInteger cj = (NSInteger)floor(y / self.cellSize);
+    NSUInteger visited = 0;
+    NSUInteger total = objects_.count;
+
+    void (^visitCell)(NSNumber *) = ^(NSNumber *cellKey) {
+      for (NSString *entityId in cells_[cellKey]) {
+        NSDictionary *object = objects_[entityId];
+        double px = 0, py = 0;
+        [DKQueryEvaluator getCoordinatesOfPoint:[DKQueryEvaluator valueForKeyPath:self.key inObject:object] x:&px y:&py];
+        double distance = sqrt((px - x) * (px - x) + (py - y) * (py - y));
+        if (maxDistance < 0 || distance <= maxDistance) {
+          [found addObject:object];
+          [distances addObject:@(distance)];
+        }
+      }
+    };
+
+    // Search rings of cells outwards, until the remaining cells can't hold closer entities
+    for (NSInteger r = 0; visited < total; r++) {
+      NSUInteger ringCells = (r == 0) ? 1 : 8 * r;
+
+      // A ring larger than the occupied cells is slower than visiting them all
+      if (ringCells > cells_.count) {
+        for (NSNumber *cellKey in cells_) {
+          NSInteger i = 0, j = 0;
+          DKCellCoordinates(cellKey, &i, &j);
+          if (MAX(ABS(i - ci), ABS(j - cj)) >= r) {
+            visitCell(cellKey);
+          }
+        }
+        break;
+      }
+
+      for (NSInteger d = -r; d <= r; d++) {
+        NSArray *ring = nil;
+        if (r == 0) {
+          ring = @[DKCellKey(ci, cj)];
+        }
+        else if (ABS(d) == r) {
+          ring = @[DKCellKey(ci + d, cj - r), DKCellKey(ci + d, cj + r)];
+          NSMutableArray *column = [NSMutableArray new];
+          for (NSInteger e = -r + 1; e <= r - 1; e++) {
+            [column addObject:DKCellKey(ci + d, cj + e)];
+          }
+          ring = [ring arrayByAddingObjectsFromArray:column];
+        }
+        else {
+          ring = @[DKCellKey(ci + d, cj - r), DKCellKey(ci + d, cj + r)];
+        }
+        for (NSNumber *cellKey in ring) {
+          visited += [cells_[cellKey] count];
+          visitCell(cellKey);
+        }
+      }
+
+      // Entities in unvisited cells are farther than the ring
+      double reach = r * self.cellSize;
+      if (maxDistance >= 0 && reach > maxDistance) {
+        break;
+      }
+      if (limit > 0) {
+        NSUInteger closer = 0;
+        for (NSNumber *distance in distances) {
+          if ([distance doubleValue] <= reach) {
+            closer++;
+          }
+        }
+        if (closer >= limit) {
+          break;
+        }
+      }
+    }
+  }
+
+  // Order by distance
+  NSMutableArray *order = [NSMutableArray new];
+  for (NSUInteger i = 0; i < found.count; i++) {
+    [order addObject:@(i)];
+  }
+  [order sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(NSNumber *i1, NSNumber *i2) {
+    return [distances[[i1 unsignedIntegerValue]] compare:distances[[i2 unsignedIntegerValue]]];
+  }];
+  NSUInteger length = (limit > 0) ? MIN(limit, order.count) : order.count;
+  NSMutableArray *nearest = [NSMutableArray new];
+  for (NSUInteger i = 0; i < length; i++) {
+    [nearest addObject:found[[order[i] unsignedIntegerValue]]];
+  }
+  return [NSArray arrayWithArray:nearest];
+}
+
+- (NSArray *)objectsWithinBoxFrom:(NSArray *)lowerLeft to:(NSArray *)upperRight {
+  double x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+  if (![DKQueryEvaluator getCoordinatesOfPoint:lowerLeft x:&x1 y:&y1] ||
+      ![DKQueryEvaluator getCoordinatesOfPoint:upperRight x:&x2 y:&y2]) {
+    return @[];
+  }
+  double minX = MIN(x1, x2), maxX = MAX(x1, x2), minY = MIN(y1, y2), maxY = MAX(y1, y2);
+
+  NSMutableArray *found = [NSMutableArray new];
+  @synchronized(self) {
+    NSInteger minI = (NSInteger)floor(minX / self.cellSize), maxI = (NSInteger)floor(maxX / self.cellSize);
+    NSInteger minJ = (NSInteger)floor(minY / self.cellSize), maxJ = (NSInteger)floor(maxY / self.cellSize);
+
+    // Visit the occupied cells if there are fewer than cells in the box
+    NSMutableArray *cellKeys = [NSMutableArray new];
+    if ((double)(maxI - minI + 1) * (double)(maxJ - minJ + 1) > cells_.count) {
+      for (NSNumber *cellKey in cells_) {
+        NSInteger i = 0, j = 0;
+        DKCellCoordinates(cellKey, &i, &j);
+        if (i >= minI && i <= maxI && j >= minJ && j <= maxJ) {
+          [cellKeys addObject:cellKey];
+        }
+      }
+    }
+    else {
+      for (NSInteger i = minI; i <= maxI; i++) {
+        for (NSInteger j = minJ; j <= maxJ; j++) {
+          [cellKeys addObject:DKCellKey(i, j)];
+        }
+      }
+    }
+
+    for (NSNumber *cellKey in cellKeys) {
+      for (NSString *entityId in cells_[cellKey]) {
+        NSDictionary *object = objects_[entityId];
+        double px = 0, py = 0;
+        [DKQueryEvaluator getCoordinatesOfPoint:[DKQueryEvaluator valueForKeyPath:self.key inObject:object] x:&px y:&py];
+        if (px >= minX && px <= maxX && py >= minY && py <= maxY) {
+          [found addObject:object];
+        }
+      }
+    }
+  }
+  return [NSArray arrayWithArray:found];
+}
+
+- (NSArray *)candidateObjectsForCondition:(id)condition limit:(NSUInteger)limit {
+  if ([condition isKindOfClass:[NSDictionary class]]) {
+    id near = condition[@"$near"];
+    NSDictionary *within = condition[@"$within"];
+    if (near != nil) {
+      id maxDistance = condition[@"$maxDistance"];
+      return [self objectsNearPoint:near maxDistance:(maxDistance != nil) ? [maxDistance doubleValue] : -1.0 limit:limit];
+    }
+    else if ([within isKindOfClass:[NSDictionary class]] && [within[@"$box"] count] == 2) {
+      return [self objectsWithinBoxFrom:within[@"$box"][0] to:within[@"$box"][1]];
+    }
+    else if ([within isKindOfClass:[NSDictionary class]] && [within[@"$center"] count] == 2) {
+      return [self objectsNearPoint:within[@"$center"][0] maxDistance:[within[@"$center"][1] doubleValue] limit:0];
+    }
+  }
+  return [self allObjects];
+}
+
+@end
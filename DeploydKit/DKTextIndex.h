@@ -0,0 +1,124 @@
+//
+//  DKTextIndex.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKConstants.h"
+
+@class DKEntity;
+
+/**
+ An in-memory inverted index over the words of string keys, for answering `containsString`, `hasPrefix`,
+ `hasSuffix` and search-as-you-type queries on local entities without a server round trip.
+
+ Words are split on non-alphanumeric characters and folded to lowercase without diacritics. A regex
+ condition on an indexed key only visits the entities containing its words, the matches are then
+ verified like <DKQuery> `findAllInEntities:error:`. Unsorted results are ranked, entities whose
+ words match the searched ones more closely come first.
+
+ Queries are answered from the index once it is complete, that is when it holds the whole collection,
+ and sent to the server before. While the index is updating, entities fetched by <DKQuery> `findAll`
+ without key subsets, saved, refreshed or deleted are added to or removed from the index.
+
+    DKTextIndex *index = [[DKTextIndex alloc] initWithEntityName:@"post" keys:@[@"text"]];
+    [index startUpdating];
+    [index loadEntities:&error];
+    // ...
+    DKQuery *query = [DKQuery queryWithEntityName:@"post"];
+    [query whereKey:@"text" containsString:searchText caseInsensitive:YES];
+    NSArray *matches = [query findAllInTextIndex:index error:&error];
+ */
+@interface DKTextIndex : NSObject
+
+/**
+ The entity name of the indexed collection
+ */
+@property (nonatomic, copy, readonly) NSString *entityName;
+
+/**
+ The indexed keys, their values are strings or arrays of strings
+ */
+@property (nonatomic, copy, readonly) NSArray *keys;
+
+/**
+ The number of indexed entities
+ */
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/**
+ `YES` if the index holds all entities of the collection
+
+ Set by <loadEntities:> while the index is updating, or after adding all entities of the collection,
+ e.g. from a <DKCollectionSync>. Removing all entities, stopping updates and saves or deletes in the
+ collection that fail, which the server may still have applied, reset it.
+ */
+@property (nonatomic, assign, getter = isComplete) BOOL complete;
+
+/** @name Creating Indexes */
+
+/**
+ Initializes an empty index
+ @param entityName The entity name of the indexed collection
+ @param keys The string keys to index
+ @return The initialized index
+ */
+- (id)initWithEntityName:(NSString *)entityName keys:(NSArray *)keys;
+
+/** @name Updating Indexes */
+
+/**
+ Adds or replaces entities
+ @param entities The entities to index, of type <DKEntity> or NSDictionary
+ */
+- (void)addEntities:(NSArray *)entities;
+
+/**
+ Removes an entity
+ @param entityId The ID of the entity to remove
+ */
+- (void)removeEntityWithId:(NSString *)entityId;
+
+/**
+ Removes all entities, the index is no longer complete
+ */
+- (void)removeAllEntities;
+
+/**
+ Replaces the indexed entities with the whole collection and marks the index complete if it is updating
+
+ The cached result of an unconstrained query on the collection is used if present, the collection
+ is fetched otherwise.
+ @param error The error object to set on error
+ @return `YES` if the collection was indexed, `NO` on error
+ */
+- (BOOL)loadEntities:(NSError **)error;
+
+/**
+ Starts adding and removing the entities fetched, saved or deleted in the collection
+
+ The index is retained until <stopUpdating> is called.
+ */
+- (void)startUpdating;
+
+/**
+ Stops updating the index, it is no longer complete
+ */
+- (void)stopUpdating;
+
+/** @name Searching Indexes */
+
+/**
+ Returns the indexed entities containing words starting with each word of a text, best matches first
+ @param text The searched text, e.g. as it is typed
+ @param limit The maximum number of entities returned, or 0 for no limit
+ @return The matching entities
+ */
+- (NSArray *)entitiesMatchingText:(NSString *)text limit:(NSUInteger)limit;
+
++ (id)new UNAVAILABLE_ATTRIBUTE;
+- (id)init UNAVAILABLE_ATTRIBUTE;
+
+@end
@@ -0,0 +1,485 @@
+//
+//  DKTextIndex.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKTextIndex.h"
+#import "DKTextIndex-Private.h"
+#import "DKQuery.h"
+#import "DKQueryEvaluator.h"
+#import "DKEntity.h"
+#import "DKEntity-Private.h"
+#import "DKRequest.h"
+
+enum {
+  DKTextMatchExact = 0,
+  DKTextMatchPrefix,
+  DKTextMatchSuffix,
+  DKTextMatchContains
+};
+typedef NSInteger DKTextMatch;
+
+#define kDKTextWordKey @"word"
+#define kDKTextMatchKey @"match"
+
+static NSComparator DKWordComparator = ^NSComparisonResult(NSString *word1, NSString *word2) {
+  return [word1 compare:word2 options:NSLiteralSearch];
+};
+
+static NSString *DKFoldedString(NSString *string) {
+  return [string stringByFoldingWithOptions:NSCaseInsensitiveSearch | NSDiacriticInsensitiveSearch locale:nil];
+}
+
+// Returns the literal string matched by a pattern, or nil if the pattern isn't a plain string
+static NSString *DKLiteralOfPattern(NSString *pattern, BOOL *anchoredStart, BOOL *anchoredEnd) {
+  NSCharacterSet *special = [NSCharacterSet characterSetWithCharactersInString:@"[]{}\\^$.|?*+()"];
+  NSMutableString *literal = [NSMutableString new];
+  *anchoredStart = NO;
+  *anchoredEnd = NO;
+  for (NSUInteger i = 0; i < pattern.length; i++) {
+    unichar c = [pattern characterAtIndex:i];
+    if (c == '\\') {
+      // Escaped letters and digits are character classes or back references
+      if (i + 1 >= pattern.length || ![special characterIsMember:[pattern characterAtIndex:i + 1]]) {
+        return nil;
+      }
+      [literal appendFormat:@"%C", [pattern characterAtIndex:++i]];
+    }
+    else if (c == '^' && i == 0) {
+      *anchoredStart = YES;
+    }
+    else if (c == '$' && i == pattern.length - 1) {
+      *anchoredEnd = YES;
+    }
+    else if ([special characterIsMember:c]) {
+      return nil;
+    }
+    else {
+      [literal appendFormat:@"%C", c];
+    }
+  }
+  return literal;
+}
+
+@interface DKTextIndex ()
+@property (nonatomic, copy, readwrite) NSString *entityName;
+@property (nonatomic, copy, readwrite) NSArray *keys;
+@end
+
+@implementation DKTextIndex {
+@private
+  NSMutableDictionary *objects_;
+  NSMutableDictionary *objectWords_;
+  NSMutableDictionary *postings_;
+  NSMutableArray *vocabulary_;
+  BOOL complete_;
+}
+
++ (NSMutableArray *)updatingIndexes {
+  static NSMutableArray *indexes;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    indexes = [NSMutableArray new];
+  });
+  return indexes;
+}
+
++ (NSArray *)wordsOfString:(NSString *)string {
+  NSCharacterSet *separators = [[NSCharacterSet alphanumericCharacterSet] invertedSet];
+  NSMutableArray *words = [NSMutableArray new];
+  for (NSString *word in [DKFoldedString(string) componentsSeparatedByCharactersInSet:separators]) {
+    if (word.length > 0) {
+      [words addObject:word];
+    }
+  }
+  return words;
+}
+
+- (id)initWithEntityName:(NSString *)entityName keys:(NSArray *)keys {
+  NSParameterAssert(entityName.length > 0);
+  NSParameterAssert(keys.count > 0);
+
+  self = [super init];
+  if (self) {
+    self.entityName = entityName;
+    self.keys = keys;
+
+    objects_ = [NSMutableDictionary new];
+    objectWords_ = [NSMutableDictionary new];
+    postings_ = [NSMutableDictionary new];
+    vocabulary_ = [NSMutableArray new];
+  }
+  return self;
+}
+
+- (NSUInteger)count {
+  @synchronized(self) {
+    return objects_.count;
+  }
+}
+
+- (BOOL)isComplete {
+  @synchronized(self) {
+    return complete_;
+  }
+}
+
+- (void)setComplete:(BOOL)complete {
+  @synchronized(self) {
+    complete_ = complete;
+  }
+}
+
+#pragma mark Updating
+
+- (NSSet *)wordsOfObject:(NSDictionary *)object {
+  NSMutableSet *words = [NSMutableSet new];
+  for (NSString *key in self.keys) {
+    id value = [DKQueryEvaluator valueForKeyPath:key inObject:object];
+    NSArray *strings = [value isKindOfClass:[NSArray class]] ? value : @[value ?: [NSNull null]];
+    for (id string in strings) {
+      if ([string isKindOfClass:[NSString class]]) {
+        [words addObjectsFromArray:[isa wordsOfString:string]];
+      }
+    }
+  }
+  return words;
+}
+
+- (void)addEntities:(NSArray *)entities {
+  @synchronized(self) {
+    for (id entity in entities) {
+      NSDictionary *object = [entity isKindOfClass:[DKEntity class]] ? [entity resultMap] : entity;
+      if (![object isKindOfClass:[NSDictionary class]]) {
+        continue;
+      }
+      NSString *entityId = object[kDKEntityIDField];
+      if (entityId == nil) {
+        continue;
+      }
+
+      [self removeObjectWithId:entityId];
+
+      NSSet *words = [self wordsOfObject:object];
+      for (NSString *word in words) {
+        NSMutableSet *posting = postings_[word];
+        if (posting == nil) {
+          posting = [NSMutableSet new];
+          postings_[word] = posting;
+          NSUInteger idx = [vocabulary_ indexOfObject:word
+                                        inSortedRange:NSMakeRange(0, vocabulary_.count)
+                                              options:NSBinarySearchingInsertionIndex
+                                      usingComparator:DKWordComparator];
+          [vocabulary_ insertObject:word atIndex:idx];
+        }
+        [posting addObject:entityId];
+      }
+      objectWords_[entityId] = words;
+      objects_[entityId] = object;
+    }
+  }
+}
+
+- (void)removeObjectWithId:(NSString *)entityId {
+  for (NSString *word in objectWords_[entityId]) {
+    NSMutableSet *posting = postings_[word];
+    [posting removeObject:entityId];
+    if (posting.count == 0) {
+      [postings_ removeObjectForKey:word];
+      NSUInteger idx = [vocabulary_ indexOfObject:word
+                                    inSortedRange:NSMakeRange(0, vocabulary_.count)
+                                          options:NSBinarySearchingFirstEqual
+                                  usingComparator:DKWordComparator];
+      if (idx != NSNotFound) {
+        [vocabulary_ removeObjectAtIndex:idx];
+      }
+    }
+  }
+  [objectWords_ removeObjectForKey:entityId];
+  [objects_ removeObjectForKey:entityId];
+}
+
+- (void)removeEntityWithId:(NSString *)entityId {
+  @synchronized(self) {
+    [self removeObjectWithId:entityId];
+  }
+}
+
+- (void)removeAllEntities {
+  @synchronized(self) {
+    [objects_ removeAllObjects];
+    [objectWords_ removeAllObjects];
+    [postings_ removeAllObjects];
+    [vocabulary_ removeAllObjects];
+    complete_ = NO;
+  }
+}
+
+- (BOOL)loadEntities:(NSError **)error {
+  id results = [[DKRequest request] cachedResultForEntity:self.entityName error:NULL];
+  if (![results isKindOfClass:[NSArray class]]) {
+    NSError *fetchError = nil;
+    results = [[DKQuery queryWithEntityName:self.entityName] findAll:&fetchError];
+    if (fetchError != nil) {
+      if (error != NULL) {
+        *error = fetchError;
+      }
+      return NO;
+    }
+  }
+  // An index that isn't updating misses the next writes
+  NSMutableArray *indexes = [isa updatingIndexes];
+  BOOL updating = NO;
+  @synchronized(indexes) {
+    updating = ([indexes indexOfObjectIdenticalTo:self] != NSNotFound);
+  }
+  @synchronized(self) {
+    [self removeAllEntities];
+    [self addEntities:results];
+    complete_ = updating;
+  }
+  return YES;
+}
+
+- (void)startUpdating {
+  NSMutableArray *indexes = [isa updatingIndexes];
+  @synchronized(indexes) {
+    if ([indexes indexOfObjectIdenticalTo:self] == NSNotFound) {
+      [indexes addObject:self];
+    }
+  }
+}
+
+- (void)stopUpdating {
+  NSMutableArray *indexes = [isa updatingIndexes];
+  @synchronized(indexes) {
+    [indexes removeObjectIdenticalTo:self];
+  }
+  self.complete = NO;
+}
+
+#pragma mark Searching
+
+// Returns the scores of the entities having a matching word for each search word, a word scores
+// the fraction of the indexed word it matches
+- (NSDictionary *)scoresForSearchWords:(NSArray *)searchWords {
+  NSMutableDictionary *scores = nil;
+  for (NSDictionary *searchWord in searchWords) {
+    NSString *word = searchWord[kDKTextWordKey];
+    DKTextMatch match = [searchWord[kDKTextMatchKey] integerValue];
+
+    NSMutableArray *matchingWords = [NSMutableArray new];
+    if (match == DKTextMatchExact) {
+      if (postings_[word] != nil) {
+        [matchingWords addObject:word];
+      }
+    }
+    else if (match == DKTextMatchPrefix) {
+      NSUInteger idx = [vocabulary_ indexOfObject:word
+                                    inSortedRange:NSMakeRange(0, vocabulary_.count)
+                                          options:NSBinarySearchingInsertionIndex | NSBinarySearchingFirstEqual
+                                  usingComparator:DKWordComparator];
+      for (; idx < vocabulary_.count && [vocabulary_[idx] hasPrefix:word]; idx++) {
+        [matchingWords addObject:vocabulary_[idx]];
+      }
+    }
+    else {
+      for (NSString *indexedWord in vocabulary_) {
+        if ((match == DKTextMatchSuffix) ? [indexedWord hasSuffix:word] : ([indexedWord rangeOfString:word].location != NSNotFound)) {
+          [matchingWords addObject:indexedWord];
+        }
+      }
+    }
+
+    NSMutableDictionary *wordScores = [NSMutableDictionary new];
+    for (NSString *indexedWord in matchingWords) {
+      double score = (double)word.length / (double)indexedWord.length;
+      for (NSString *entityId in postings_[indexedWord]) {
+        if ([wordScores[entityId] doubleValue] < score) {
+          wordScores[entityId] = @(score);
+        }
+      }
+    }
+
+    // Every search word must match
+    if (scores == nil) {
+      scores = wordScores;
+    }
+    else {
+      for (NSString *entityId in [scores allKeys]) {
+        NSNumber *score = wordScores[entityId];
+        if (score == nil) {
+          [scores removeObjectForKey:entityId];
+        }
+        else {
+          scores[entityId] = @([scores[entityId] doubleValue] + [score doubleValue]);
+        }
+      }
+    }
+  }
+  return scores;
+}
+
+// Splits a literal into search words, the first and last may be parts of indexed words
+- (NSArray *)searchWordsOfLiteral:(NSString *)literal anchoredStart:(BOOL)anchoredStart anchoredEnd:(BOOL)anchoredEnd {
+  NSCharacterSet *separators = [[NSCharacterSet alphanumericCharacterSet] invertedSet];
+  NSArray *parts = [DKFoldedString(literal) componentsSeparatedByCharactersInSet:separators];
+  NSMutableArray *searchWords = [NSMutableArray new];
+  for (NSUInteger i = 0; i < parts.count; i++) {
+    NSString *part = parts[i];
+    if (part.length == 0) {
+      continue;
+    }
+    BOOL startsWord = (i > 0 || anchoredStart);
+    BOOL endsWord = (i + 1 < parts.count || anchoredEnd);
+    DKTextMatch match = DKTextMatchContains;
+    if (startsWord && endsWord) {
+      match = DKTextMatchExact;
+    }
+    else if (startsWord) {
+      match = DKTextMatchPrefix;
+    }
+    else if (endsWord) {
+      match = DKTextMatchSuffix;
+    }
+    [searchWords addObject:@{kDKTextWordKey : part, kDKTextMatchKey : @(match)}];
+  }
+  return searchWords;
+}
+
+- (NSArray *)objectsRankedByScores:(NSDictionary *)scores limit:(NSUInteger)limit {
+  NSArray *entityIds = [[scores allKeys] sortedArrayUsingComparator:^NSComparisonResult(NSString *id1, NSString *id2) {
+    NSComparisonResult result = [scores[id2] compare:scores[id1]];
+    return (result != NSOrderedSame) ? result : [id1 compare:id2];
+  }];
+  NSUInteger length = (limit > 0) ? MIN(limit, entityIds.count) : entityIds.count;
+  NSMutableArray *objects = [NSMutableArray new];
+  for (NSUInteger i = 0; i < length; i++) {
+    [objects addObject:objects_[entityIds[i]]];
+  }
+  return objects;
+}
+
+- (NSArray *)entitiesMatchingText:(NSString *)text limit:(NSUInteger)limit {
+  NSArray *objects = nil;
+  @synchronized(self) {
+    NSMutableArray *searchWords = [NSMutableArray new];
+    for (NSString *word in [isa wordsOfString:text]) {
+      [searchWords addObject:@{kDKTextWordKey : word, kDKTextMatchKey : @(DKTextMatchPrefix)}];
+    }
+    if (searchWords.count == 0) {
+      return @[];
+    }
+    objects = [self objectsRankedByScores:[self scoresForSearchWords:searchWords] limit:limit];
+  }
+
+  NSMutableArray *entities = [NSMutableArray new];
+  for (NSDictionary *object in objects) {
+    DKEntity *entity = [[[DKEntity classForEntityName:self.entityName] alloc] initWithName:self.entityName];
+    entity.resultMap = object;
+    [entities addObject:entity];
+  }
+  return [NSArray arrayWithArray:entities];
+}
+
+@end
+
+@implementation DKTextIndex (Private)
+
++ (void)updateIndexesWithEntities:(NSArray *)entities entityName:(NSString *)entityName {
+  NSMutableArray *indexes = [self updatingIndexes];
+  NSArray *snapshot = nil;
+  @synchronized(indexes) {
+    snapshot = [indexes copy];
+  }
+  for (DKTextIndex *index in snapshot) {
+    if ([index.entityName isEqualToString:entityName]) {
+      [index addEntities:entities];
+    }
+  }
+}
+
++ (void)removeEntityId:(NSString *)entityId fromIndexesWithEntityName:(NSString *)entityName {
+  NSMutableArray *indexes = [self updatingIndexes];
+  NSArray *snapshot = nil;
+  @synchronized(indexes) {
+    snapshot = [indexes copy];
+  }
+  for (DKTextIndex *index in snapshot) {
+    if ([index.entityName isEqualToString:entityName]) {
+      [index removeEntityWithId:entityId];
+    }
+  }
+}
+
++ (void)invalidateIndexesWithEntityName:(NSString *)entityName {
+  NSMutableArray *indexes = [self updatingIndexes];
+  NSArray *snapshot = nil;
+  @synchronized(indexes) {
+    snapshot = [indexes copy];
+  }
+  for (DKTextIndex *index in snapshot) {
+    if ([index.entityName isEqualToString:entityName]) {
+      index.complete = NO;
+    }
+  }
+}
+
+- (NSArray *)allObjects {
+  @synchronized(self) {
+    return [objects_ allValues];
+  }
+}
+
+- (NSArray *)candidateObjectsForConditions:(NSDictionary *)conditions {
+  @synchronized(self) {
+    NSMutableDictionary *scores = nil;
+    for (NSString *key in self.keys) {
+      id condition = conditions[key];
+      NSString *literal = nil;
+      BOOL anchoredStart = NO, anchoredEnd = NO;
+      if ([condition isKindOfClass:[NSString class]]) {
+        literal = condition;
+        anchoredStart = anchoredEnd = YES;
+      }
+      else if ([condition isKindOfClass:[NSDictionary class]] && [condition[@"$regex"] isKindOfClass:[NSString class]] &&
+               [condition[@"$options"] rangeOfString:@"x"].length == 0) {
+        literal = DKLiteralOfPattern(condition[@"$regex"], &anchoredStart, &anchoredEnd);
+      }
+      if (literal == nil) {
+        continue;
+      }
+
+      NSArray *searchWords = [self searchWordsOfLiteral:literal anchoredStart:anchoredStart anchoredEnd:anchoredEnd];
+      if (searchWords.count == 0) {
+        continue;
+      }
+      NSDictionary *keyScores = [self scoresForSearchWords:searchWords];
+      if (scores == nil) {
+        scores = [keyScores mutableCopy];
+      }
+      else {
+        for (NSString *entityId in [scores allKeys]) {
+          NSNumber *score = keyScores[entityId];
+          if (score == nil) {
+            [scores removeObjectForKey:entityId];
+          }
+          else {
+            scores[entityId] = @([scores[entityId] doubleValue] + [score doubleValue]);
+          }
+        }
+      }
+    }
+
+    // Conditions without words can't narrow the candidates
+    if (scores == nil) {
+      return [objects_ allValues];
+    }
+    return [self objectsRankedByScores:scores limit:0];
+  }
+}
+
+@end
@@ -15,6 +15,15 @@
 #import "DKConstants.h"
 #import "DKEntity.h"
 #import "DKQuery.h"
+#import "DKQueryCursor.h"
+#import "DKPreparedQuery.h"
+#import "DKQueryGroup.h"
+#import "DKLiveQuery.h"
+#import "DKCollectionSync.h"
+#import "DKSpatialIndex.h"
+#import "DKTextIndex.h"
+#import "DKEntityStore.h"
+#import "DKImagePipeline.h"
 #import "DKFile.h"
 #import "DKChannel.h"
 #import "DKQueryTableViewController.h"
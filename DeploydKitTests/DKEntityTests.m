@@ -14,6 +14,8 @@
 #import "DeploydKit.h"
 #import "DKEntity-Private.h"
 #import "DKTests.h"
+#import "DKTestsQueue.h"
+#import "DKTestsPost.h"
 
 @implementation DKEntityTests
 
@@ -286,6 +288,149 @@
     
   [self deleteDefaultUser];    
 }
+
+- (void)testWriteBehind {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert post
+  DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject setObject:@0 forKey:kDKEntityTestsPostVisits];
+  [postObject setObject:@[@"user_2"] forKey:kDKEntityTestsPostSharedTo];
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  //Test changes are merged
+  [postObject incrementKey:kDKEntityTestsPostVisits byAmount:@2];
+  [postObject incrementKey:kDKEntityTestsPostVisits];
+  [postObject pushObject:@"user_3" forKey:kDKEntityTestsPostSharedTo];
+  [postObject pushAllObjects:@[@"user_4"] forKey:kDKEntityTestsPostSharedTo];
+  [postObject pushObject:@"user_5" forKey:kDKEntityTestsPostSharedTo];
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  STAssertEquals([[postObject objectForKey:kDKEntityTestsPostVisits] integerValue], (NSInteger)3, nil);
+  NSArray *comp = @[@"user_2", @"user_3", @"user_4", @"user_5"];
+  STAssertEqualObjects([postObject objectForKey:kDKEntityTestsPostSharedTo], comp, nil);
+  
+  //Test background saves are coalesced, callbacks are delivered on a serial queue without a run loop
+  postObject.writeBehindInterval = 0.5;
+  DKTestsQueue *queue = [DKTestsQueue queue];
+  NSMutableArray *updates = [NSMutableArray new];
+  success = [queue waitForBlock:^{
+    for (NSUInteger i = 0; i < 10; i++) {
+      [postObject incrementKey:kDKEntityTestsPostVisits];
+      [postObject setObject:@(i) forKey:kDKEntityTestsPostQuantity];
+      [postObject saveInBackgroundWithBlock:^(DKEntity *entity, NSError *saveError) {
+        STAssertNil(saveError, saveError.description);
+        [updates addObject:[entity objectForKey:kDKEntityTestsPostVisits]];
+        [queue signal];
+      }];
+    }
+  } signals:10 timeout:5.0];
+  STAssertTrue(success, nil);
+  NSArray *expected = @[@13, @13, @13, @13, @13, @13, @13, @13, @13, @13];
+  STAssertEqualObjects(updates, expected, nil);
+  STAssertEquals([[postObject objectForKey:kDKEntityTestsPostQuantity] integerValue], (NSInteger)9, nil);
+  STAssertFalse(postObject.isDirty, nil);
+  
+  //Test the size trigger sends before the delay
+  postObject.writeBehindInterval = 60.0;
+  postObject.writeBehindMaxChanges = 3;
+  success = [queue waitForBlock:^{
+    for (NSUInteger i = 0; i < 3; i++) {
+      [postObject incrementKey:kDKEntityTestsPostVisits];
+      [postObject saveInBackgroundWithBlock:^(DKEntity *entity, NSError *saveError) {
+        [queue signal];
+      }];
+    }
+  } signals:3 timeout:5.0];
+  STAssertTrue(success, nil);
+  STAssertEquals([[postObject objectForKey:kDKEntityTestsPostVisits] integerValue], (NSInteger)16, nil);
+  
+  //Test explicit flush
+  error = nil;
+  [postObject incrementKey:kDKEntityTestsPostVisits byAmount:@4];
+  [postObject saveInBackground];
+  success = [postObject flush:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  success = [postObject refresh:&error];
+  STAssertTrue(success, nil);
+  STAssertEquals([[postObject objectForKey:kDKEntityTestsPostVisits] integerValue], (NSInteger)20, nil);
+  
+  //Delete post
+  error = nil;
+  success = [postObject delete:&error];
+  STAssertNil(error, @"delete post should not return error, did return %@", error);
+  STAssertTrue(success, @"delete post should have been successful (return YES)");
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testGeneratedSubclass {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert post through typed properties
+  DKTestsPost *postObject = [DKTestsPost entity];
+  postObject.text = @"Typed post";
+  postObject.visits = 3;
+  postObject.sharedTo = @[@"user_1"];
+  STAssertEqualObjects([postObject objectForKey:kDKEntityTestsPostText], @"Typed post", nil);
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  STAssertEquals(postObject.visits, 3.0, nil);
+  
+  //Test saved values are decoded
+  [postObject incrementKey:kDKEntityTestsPostVisits byAmount:@2];
+  [postObject setObject:@1.5 forKey:kDKEntityTestsPostPrice];
+  STAssertEquals(postObject.price, 1.5, nil);
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  STAssertEquals(postObject.visits, 5.0, nil);
+  
+  //Test reset restores the saved values
+  postObject.text = @"Unsaved";
+  [postObject reset];
+  STAssertEqualObjects(postObject.text, @"Typed post", nil);
+  
+  //Test fetched entities are instances of the registered subclass
+  STAssertEquals([DKEntity classForEntityName:kDKEntityTestsPost], [DKTestsPost class], nil);
+  DKQuery *query = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [query whereKey:kDKEntityIDField equalTo:postObject.entityId];
+  DKTestsPost *fetched = [[query findAll:&error] lastObject];
+  STAssertNil(error, error.description);
+  STAssertTrue([fetched isKindOfClass:[DKTestsPost class]], nil);
+  STAssertEqualObjects(fetched.text, @"Typed post", nil);
+  STAssertEquals(fetched.visits, 5.0, nil);
+  STAssertEqualObjects(fetched.sharedTo, @[@"user_1"], nil);
+  STAssertEquals(fetched.quantity, 0.0, nil);
+  STAssertEqualObjects(fetched, postObject, nil);
+  
+  //Test values other than scalars are validated for scalar keys
+  [postObject setObject:@{@"$where" : @"true"} forKey:kDKEntityTestsPostText];
+  STAssertThrows([postObject save:&error], nil);
+  [postObject reset];
+  STAssertEqualObjects(postObject.text, @"Typed post", nil);
+  
+  //Delete post
+  error = nil;
+  success = [postObject delete:&error];
+  STAssertNil(error, @"delete post should not return error, did return %@", error);
+  STAssertTrue(success, @"delete post should have been successful (return YES)");
+  STAssertNil(postObject.text, nil);
+  
+  [self deleteDefaultUser];
+}
+
 /*
 - (void)testObjectAddToSet {
     NSError *error = nil;
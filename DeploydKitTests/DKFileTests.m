@@ -13,6 +13,7 @@
 #import "DKFileTests.h"
 #import "DeploydKit.h"
 #import "DKTests.h"
+#import "DKTestsQueue.h"
 
 @implementation DKFileTests
 
@@ -128,4 +129,262 @@
   [self deleteDefaultUser];
 }
 
+- (void)testStreamedUpload {
+  NSError *error = nil;
+  BOOL success = NO;
+    
+  [self createDefaultUserAndLogin];
+    
+  NSData *data = [self generateRandomDataWithLength:256*1024];
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"DKFileTests.upload"];
+  success = [data writeToFile:path atomically:YES];
+  STAssertTrue(success, nil);
+    
+  //Save from disk in the background, reporting progress
+  DKFile *file = [DKFile fileWithName:nil contentsOfURL:[NSURL fileURLWithPath:path]];
+  STAssertNil(file.data, nil);
+  DKTestsQueue *queue = [DKTestsQueue queue];
+  __block BOOL savedInBackground = NO;
+  __block long long lastBytesSent = 0;
+  __block long long lastTotalBytes = 0;
+  success = [queue waitForBlock:^{
+    [file saveInBackgroundWithBlock:^(BOOL saveSuccess, NSError *saveError) {
+      STAssertNil(saveError, saveError.localizedDescription);
+      savedInBackground = saveSuccess;
+      [queue signal];
+    } progressBlock:^(long long bytesSent, long long totalBytes) {
+      STAssertTrue(bytesSent >= lastBytesSent, nil);
+      lastBytesSent = bytesSent;
+      lastTotalBytes = totalBytes;
+    }];
+  } signals:1 timeout:30.0];
+  STAssertTrue(success, nil);
+  STAssertTrue(savedInBackground, nil);
+  STAssertEquals(lastBytesSent, (long long)data.length, nil);
+  STAssertEquals(lastTotalBytes, (long long)data.length, nil);
+  STAssertNil(file.data, nil);
+    
+  //Load file
+  error = nil;
+  DKFile *file2 = [DKFile fileWithName:file.name];
+  NSData *data2 = [file2 loadData:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue([data isEqualToData:data2], nil);
+    
+  //Save from a stream
+  error = nil;
+  DKFile *file3 = [DKFile fileWithName:nil inputStream:[NSInputStream inputStreamWithFileAtPath:path] length:data.length];
+  success = [file3 save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  data2 = [[DKFile fileWithName:file3.name] loadData:&error];
+  STAssertTrue([data isEqualToData:data2], nil);
+    
+  //Delete files
+  STAssertTrue([file2 delete], nil);
+  STAssertTrue([file3 delete], nil);
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+  [self deleteDefaultUser];
+}
+
+- (void)testResumableDownload {
+  NSError *error = nil;
+  BOOL success = NO;
+    
+  [self createDefaultUserAndLogin];
+    
+  NSData *data = [self generateRandomDataWithLength:256*1024];
+  DKFile *file = [DKFile fileWithName:nil data:data];
+  success = [file save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+    
+  //Download to disk in the background, reporting progress
+  DKFile *file2 = [DKFile fileWithName:file.name];
+  DKTestsQueue *queue = [DKTestsQueue queue];
+  __block NSURL *fileURL = nil;
+  __block long long lastBytesReceived = 0;
+  __block long long lastTotalBytes = 0;
+  success = [queue waitForBlock:^{
+    [file2 loadFileInBackgroundWithBlock:^(NSURL *loadedURL, NSError *loadError) {
+      STAssertNil(loadError, loadError.localizedDescription);
+      fileURL = loadedURL;
+      [queue signal];
+    } progressBlock:^(long long bytesReceived, long long totalBytes) {
+      lastBytesReceived = bytesReceived;
+      lastTotalBytes = totalBytes;
+    }];
+  } signals:1 timeout:30.0];
+  STAssertTrue(success, nil);
+  STAssertEqualObjects([NSData dataWithContentsOfURL:fileURL], data, nil);
+  STAssertEquals(lastBytesReceived, (long long)data.length, nil);
+  STAssertEquals(lastTotalBytes, (long long)data.length, nil);
+    
+  //Resume an interrupted download
+  NSString *partPath = [fileURL.path stringByAppendingPathExtension:@"part"];
+  [[NSFileManager defaultManager] removeItemAtURL:fileURL error:NULL];
+  [[data subdataWithRange:NSMakeRange(0, data.length / 2)] writeToFile:partPath atomically:YES];
+  error = nil;
+  NSData *mapped = [file2 loadMappedData:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEqualObjects(mapped, data, nil);
+  STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:partPath], nil);
+    
+  //Completed downloads are reused from the cache
+  file2.cachePolicy = DKCachePolicyUseCacheElseLoad;
+  NSURL *cachedURL = [file2 loadFile:&error];
+  STAssertEqualObjects(cachedURL, fileURL, nil);
+  [DKFile removeDownloadedFiles];
+  STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:fileURL.path], nil);
+    
+  //Delete file
+  STAssertTrue([file delete], nil);
+
+  [self deleteDefaultUser];
+}
+
+- (void)testMultipartUpload {
+  NSError *error = nil;
+  BOOL success = NO;
+    
+  [self createDefaultUserAndLogin];
+    
+  NSData *data = [self generateRandomDataWithLength:11*1024*1024];
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"DKFileTests.multipart"];
+  success = [data writeToFile:path atomically:YES];
+  STAssertTrue(success, nil);
+    
+  //Save in 3 parts, 2 at a time
+  DKFile *file = [DKFile fileWithName:nil contentsOfURL:[NSURL fileURLWithPath:path]];
+  file.partSize = 5*1024*1024;
+  file.maxConcurrentParts = 2;
+  success = [file save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertFalse(file.isVolatile, nil);
+  STAssertTrue([DKFile fileExists:file.name error:&error], nil);
+    
+  //Load file
+  error = nil;
+  NSData *data2 = [[DKFile fileWithName:file.name] loadMappedData:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue([data isEqualToData:data2], nil);
+    
+  //Parts smaller than the S3 minimum are raised to it, the data is sent in a single request
+  DKFile *file2 = [DKFile fileWithName:nil data:[data subdataWithRange:NSMakeRange(0, 1024*1024)]];
+  file2.partSize = 1024;
+  success = [file2 save:&error];
+  STAssertTrue(success, nil);
+    
+  //Delete files
+  STAssertTrue([file delete], nil);
+  STAssertTrue([file2 delete], nil);
+  [DKFile removeDownloadedFiles];
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+  [self deleteDefaultUser];
+}
+
+- (void)testContentDeduplication {
+  NSError *error = nil;
+  BOOL success = NO;
+    
+  [self createDefaultUserAndLogin];
+    
+  //Known SHA-256, computed in the background
+  DKFile *helloFile = [DKFile fileWithData:[@"hello" dataUsingEncoding:NSUTF8StringEncoding]];
+  STAssertNil(helloFile.contentHash, nil);
+  DKTestsQueue *queue = [DKTestsQueue queue];
+  __block NSString *contentHash = nil;
+  success = [queue waitForBlock:^{
+    [helloFile computeContentHashInBackgroundWithBlock:^(NSString *hash, NSError *hashError) {
+      STAssertNil(hashError, hashError.localizedDescription);
+      contentHash = hash;
+      [queue signal];
+    }];
+  } signals:1 timeout:10.0];
+  STAssertTrue(success, nil);
+  STAssertEqualObjects(contentHash, @"2cf24dba5fb0a30e26e83b2ac5b9e29e1b161e5c1fa7425e73043362938b9824", nil);
+  STAssertEqualObjects(helloFile.contentHash, contentHash, nil);
+    
+  //The first save uploads the contents
+  NSData *data = [self generateRandomDataWithLength:64*1024];
+  DKFile *file = [DKFile fileWithData:data];
+  file.deduplicatesContent = YES;
+  success = [file save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEquals(file.contentHash.length, (NSUInteger)64, nil);
+    
+  //The same contents from disk reuse the uploaded file
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"DKFileTests.dedup"];
+  success = [data writeToFile:path atomically:YES];
+  STAssertTrue(success, nil);
+  DKFile *file2 = [DKFile fileWithName:nil contentsOfURL:[NSURL fileURLWithPath:path]];
+  file2.deduplicatesContent = YES;
+  success = [file2 save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertFalse(file2.isVolatile, nil);
+  STAssertEqualObjects(file2.contentHash, file.contentHash, nil);
+  STAssertEqualObjects(file2.name, file.name, nil);
+    
+  //Without deduplication the contents are uploaded again
+  DKFile *file3 = [DKFile fileWithData:data];
+  success = [file3 save:&error];
+  STAssertTrue(success, nil);
+  STAssertFalse([file3.name isEqualToString:file.name], nil);
+    
+  //Delete files
+  STAssertTrue([file delete], nil);
+  STAssertTrue([file3 delete], nil);
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+  [self deleteDefaultUser];
+}
+
+- (void)testFileMetadata {
+  NSError *error = nil;
+  BOOL success = NO;
+    
+  [self createDefaultUserAndLogin];
+    
+  NSData *data = [self generateRandomDataWithLength:1024];
+  DKFile *file = [DKFile fileWithData:data];
+  success = [file save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+    
+  //Metadata of a single file
+  NSDictionary *metadata = [DKFile metadataOfFile:file.name error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEqualObjects(metadata[kDKFileMetadataSize], @(data.length), nil);
+  STAssertTrue([metadata[kDKFileMetadataETag] length] > 0, nil);
+  STAssertTrue([metadata[kDKFileMetadataLastModified] isKindOfClass:[NSDate class]], nil);
+  STAssertTrue([DKFile fileExists:file.name error:&error], nil);
+    
+  //Missing files are not an error
+  STAssertNil([DKFile metadataOfFile:@"DKFileTests-missing" error:&error], nil);
+  STAssertNil(error, error.localizedDescription);
+  STAssertFalse([DKFile fileExists:@"DKFileTests-missing" error:&error], nil);
+    
+  //Batched, more names than a single request checks
+  NSMutableArray *fileNames = [NSMutableArray new];
+  for (NSUInteger i = 0; i < 150; i++) {
+    [fileNames addObject:(i == 120 ? file.name : [NSString stringWithFormat:@"DKFileTests-missing-%u", i])];
+  }
+  NSDictionary *filesMetadata = [DKFile metadataOfFiles:fileNames error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(filesMetadata.count, (NSUInteger)1, nil);
+  STAssertEqualObjects(filesMetadata[file.name][kDKFileMetadataSize], @(data.length), nil);
+  STAssertEqualObjects(filesMetadata[file.name][kDKFileMetadataETag], metadata[kDKFileMetadataETag], nil);
+    
+  //Deleted files don't exist anymore
+  STAssertTrue([file delete], nil);
+  STAssertFalse([DKFile fileExists:file.name error:&error], nil);
+
+  [self deleteDefaultUser];
+}
+
 @end
@@ -0,0 +1,13 @@
+//
+//  DKImagePipelineTests.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface DKImagePipelineTests : SenTestCase
+
+@end
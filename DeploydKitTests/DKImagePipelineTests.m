@@ -0,0 +1,108 @@
+//
+//  DKImagePipelineTests.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKImagePipelineTests.h"
+#import "DeploydKit.h"
+#import "DKTestsQueue.h"
+#import <ImageIO/ImageIO.h>
+
+@implementation DKImagePipelineTests
+
+- (NSData *)generatePNGDataWithWidth:(size_t)width height:(size_t)height {
+  CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+  CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaPremultipliedLast);
+  CGColorSpaceRelease(colorSpace);
+  CGContextSetRGBFillColor(context, 1.0, 0.0, 0.0, 1.0);
+  CGContextFillRect(context, CGRectMake(0.0, 0.0, width, height));
+  CGImageRef image = CGBitmapContextCreateImage(context);
+  CGContextRelease(context);
+  
+  NSMutableData *data = [NSMutableData new];
+  CGImageDestinationRef destination = CGImageDestinationCreateWithData((__bridge CFMutableDataRef)data, CFSTR("public.png"), 1, NULL);
+  CGImageDestinationAddImage(destination, image, NULL);
+  CGImageDestinationFinalize(destination);
+  CFRelease(destination);
+  CGImageRelease(image);
+  return data;
+}
+
+- (void)testDecode {
+  NSData *data = [self generatePNGDataWithWidth:400 height:200];
+  
+  //Decoded synchronously, downsampled to the maximum pixel size
+  CGImageRef image = [DKImagePipeline newImageWithData:data maxPixelSize:100.0];
+  STAssertTrue(image != NULL, nil);
+  STAssertEquals(CGImageGetWidth(image), (size_t)100, nil);
+  STAssertEquals(CGImageGetHeight(image), (size_t)50, nil);
+  CGImageRelease(image);
+  image = [DKImagePipeline newImageWithData:data maxPixelSize:0.0];
+  STAssertEquals(CGImageGetWidth(image), (size_t)400, nil);
+  CGImageRelease(image);
+  
+  //Data that isn't an image
+  NSData *textData = [@"DSTART!not an image DEND!" dataUsingEncoding:NSUTF8StringEncoding];
+  STAssertTrue([DKImagePipeline newImageWithData:textData maxPixelSize:100.0] == NULL, nil);
+}
+
+- (void)testBackgroundDecodeAndCache {
+  NSData *data = [self generatePNGDataWithWidth:400 height:200];
+  
+  //Decoded in the background and cached
+  DKImagePipeline *pipeline = [DKImagePipeline new];
+  STAssertTrue([pipeline cachedImageForKey:@"red" maxPixelSize:100.0] == NULL, nil);
+  DKTestsQueue *queue = [DKTestsQueue queue];
+  __block size_t decodedWidth = 0;
+  BOOL decoded = [queue waitForBlock:^{
+    [pipeline decodeImageWithData:data key:@"red" maxPixelSize:100.0 block:^(CGImageRef decodedImage) {
+      decodedWidth = CGImageGetWidth(decodedImage);
+      [queue signal];
+    }];
+  } signals:1 timeout:10.0];
+  STAssertTrue(decoded, nil);
+  STAssertEquals(decodedWidth, (size_t)100, nil);
+  
+  CGImageRef cachedImage = [pipeline cachedImageForKey:@"red" maxPixelSize:100.0];
+  STAssertTrue(cachedImage != NULL, nil);
+  STAssertEquals(CGImageGetWidth(cachedImage), (size_t)100, nil);
+  STAssertTrue([pipeline cachedImageForKey:@"red" maxPixelSize:200.0] == NULL, nil);
+  
+  [pipeline removeAllImages];
+  STAssertTrue([pipeline cachedImageForKey:@"red" maxPixelSize:100.0] == NULL, nil);
+}
+
+- (void)testCancelledDecode {
+  NSData *data = [self generatePNGDataWithWidth:400 height:200];
+  DKImagePipeline *pipeline = [DKImagePipeline new];
+  DKTestsQueue *queue = [DKTestsQueue queue];
+  __block BOOL cancelledCalled = NO;
+  __block BOOL finishedCalled = NO;
+  __block NSOperation *cancelledOperation = nil;
+  __block NSOperation *finishedOperation = nil;
+  [queue sync:^{
+    //Cancelled before decoding
+    cancelledOperation = [pipeline decodeImageWithData:data key:nil maxPixelSize:50.0 block:^(CGImageRef decodedImage) {
+      cancelledCalled = YES;
+    }];
+    [cancelledOperation cancel];
+    
+    //Cancelled once decoded, the callback is already queued on the blocked calling queue
+    finishedOperation = [pipeline decodeImageWithData:data key:nil maxPixelSize:50.0 block:^(CGImageRef decodedImage) {
+      finishedCalled = YES;
+    }];
+    [finishedOperation waitUntilFinished];
+    [finishedOperation cancel];
+  }];
+  [cancelledOperation waitUntilFinished];
+  
+  //Run the queued callbacks
+  [queue drain];
+  STAssertFalse(cancelledCalled, nil);
+  STAssertFalse(finishedCalled, nil);
+}
+
+@end
@@ -15,8 +15,18 @@
 #import "DKEntity-Private.h"
 #import "DKQuery.h"
 #import "DKQuery-Private.h"
+#import "DKQueryCursor.h"
+#import "DKPreparedQuery.h"
+#import "DKQueryGroup.h"
+#import "DKLiveQuery.h"
+#import "DKCollectionSync.h"
+#import "DKSpatialIndex.h"
+#import "DKTextIndex.h"
+#import "DKEntityStore.h"
 #import "DKManager.h"
+#import "DKBinaryCoder.h"
 #import "DKTests.h"
+#import "DKTestsQueue.h"
 #import "DKEntityTests.h"
 
 @implementation DKQueryTests
@@ -809,6 +819,1217 @@
   [self deleteDefaultUser];
 }
 
+- (void)testCacheInvalidationOnWrite {
+  NSError *error = nil;
+  BOOL success = NO;
+    
+  [self createDefaultUserAndLogin];
+    
+  //Insert post
+  DKEntity *postObject1 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject1 setObject:@"post1" forKey:kDKEntityTestsPostText];
+  success = [postObject1 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+    
+  //Cache query results
+  error = nil;
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  q.cachePolicy = DKCachePolicyUseCacheElseLoad;
+  NSArray *results = [q findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)1, nil);
+  STAssertTrue([q hasCachedResult], nil);
+    
+  //Cache entity refresh on another collection
+  DKEntity *userObject = [DKEntity entityWithName:kDKEntityTestsUser];
+  success = [userObject loggedUser:&error];
+  STAssertTrue(success, nil);
+  DKQuery *q2 = [DKQuery queryWithEntityName:kDKEntityTestsUser];
+  q2.cachePolicy = DKCachePolicyUseCacheElseLoad;
+  [q2 whereEntityIdMatches:userObject.entityId];
+  results = [q2 findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue([q2 hasCachedResult], nil);
+    
+  //Insert invalidates only the post collection
+  DKEntity *postObject2 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject2 setObject:@"post2" forKey:kDKEntityTestsPostText];
+  success = [postObject2 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  STAssertFalse([q hasCachedResult], nil);
+  STAssertTrue([q2 hasCachedResult], nil);
+    
+  //Reload sees the new post
+  error = nil;
+  results = [q findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)2, nil);
+  STAssertTrue([q hasCachedResult], nil);
+    
+  //Delete posts
+  error = nil;
+  success = [postObject1 delete:&error];
+  STAssertNil(error, @"delete should not return error, did return %@", error);
+  STAssertTrue(success, @"delete should have been successful (return YES)");
+  STAssertFalse([q hasCachedResult], nil);
+  error = nil;
+  success = [postObject2 delete:&error];
+  STAssertNil(error, @"delete should not return error, did return %@", error);
+  STAssertTrue(success, @"delete should have been successful (return YES)");
+    
+  [self deleteDefaultUser];
+}
+
+- (void)testBinaryCoder {
+  NSError *error = nil;
+  
+  //Round trip
+  NSDictionary *object = @{@"text": @"caf\u00e9 \U0001F600", @"empty": @"", @"null": [NSNull null],
+                           @"yes": @YES, @"no": @NO, @"int": @(42), @"negative": @(-1234567890123LL),
+                           @"double": @(3.25), @"array": @[@1, @"two", @[], @{}],
+                           @"nested": @[@{@"text": @"a", @"int": @1}, @{@"text": @"b", @"int": @2}]};
+  NSData *data = [DKBinaryCoder dataWithJSONObject:object];
+  STAssertTrue([DKBinaryCoder isEncodedData:data], nil);
+  id decoded = [DKBinaryCoder JSONObjectWithData:data error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEqualObjects(decoded, object, nil);
+  STAssertTrue(decoded[@"yes"] == (id)kCFBooleanTrue, nil);
+  STAssertTrue(decoded[@"no"] == (id)kCFBooleanFalse, nil);
+  STAssertEquals(strcmp([decoded[@"int"] objCType], @encode(long long)), 0, nil);
+  
+  //Repeated keys are stored once
+  NSData *JSONData = [NSJSONSerialization dataWithJSONObject:object[@"nested"] options:0 error:NULL];
+  STAssertTrue([DKBinaryCoder dataWithJSONObject:object[@"nested"]].length < JSONData.length, nil);
+  
+  //Invalid objects and data
+  STAssertNil([DKBinaryCoder dataWithJSONObject:@{@"date": [NSDate date]}], nil);
+  STAssertNil([DKBinaryCoder dataWithJSONObject:@{@"nan": @(NAN)}], nil);
+  STAssertFalse([DKBinaryCoder isEncodedData:JSONData], nil);
+  error = nil;
+  STAssertNil([DKBinaryCoder JSONObjectWithData:[data subdataWithRange:NSMakeRange(0, data.length - 1)] error:&error], nil);
+  STAssertEquals(error.code, (NSInteger)DKErrorInvalidResponse, nil);
+  
+  //Cached query results decode like the fetched ones
+  [self createDefaultUserAndLogin];
+  DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject setObject:@"post1" forKey:kDKEntityTestsPostText];
+  [postObject setObject:@[@"a", @"b"] forKey:kDKEntityTestsPostSharedTo];
+  error = nil;
+  BOOL success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  error = nil;
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  q.cachePolicy = DKCachePolicyUseCacheElseLoad;
+  NSArray *fetched = [q findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue([q hasCachedResult], nil);
+  NSArray *cached = [q findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(cached.count, (NSUInteger)1, nil);
+  STAssertEqualObjects([cached[0] resultMap], [fetched[0] resultMap], nil);
+  STAssertEqualObjects([cached[0] objectForKey:kDKEntityTestsPostText], @"post1", nil);
+  
+  error = nil;
+  success = [postObject delete:&error];
+  STAssertNil(error, @"delete should not return error, did return %@", error);
+  STAssertTrue(success, @"delete should have been successful (return YES)");
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testCursorPaging {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts, with ties on the sort key across page boundaries
+  NSArray *visits = @[@0, @1, @1, @1, @2];
+  NSMutableArray *posts = [NSMutableArray new];
+  for (NSNumber *value in visits) {
+    DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+    [postObject setObject:value forKey:kDKEntityTestsPostVisits];
+    success = [postObject save:&error];
+    STAssertNil(error, error.description);
+    STAssertTrue(success, nil);
+    [posts addObject:postObject];
+  }
+  
+  //Test pages
+  error = nil;
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q orderDescendingByKey:kDKEntityTestsPostVisits];
+  DKQueryCursor *cursor = [q cursorWithPageSize:2];
+  cursor.assumesSortKeyExists = YES;
+  NSMutableSet *ids = [NSMutableSet new];
+  NSMutableArray *values = [NSMutableArray new];
+  NSArray *page = nil;
+  NSUInteger pageCount = 0;
+  while ((page = [cursor nextPage:&error]) != nil) {
+    STAssertNil(error, error.localizedDescription);
+    STAssertTrue(page.count <= 2, nil);
+    for (DKEntity *entity in page) {
+      [ids addObject:entity.entityId];
+      [values addObject:[entity objectForKey:kDKEntityTestsPostVisits]];
+    }
+    pageCount++;
+  }
+  STAssertNil(error, error.localizedDescription);
+  STAssertFalse(cursor.hasMore, nil);
+  //Pages end before a sort value that may continue on the next page
+  STAssertEquals(pageCount, (NSUInteger)4, nil);
+  STAssertEquals(ids.count, (NSUInteger)5, nil);
+  STAssertEqualObjects(values, [[visits reverseObjectEnumerator] allObjects], nil);
+  
+  //Test fast enumeration
+  [cursor reset];
+  NSUInteger count = 0;
+  for (DKEntity *entity in cursor) {
+    STAssertTrue([ids containsObject:entity.entityId], nil);
+    count++;
+  }
+  STAssertNil(cursor.lastError, cursor.lastError.localizedDescription);
+  STAssertEquals(count, (NSUInteger)5, nil);
+  
+  //Test block enumeration, unsorted queries page by id
+  error = nil;
+  __block NSUInteger blockCount = 0;
+  DKQuery *q2 = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  success = [[q2 cursorWithPageSize:3] enumerateEntitiesUsingBlock:^(DKEntity *entity, BOOL *stop) {
+    blockCount++;
+  } error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEquals(blockCount, (NSUInteger)5, nil);
+  
+  //Test entities without a value for the sort key are paged by default
+  DKEntity *unsortedPost = [DKEntity entityWithName:kDKEntityTestsPost];
+  success = [unsortedPost save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  [posts addObject:unsortedPost];
+  
+  NSMutableSet *allIds = [NSMutableSet new];
+  for (DKEntity *entity in [q cursorWithPageSize:2]) {
+    [allIds addObject:entity.entityId];
+  }
+  STAssertEquals(allIds.count, (NSUInteger)6, nil);
+  STAssertTrue([allIds containsObject:unsortedPost.entityId], nil);
+  
+  cursor = [q cursorWithPageSize:2];
+  cursor.assumesSortKeyExists = YES;
+  count = 0;
+  for (DKEntity *entity in cursor) {
+    count++;
+  }
+  STAssertEquals(count, (NSUInteger)5, nil);
+  
+  //Delete posts
+  for (DKEntity *postObject in posts) {
+    error = nil;
+    success = [postObject delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testPartitionedFetch {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  NSMutableArray *posts = [NSMutableArray new];
+  for (NSUInteger i = 0; i < 5; i++) {
+    DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+    [postObject setObject:@(i) forKey:kDKEntityTestsPostVisits];
+    success = [postObject save:&error];
+    STAssertNil(error, error.description);
+    STAssertTrue(success, nil);
+    [posts addObject:postObject];
+  }
+  
+  //Test numeric partitions, merged in sort order
+  error = nil;
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q orderDescendingByKey:kDKEntityTestsPostVisits];
+  NSArray *results = [q findAllPartitionedByKey:kDKEntityTestsPostVisits partitions:3 maxConcurrent:2 error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)5, nil);
+  for (NSUInteger i = 0; i < results.count; i++) {
+    STAssertEqualObjects([results[i] objectForKey:kDKEntityTestsPostVisits], @(4 - i), nil);
+  }
+  
+  //Test id partitions, with a condition on another key
+  error = nil;
+  DKQuery *q2 = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q2 whereKey:kDKEntityTestsPostVisits greaterThan:@1];
+  [q2 orderAscendingByKey:kDKEntityTestsPostVisits];
+  results = [q2 findAllPartitionedByKey:kDKEntityIDField partitions:4 maxConcurrent:4 error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)3, nil);
+  STAssertEqualObjects([results[0] objectForKey:kDKEntityTestsPostVisits], @2, nil);
+  STAssertEqualObjects([results[2] objectForKey:kDKEntityTestsPostVisits], @4, nil);
+  
+  //Delete posts
+  for (DKEntity *postObject in posts) {
+    error = nil;
+    success = [postObject delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testLocalEvaluation {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  DKEntity *postObject1 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject1 setObject:@"A test string" forKey:kDKEntityTestsPostText];
+  [postObject1 setObject:@0 forKey:kDKEntityTestsPostVisits];
+  [postObject1 setObject:@[@"user1", @"user2", @"user3"] forKey:kDKEntityTestsPostSharedTo];
+  [postObject1 setObject:@1.0 forKey:kDKEntityTestsPostQuantity];
+  success = [postObject1 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  DKEntity *postObject2 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject2 setObject:@"another TEST" forKey:kDKEntityTestsPostText];
+  [postObject2 setObject:@1 forKey:kDKEntityTestsPostVisits];
+  [postObject2 setObject:@[@"user1", @"user2"] forKey:kDKEntityTestsPostSharedTo];
+  [postObject2 setObject:@50.0 forKey:kDKEntityTestsPostPrice];
+  success = [postObject2 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  DKEntity *postObject3 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject3 setObject:@"nothing" forKey:kDKEntityTestsPostText];
+  [postObject3 setObject:@2 forKey:kDKEntityTestsPostVisits];
+  success = [postObject3 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  //Load the collection
+  error = nil;
+  DKQuery *all = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  all.cachePolicy = DKCachePolicyUseCacheElseLoad;
+  NSArray *entities = [all findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(entities.count, (NSUInteger)3, nil);
+  
+  //Build queries
+  NSMutableArray *queries = [NSMutableArray new];
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits equalTo:@1];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits notEqualTo:@1];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits greaterThan:@0];
+  [q whereKey:kDKEntityTestsPostVisits lessThanOrEqualTo:@1];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits containedIn:@[@0, @2]];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits notContainedIn:@[@0, @2]];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostSharedTo containsAllIn:@[@"user1", @"user2"]];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostSharedTo equalTo:@"user3"];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKeyExists:kDKEntityTestsPostQuantity];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKeyDoesNotExist:kDKEntityTestsPostQuantity];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText containsString:@"test" caseInsensitive:YES];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText hasPrefix:@"A"];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [[q or] whereKey:kDKEntityTestsPostVisits equalTo:@0];
+  [[q or] whereKey:kDKEntityTestsPostPrice equalTo:@50.0];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q orderDescendingByKey:kDKEntityTestsPostVisits];
+  q.skip = 1;
+  q.limit = 1;
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q orderAscendingByKey:kDKEntityTestsPostPrice];
+  [q includeKeys:@[kDKEntityTestsPostText]];
+  [queries addObject:q];
+  
+  //Test local results match the server
+  for (DKQuery *query in queries) {
+    error = nil;
+    NSArray *serverResults = [query findAll:&error];
+    STAssertNil(error, error.localizedDescription);
+    NSArray *localResults = [query findAllInEntities:entities error:&error];
+    STAssertNil(error, error.localizedDescription);
+    STAssertEquals(localResults.count, serverResults.count, nil);
+    for (NSUInteger i = 0; i < MIN(localResults.count, serverResults.count); i++) {
+      STAssertEqualObjects([localResults[i] resultMap], [serverResults[i] resultMap], nil);
+    }
+  }
+  
+  //Test cached collection
+  error = nil;
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits greaterThanOrEqualTo:@1];
+  NSArray *results = [q findAllInCachedCollection:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)2, nil);
+  
+  //Test geo operators on entities without locations
+  error = nil;
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostLocation nearPoint:@[@0, @0] withinDistance:@1];
+  results = [q findAllInEntities:entities error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)0, nil);
+  
+  //Delete posts
+  error = nil;
+  success = [postObject1 delete:&error];
+  STAssertNil(error, @"delete should not return error, did return %@", error);
+  STAssertTrue(success, @"delete should have been successful (return YES)");
+  error = nil;
+  success = [postObject2 delete:&error];
+  STAssertNil(error, @"delete should not return error, did return %@", error);
+  STAssertTrue(success, @"delete should have been successful (return YES)");
+  error = nil;
+  success = [postObject3 delete:&error];
+  STAssertNil(error, @"delete should not return error, did return %@", error);
+  STAssertTrue(success, @"delete should have been successful (return YES)");
+  
+  //Writes invalidate the cached collection
+  error = nil;
+  results = [q findAllInCachedCollection:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertNil(results, nil);
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testPreparedQuery {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  NSMutableArray *posts = [NSMutableArray new];
+  NSArray *texts = @[@"first \"post\"", @"second/post", @"third\npost"];
+  for (NSUInteger i = 0; i < texts.count; i++) {
+    DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+    [postObject setObject:texts[i] forKey:kDKEntityTestsPostText];
+    [postObject setObject:@(i) forKey:kDKEntityTestsPostVisits];
+    success = [postObject save:&error];
+    STAssertNil(error, error.description);
+    STAssertTrue(success, nil);
+    [posts addObject:postObject];
+  }
+  
+  //Prepare query
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits greaterThanOrEqualTo:[DKQuery parameterNamed:@"minVisits"]];
+  [[q or] whereKey:kDKEntityTestsPostText equalTo:[DKQuery parameterNamed:@"text"]];
+  [[q or] whereKey:kDKEntityTestsPostVisits equalTo:[DKQuery parameterNamed:@"minVisits"]];
+  [q orderAscendingByKey:kDKEntityTestsPostVisits];
+  DKPreparedQuery *prepared = [q prepare];
+  STAssertEquals(prepared.parameterNames.count, (NSUInteger)2, nil);
+  
+  //Test encoding matches the plain query
+  for (NSString *text in texts) {
+    NSDictionary *parameters = @{@"minVisits" : @1, @"text" : text};
+    DKQuery *plain = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+    [plain whereKey:kDKEntityTestsPostVisits greaterThanOrEqualTo:@1];
+    [[plain or] whereKey:kDKEntityTestsPostText equalTo:text];
+    [[plain or] whereKey:kDKEntityTestsPostVisits equalTo:@1];
+    [plain orderAscendingByKey:kDKEntityTestsPostVisits];
+    
+    NSString *encoded = [prepared encodedQueryWithParameters:parameters];
+    NSData *JSONData = [[encoded stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding] dataUsingEncoding:NSUTF8StringEncoding];
+    id decoded = [NSJSONSerialization JSONObjectWithData:JSONData options:0 error:&error];
+    STAssertNil(error, error.localizedDescription);
+    STAssertEqualObjects(decoded, [plain requestDict], nil);
+  }
+  
+  //Test execution
+  error = nil;
+  NSArray *results = [prepared findAllWithParameters:@{@"minVisits" : @1, @"text" : texts[1]} error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)1, nil);
+  STAssertEqualObjects([results[0] objectForKey:kDKEntityTestsPostText], texts[1], nil);
+  
+  error = nil;
+  results = [prepared findAllWithParameters:@{@"minVisits" : @2, @"text" : texts[2]} error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)1, nil);
+  STAssertEqualObjects([results[0] objectForKey:kDKEntityTestsPostVisits], @2, nil);
+  
+  //Test missing parameter
+  STAssertThrows([prepared encodedQueryWithParameters:@{@"minVisits" : @1}], nil);
+  
+  //Test values without a JSON representation
+  STAssertThrows([prepared encodedQueryWithParameters:@{@"minVisits" : @(NAN), @"text" : texts[1]}], nil);
+  error = nil;
+  results = [prepared findAllWithParameters:@{@"minVisits" : @(INFINITY), @"text" : texts[1]} error:&error];
+  STAssertNil(results, nil);
+  STAssertEquals(error.code, (NSInteger)DKErrorInvalidParams, nil);
+  
+  //Delete posts
+  for (DKEntity *postObject in posts) {
+    error = nil;
+    success = [postObject delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testQueryGroup {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  NSMutableArray *posts = [NSMutableArray new];
+  for (NSUInteger i = 0; i < 3; i++) {
+    DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+    [postObject setObject:@(i) forKey:kDKEntityTestsPostVisits];
+    success = [postObject save:&error];
+    STAssertNil(error, error.description);
+    STAssertTrue(success, nil);
+    [posts addObject:postObject];
+  }
+  
+  //Group queries across collections
+  __block NSArray *postResults = nil;
+  __block NSUInteger postCount = 0;
+  __block NSArray *userResults = nil;
+  __block NSError *unknownError = nil;
+  
+  DKQueryGroup *group = [DKQueryGroup group];
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits greaterThanOrEqualTo:@1];
+  [q orderDescendingByKey:kDKEntityTestsPostVisits];
+  [group addQuery:q resultBlock:^(NSArray *results, NSError *error) {
+    STAssertNil(error, error.localizedDescription);
+    postResults = results;
+  }];
+  DKQuery *q2 = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  q2.limit = 1;
+  [group addCountQuery:q2 countBlock:^(NSUInteger count, NSError *error) {
+    STAssertNil(error, error.localizedDescription);
+    postCount = count;
+  }];
+  DKQuery *q3 = [DKQuery queryWithEntityName:kDKEntityTestsUser];
+  [q3 whereKey:kDKEntityUserName equalTo:@"user_1"];
+  [group addQuery:q3 resultBlock:^(NSArray *results, NSError *error) {
+    STAssertNil(error, error.localizedDescription);
+    userResults = results;
+  }];
+  DKQuery *q4 = [DKQuery queryWithEntityName:@"NonExistentCollection"];
+  [group addQuery:q4 resultBlock:^(NSArray *results, NSError *error) {
+    unknownError = error;
+  }];
+  STAssertEquals(group.count, (NSUInteger)4, nil);
+  
+  //Test results match the queries run alone
+  error = nil;
+  success = [group execute:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEquals(postResults.count, (NSUInteger)2, nil);
+  STAssertEqualObjects([postResults[0] objectForKey:kDKEntityTestsPostVisits], @2, nil);
+  STAssertEqualObjects([postResults[0] entityName], kDKEntityTestsPost, nil);
+  STAssertEquals(postCount, (NSUInteger)3, nil);
+  STAssertEquals(userResults.count, (NSUInteger)1, nil);
+  STAssertEqualObjects([userResults[0] objectForKey:kDKEntityUserName], @"user_1", nil);
+  STAssertNotNil(unknownError, nil);
+  
+  //Delete posts
+  for (DKEntity *postObject in posts) {
+    error = nil;
+    success = [postObject delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testLiveQuery {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Subscribe from a serial queue, events are delivered there without a run loop
+  NSMutableArray *events = [NSMutableArray new];
+  DKTestsQueue *queue = [DKTestsQueue queue];
+  
+  DKQuery *query = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [query whereKey:kDKEntityTestsPostVisits greaterThanOrEqualTo:@10];
+  __block DKLiveQuery *subscription = nil;
+  [queue sync:^{
+    subscription = [query subscribeWithBlock:^(DKLiveQueryEvent event, DKEntity *entity) {
+      //Events without an id are recorded so the comparison below fails instead of throwing
+      [events addObject:@[@(event), (entity.entityId != nil) ? entity.entityId : [NSNull null]]];
+      [queue signal];
+    }];
+  }];
+  for (NSUInteger i = 0; i < 50 && !subscription.isConnected; i++) {
+    [NSThread sleepForTimeInterval:0.1];
+  }
+  STAssertTrue(subscription.isConnected, subscription.lastError.localizedDescription);
+  
+  //Test insert into the results
+  DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject setObject:@20 forKey:kDKEntityTestsPostVisits];
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  STAssertTrue([queue waitForSignals:1 timeout:5.0], nil);
+  
+  //Test the event is sent once stored, with the id of the created entity
+  __block NSArray *insertedEvent = nil;
+  [queue sync:^{
+    insertedEvent = [events lastObject];
+  }];
+  STAssertEqualObjects(insertedEvent, (@[@(DKLiveQueryEventInserted), postObject.entityId]), nil);
+  
+  //Test writes outside the results are not delivered
+  DKEntity *postObject2 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject2 setObject:@1 forKey:kDKEntityTestsPostVisits];
+  success = [postObject2 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  //Test update within and out of the results
+  [postObject setObject:@30 forKey:kDKEntityTestsPostVisits];
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  STAssertTrue([queue waitForSignals:1 timeout:5.0], nil);
+  
+  [postObject setObject:@5 forKey:kDKEntityTestsPostVisits];
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  STAssertTrue([queue waitForSignals:1 timeout:5.0], nil);
+  
+  [subscription cancel];
+  STAssertFalse(subscription.isConnected, nil);
+  
+  __block NSArray *receivedEvents = nil;
+  [queue sync:^{
+    receivedEvents = [events copy];
+  }];
+  NSArray *expected = @[@[@(DKLiveQueryEventInserted), postObject.entityId],
+                        @[@(DKLiveQueryEventUpdated), postObject.entityId],
+                        @[@(DKLiveQueryEventDeleted), postObject.entityId]];
+  STAssertEqualObjects(receivedEvents, expected, nil);
+  
+  //Delete posts
+  for (DKEntity *post in @[postObject, postObject2]) {
+    error = nil;
+    success = [post delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testCollectionSync {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject setObject:@20 forKey:kDKEntityTestsPostVisits];
+  success = [postObject save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  DKEntity *postObject2 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject2 setObject:@1 forKey:kDKEntityTestsPostVisits];
+  success = [postObject2 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  //Test full sync
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostVisits greaterThanOrEqualTo:@10];
+  [q orderDescendingByKey:kDKEntityTestsPostVisits];
+  DKCollectionSync *sync = [[DKCollectionSync alloc] initWithQuery:q];
+  [sync reset];
+  STAssertNil(sync.watermark, nil);
+  
+  success = [sync synchronize:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertNotNil(sync.watermark, nil);
+  STAssertEquals(sync.count, (NSUInteger)1, nil);
+  STAssertEqualObjects([sync entityWithId:postObject.entityId].entityId, postObject.entityId, nil);
+  
+  //Test incremental sync of updates, deletions and inserts
+  [postObject2 setObject:@15 forKey:kDKEntityTestsPostVisits];
+  success = [postObject2 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  NSString *deletedId = postObject.entityId;
+  success = [postObject delete:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  DKEntity *postObject3 = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject3 setObject:@50 forKey:kDKEntityTestsPostVisits];
+  success = [postObject3 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  success = [sync synchronize:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  NSSet *changedIds = [NSSet setWithArray:[sync.changedEntities valueForKey:@"entityId"]];
+  NSSet *expectedIds = [NSSet setWithObjects:postObject2.entityId, postObject3.entityId, nil];
+  STAssertEqualObjects(changedIds, expectedIds, nil);
+  STAssertEqualObjects(sync.removedEntityIds, @[deletedId], nil);
+  
+  NSArray *results = [sync findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)2, nil);
+  STAssertEqualObjects([results[0] entityId], postObject3.entityId, nil);
+  STAssertEqualObjects([results[1] objectForKey:kDKEntityTestsPostVisits], @15, nil);
+  
+  //Test entities leaving the query results are removed
+  [postObject3 setObject:@5 forKey:kDKEntityTestsPostVisits];
+  success = [postObject3 save:&error];
+  STAssertNil(error, error.description);
+  STAssertTrue(success, nil);
+  
+  success = [sync synchronize:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEqualObjects(sync.removedEntityIds, @[postObject3.entityId], nil);
+  STAssertEquals(sync.count, (NSUInteger)1, nil);
+  
+  //Test the store and watermark are restored
+  DKCollectionSync *restored = [[DKCollectionSync alloc] initWithQuery:q];
+  STAssertEqualObjects(restored.watermark, sync.watermark, nil);
+  STAssertEquals(restored.count, (NSUInteger)1, nil);
+  STAssertNotNil([restored entityWithId:postObject2.entityId], nil);
+  
+  //Test a sync older than the tombstone retention fetches all entities
+  [NSThread sleepForTimeInterval:1.1];
+  restored.tombstoneRetentionInterval = 1.0;
+  success = [restored synchronize:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEqualObjects([restored.changedEntities valueForKey:@"entityId"], @[postObject2.entityId], nil);
+  [restored reset];
+  
+  //Delete posts
+  for (DKEntity *post in @[postObject2, postObject3]) {
+    error = nil;
+    success = [post delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testQueryPOSTTransport {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  NSMutableArray *posts = [NSMutableArray new];
+  for (NSUInteger i = 0; i < 3; i++) {
+    DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+    [postObject setObject:@(i) forKey:kDKEntityTestsPostVisits];
+    success = [postObject save:&error];
+    STAssertNil(error, error.description);
+    STAssertTrue(success, nil);
+    [posts addObject:postObject];
+  }
+  
+  //Query with a large $in list
+  NSMutableArray *ids = [NSMutableArray arrayWithObjects:[posts[0] entityId], [posts[2] entityId], nil];
+  for (NSUInteger i = 0; i < 500; i++) {
+    [ids addObject:[NSString stringWithFormat:@"%016x", (unsigned int)i]];
+  }
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityIDField containedIn:ids];
+  [q orderAscendingByKey:kDKEntityTestsPostVisits];
+  
+  //Test the results match the query sent in the URL
+  NSUInteger threshold = [DKManager queryPOSTThreshold];
+  [DKManager setQueryPOSTThreshold:0];
+  NSArray *getResults = [q findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(getResults.count, (NSUInteger)2, nil);
+  
+  [DKManager setQueryPOSTThreshold:1024];
+  NSArray *postResults = [q findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEqualObjects([postResults valueForKey:@"entityId"], [getResults valueForKey:@"entityId"], nil);
+  
+  //Test long count queries are posted as counts
+  NSUInteger count = [q countAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(count, (NSUInteger)2, nil);
+  
+  //Test posted queries are cached and invalidated like queries sent in the URL
+  q.cachePolicy = DKCachePolicyUseCacheElseLoad;
+  postResults = [q findAll:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue([q hasCachedResult], nil);
+  
+  [DKManager clearCachedResultsForEntityName:kDKEntityTestsPost];
+  STAssertFalse([q hasCachedResult], nil);
+  
+  //Test errors of posted queries
+  DKQuery *q3 = [DKQuery queryWithEntityName:@"NonExistentCollection"];
+  [q3 whereKey:kDKEntityIDField containedIn:ids];
+  NSArray *results = [q3 findAll:&error];
+  STAssertNotNil(error, nil);
+  STAssertEquals(results.count, (NSUInteger)0, nil);
+  
+  [DKManager setQueryPOSTThreshold:threshold];
+  
+  //Delete posts
+  for (DKEntity *postObject in posts) {
+    error = nil;
+    success = [postObject delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testAggregation {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  NSArray *values = @[@[@"a", @1], @[@"a", @3], @[@"b", @5], @[@"b", [NSNull null]]];
+  NSMutableArray *posts = [NSMutableArray new];
+  for (NSArray *value in values) {
+    DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+    [postObject setObject:value[0] forKey:kDKEntityTestsPostText];
+    if (value[1] != [NSNull null]) {
+      [postObject setObject:value[1] forKey:kDKEntityTestsPostVisits];
+    }
+    success = [postObject save:&error];
+    STAssertNil(error, error.description);
+    STAssertTrue(success, nil);
+    [posts addObject:postObject];
+  }
+  
+  //Test grouped aggregates
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q orderDescendingByKey:kDKEntityTestsPostText];
+  NSArray *rows = [q aggregate:@{@"total" : @{@"$sum" : kDKEntityTestsPostVisits},
+                                 @"posts" : @{@"$count" : @YES},
+                                 @"visited" : @{@"$count" : kDKEntityTestsPostVisits}}
+                 groupedByKeys:@[kDKEntityTestsPostText]
+                         error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(rows.count, (NSUInteger)2, nil);
+  NSDictionary *expectedB = @{kDKEntityTestsPostText : @"b", @"total" : @5, @"posts" : @2, @"visited" : @1};
+  NSDictionary *expectedA = @{kDKEntityTestsPostText : @"a", @"total" : @4, @"posts" : @2, @"visited" : @2};
+  STAssertEqualObjects(rows[0], expectedB, nil);
+  STAssertEqualObjects(rows[1], expectedA, nil);
+  
+  NSArray *counts = [q countGroupedByKeys:@[kDKEntityTestsPostText] error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEqualObjects([counts valueForKey:@"count"], (@[@2, @2]), nil);
+  
+  //Test single values
+  DKQuery *q2 = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  STAssertEqualObjects([q2 sumOfKey:kDKEntityTestsPostVisits error:&error], @9, nil);
+  STAssertEqualObjects([q2 averageOfKey:kDKEntityTestsPostVisits error:&error], @3, nil);
+  STAssertEqualObjects([q2 minimumOfKey:kDKEntityTestsPostVisits error:&error], @1, nil);
+  STAssertEqualObjects([q2 maximumOfKey:kDKEntityTestsPostVisits error:&error], @5, nil);
+  STAssertNil(error, error.localizedDescription);
+  
+  //Test conditions apply
+  [q2 whereKey:kDKEntityTestsPostVisits greaterThanOrEqualTo:@2];
+  STAssertEqualObjects([q2 sumOfKey:kDKEntityTestsPostVisits error:&error], @8, nil);
+  [q2 whereKey:kDKEntityTestsPostVisits greaterThan:@100];
+  STAssertEqualObjects([q2 sumOfKey:kDKEntityTestsPostVisits error:&error], @0, nil);
+  STAssertNil([q2 averageOfKey:kDKEntityTestsPostVisits error:&error], nil);
+  STAssertNil(error, error.localizedDescription);
+  
+  //Test unknown operators fail
+  NSArray *invalid = [q aggregate:@{@"x" : @{@"$median" : kDKEntityTestsPostVisits}} groupedByKeys:nil error:&error];
+  STAssertNil(invalid, nil);
+  STAssertNotNil(error, nil);
+  
+  //Delete posts
+  for (DKEntity *postObject in posts) {
+    error = nil;
+    success = [postObject delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testSpatialIndex {
+  NSError *error = nil;
+  
+  //Index a grid of points
+  DKSpatialIndex *index = [[DKSpatialIndex alloc] initWithEntityName:kDKEntityTestsPost key:kDKEntityTestsPostLocation cellSize:1.0];
+  NSMutableArray *objects = [NSMutableArray new];
+  for (NSInteger x = -5; x <= 5; x++) {
+    for (NSInteger y = -5; y <= 5; y++) {
+      [objects addObject:@{kDKEntityIDField : [NSString stringWithFormat:@"%d:%d", (int)x, (int)y],
+                           kDKEntityTestsPostLocation : @[@(x * 0.5), @(y * 0.5)],
+                           kDKEntityTestsPostVisits : @(ABS(x))}];
+    }
+  }
+  [objects addObject:@{kDKEntityIDField : @"nowhere"}];
+  [index addEntities:objects];
+  STAssertEquals(index.count, (NSUInteger)121, nil);
+  
+  //Test nearest entities
+  NSArray *results = [index entitiesNearPoint:@[@1.1, @0.9] maxDistance:-1 limit:3];
+  STAssertEquals(results.count, (NSUInteger)3, nil);
+  STAssertEqualObjects([results[0] entityId], @"2:2", nil);
+  
+  results = [index entitiesNearPoint:@[@0, @0] maxDistance:0.5 limit:0];
+  STAssertEquals(results.count, (NSUInteger)5, nil);
+  STAssertEqualObjects([results[0] entityId], @"0:0", nil);
+  
+  results = [index entitiesNearPoint:@[@100, @100] maxDistance:-1 limit:1];
+  STAssertEqualObjects([results.lastObject entityId], @"5:5", nil);
+  
+  //Test box
+  results = [index entitiesWithinBoxFrom:@[@0, @0] to:@[@1, @0.5]];
+  STAssertEquals(results.count, (NSUInteger)6, nil);
+  
+  //Test queries match the evaluation of all entities
+  NSMutableArray *queries = [NSMutableArray new];
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostLocation nearPoint:@[@-0.83, @1.27] withinDistance:@1.2];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostLocation nearPoint:@[@0.2, @0.1] withinDistance:@10];
+  q.skip = 2;
+  q.limit = 4;
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostLocation nearPoint:@[@0.2, @0.1] withinDistance:@2];
+  [q whereKey:kDKEntityTestsPostVisits greaterThan:@2];
+  q.limit = 3;
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostLocation withinBoxFrom:@[@-1, @-2] to:@[@1.5, @0]];
+  [q orderAscendingByKey:kDKEntityIDField];
+  [queries addObject:q];
+  
+  for (DKQuery *query in queries) {
+    error = nil;
+    NSArray *indexResults = [query findAllInSpatialIndex:index error:&error];
+    STAssertNil(error, error.localizedDescription);
+    NSArray *allResults = [query findAllInEntities:objects error:&error];
+    STAssertNil(error, error.localizedDescription);
+    STAssertTrue(indexResults.count > 0, nil);
+    STAssertEquals(indexResults.count, allResults.count, nil);
+    for (NSUInteger i = 0; i < MIN(indexResults.count, allResults.count); i++) {
+      STAssertEqualObjects([indexResults[i] resultMap], [allResults[i] resultMap], nil);
+    }
+  }
+  
+  //Test removal
+  [index removeEntityWithId:@"0:0"];
+  results = [index entitiesNearPoint:@[@0, @0] maxDistance:-1 limit:1];
+  STAssertFalse([[results.lastObject entityId] isEqualToString:@"0:0"], nil);
+  [index addEntities:@[@{kDKEntityIDField : @"1:1"}]];
+  STAssertEquals(index.count, (NSUInteger)119, nil);
+  [index removeAllEntities];
+  STAssertEquals(index.count, (NSUInteger)0, nil);
+  
+  //Test updating from saved entities
+  [self createDefaultUserAndLogin];
+  [index startUpdating];
+  DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject setObject:@[@9.19, @45.46] forKey:kDKEntityTestsPostLocation];
+  BOOL success = [postObject save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  results = [index entitiesNearPoint:@[@9.2, @45.5] maxDistance:0.1 limit:0];
+  STAssertEquals(results.count, (NSUInteger)1, nil);
+  STAssertEqualObjects([results.lastObject entityId], postObject.entityId, nil);
+  
+  error = nil;
+  success = [postObject delete:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEquals(index.count, (NSUInteger)0, nil);
+  [index stopUpdating];
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testTextIndex {
+  NSError *error = nil;
+  
+  //Index texts
+  DKTextIndex *index = [[DKTextIndex alloc] initWithEntityName:kDKEntityTestsPost keys:@[kDKEntityTestsPostText, kDKEntityTestsPostSharedTo]];
+  NSArray *objects = @[@{kDKEntityIDField : @"1", kDKEntityTestsPostText : @"New York city", kDKEntityTestsPostVisits : @1},
+                       @{kDKEntityIDField : @"2", kDKEntityTestsPostText : @"new yorkshire terrier", kDKEntityTestsPostVisits : @2},
+                       @{kDKEntityIDField : @"3", kDKEntityTestsPostText : @"Café York", kDKEntityTestsPostSharedTo : @[@"user1"]},
+                       @{kDKEntityIDField : @"4", kDKEntityTestsPostText : @"the yorker, news"},
+                       @{kDKEntityIDField : @"5", kDKEntityTestsPostVisits : @3}];
+  [index addEntities:objects];
+  STAssertEquals(index.count, (NSUInteger)5, nil);
+  STAssertFalse(index.isComplete, nil);
+  
+  //Test search as you type
+  NSArray *results = [index entitiesMatchingText:@"new yo" limit:0];
+  STAssertEquals(results.count, (NSUInteger)3, nil);
+  STAssertEqualObjects([results[0] entityId], @"1", nil);
+  
+  results = [index entitiesMatchingText:@"YORK" limit:2];
+  STAssertEquals(results.count, (NSUInteger)2, nil);
+  STAssertEqualObjects([results[0] entityId], @"1", nil);
+  STAssertEqualObjects([results[1] entityId], @"3", nil);
+  
+  results = [index entitiesMatchingText:@"cafe" limit:0];
+  STAssertEqualObjects([results.lastObject entityId], @"3", nil);
+  
+  //Test queries match the evaluation of all entities
+  index.complete = YES;
+  NSMutableArray *queries = [NSMutableArray new];
+  DKQuery *q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText containsString:@"york" caseInsensitive:YES];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText containsString:@"w york" caseInsensitive:NO];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText hasPrefix:@"new"];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText hasSuffix:@"rier"];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText equalTo:@"Café York"];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText matchesRegex:@"ork.*r"];
+  [queries addObject:q];
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText containsString:@"new" caseInsensitive:YES];
+  [q whereKey:kDKEntityTestsPostVisits greaterThan:@1];
+  [queries addObject:q];
+  
+  for (DKQuery *query in queries) {
+    [query orderAscendingByKey:kDKEntityIDField];
+    error = nil;
+    NSArray *indexResults = [query findAllInTextIndex:index error:&error];
+    STAssertNil(error, error.localizedDescription);
+    NSArray *allResults = [query findAllInEntities:objects error:&error];
+    STAssertNil(error, error.localizedDescription);
+    STAssertTrue(indexResults.count > 0, nil);
+    STAssertEquals(indexResults.count, allResults.count, nil);
+    for (NSUInteger i = 0; i < MIN(indexResults.count, allResults.count); i++) {
+      STAssertEqualObjects([indexResults[i] resultMap], [allResults[i] resultMap], nil);
+    }
+  }
+  
+  //Test unsorted results are ranked
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText containsString:@"york" caseInsensitive:YES];
+  results = [q findAllInTextIndex:index error:&error];
+  STAssertEquals(results.count, (NSUInteger)4, nil);
+  STAssertEqualObjects([results[0] entityId], @"1", nil);
+  STAssertEqualObjects([results[1] entityId], @"3", nil);
+  
+  //Test removal
+  [index removeEntityWithId:@"1"];
+  results = [index entitiesMatchingText:@"city" limit:0];
+  STAssertEquals(results.count, (NSUInteger)0, nil);
+  [index removeAllEntities];
+  STAssertEquals(index.count, (NSUInteger)0, nil);
+  STAssertFalse(index.isComplete, nil);
+  
+  //Test incomplete indexes query the server
+  [self createDefaultUserAndLogin];
+  [index startUpdating];
+  DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+  [postObject setObject:@"Text index test" forKey:kDKEntityTestsPostText];
+  BOOL success = [postObject save:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEquals(index.count, (NSUInteger)1, nil);
+  
+  error = nil;
+  q = [DKQuery queryWithEntityName:kDKEntityTestsPost];
+  [q whereKey:kDKEntityTestsPostText hasPrefix:@"Text index"];
+  results = [q findAllInTextIndex:index error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)1, nil);
+  
+  //Test loading the collection
+  error = nil;
+  success = [index loadEntities:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertTrue(index.isComplete, nil);
+  results = [q findAllInTextIndex:index error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEqualObjects([results.lastObject entityId], postObject.entityId, nil);
+  
+  error = nil;
+  success = [postObject delete:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEquals([index entitiesMatchingText:@"text index" limit:0].count, (NSUInteger)0, nil);
+  
+  //Test indexes not updating are not complete
+  [index stopUpdating];
+  STAssertFalse(index.isComplete, nil);
+  error = nil;
+  success = [index loadEntities:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertFalse(index.isComplete, nil);
+  
+  [self deleteDefaultUser];
+}
+
+- (void)testEntityStore {
+  NSError *error = nil;
+  BOOL success = NO;
+  
+  [self createDefaultUserAndLogin];
+  
+  //Insert posts
+  NSArray *values = @[@[@"a", @3, @[@"user1", @"user2"]], @[@"b", @1, @[@"user2"]], @[@"c", @2, @[]]];
+  NSMutableArray *posts = [NSMutableArray new];
+  for (NSArray *value in values) {
+    DKEntity *postObject = [DKEntity entityWithName:kDKEntityTestsPost];
+    [postObject setObject:value[0] forKey:kDKEntityTestsPostText];
+    [postObject setObject:value[1] forKey:kDKEntityTestsPostVisits];
+    [postObject setObject:value[2] forKey:kDKEntityTestsPostSharedTo];
+    success = [postObject save:&error];
+    STAssertNil(error, error.description);
+    STAssertTrue(success, nil);
+    [posts addObject:postObject];
+  }
+  
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"DKEntityStoreTests.sqlite"];
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  DKEntityStore *store = [[DKEntityStore alloc] initWithPath:path];
+  
+  //Store query results, index before and after
+  success = [store addIndexForKey:kDKEntityTestsPostVisits entityName:kDKEntityTestsPost error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  NSArray *results = [store saveResultsOfQuery:[DKQuery queryWithEntityName:kDKEntityTestsPost] error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)3, nil);
+  success = [store addIndexForKey:kDKEntityTestsPostSharedTo entityName:kDKEntityTestsPost error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  STAssertEquals([store countOfEntitiesWithName:kDKEntityTestsPost error:&error], (NSUInteger)3, nil);
+  
+  //Lookups by ID, value and range
+  DKEntity *stored = [store entityWithName:kDKEntityTestsPost entityId:[posts[0] entityId] error:&error];
+  STAssertEqualObjects([stored objectForKey:kDKEntityTestsPostText], @"a", nil);
+  results = [store entitiesWithName:kDKEntityTestsPost key:kDKEntityTestsPostSharedTo equalTo:@"user2" error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEquals(results.count, (NSUInteger)2, nil);
+  results = [store entitiesWithName:kDKEntityTestsPost key:kDKEntityTestsPostVisits from:@2 to:nil limit:0 error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertEqualObjects([results valueForKey:@"entityId"], (@[[posts[2] entityId], [posts[0] entityId]]), nil);
+  results = [store entitiesWithName:kDKEntityTestsPost key:kDKEntityTestsPostVisits from:nil to:@3 limit:2 error:&error];
+  STAssertEqualObjects([results valueForKey:@"entityId"], (@[[posts[1] entityId], [posts[2] entityId]]), nil);
+  
+  //Lookups on keys without index fail
+  error = nil;
+  results = [store entitiesWithName:kDKEntityTestsPost key:kDKEntityTestsPostText equalTo:@"a" error:&error];
+  STAssertNil(results, nil);
+  STAssertEquals(error.code, (NSInteger)DKErrorInvalidParams, nil);
+  
+  //Upserts replace index entries
+  error = nil;
+  DKEntity *updated = posts[1];
+  [updated setObject:@10 forKey:kDKEntityTestsPostVisits];
+  success = [updated save:&error];
+  STAssertTrue(success, nil);
+  success = [store saveEntities:@[updated] error:&error];
+  STAssertNil(error, error.localizedDescription);
+  STAssertTrue(success, nil);
+  results = [store entitiesWithName:kDKEntityTestsPost key:kDKEntityTestsPostVisits from:@4 to:@20 limit:0 error:&error];
+  STAssertEqualObjects([results valueForKey:@"entityId"], (@[[updated entityId]]), nil);
+  
+  //Reopened store keeps entities and indexes
+  [store close];
+  store = [[DKEntityStore alloc] initWithPath:path];
+  STAssertEqualObjects([store indexedKeysForEntityName:kDKEntityTestsPost], (@[kDKEntityTestsPostVisits, kDKEntityTestsPostSharedTo]), nil);
+  results = [store entitiesWithName:kDKEntityTestsPost key:kDKEntityTestsPostVisits equalTo:@3 error:&error];
+  STAssertEqualObjects([results valueForKey:@"entityId"], (@[[posts[0] entityId]]), nil);
+  
+  //Removals
+  success = [store removeEntityWithId:[posts[0] entityId] entityName:kDKEntityTestsPost error:&error];
+  STAssertTrue(success, nil);
+  STAssertNil([store entityWithName:kDKEntityTestsPost entityId:[posts[0] entityId] error:&error], nil);
+  results = [store entitiesWithName:kDKEntityTestsPost key:kDKEntityTestsPostSharedTo equalTo:@"user1" error:&error];
+  STAssertEquals(results.count, (NSUInteger)0, nil);
+  success = [store removeAllEntitiesWithName:kDKEntityTestsPost error:&error];
+  STAssertTrue(success, nil);
+  STAssertEquals([store countOfEntitiesWithName:kDKEntityTestsPost error:&error], (NSUInteger)0, nil);
+  STAssertNil(error, error.localizedDescription);
+  [store close];
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  
+  //Delete posts
+  for (DKEntity *postObject in posts) {
+    success = [postObject delete:&error];
+    STAssertNil(error, @"delete should not return error, did return %@", error);
+    STAssertTrue(success, @"delete should have been successful (return YES)");
+  }
+  
+  [self deleteDefaultUser];
+}
 
 - (void)testQueryOnNonExistentCollection {
   NSError *error = nil;
@@ -0,0 +1,51 @@
+//
+//  DKTestsPost.h
+//  DeploydKit
+//
+//  Generated by DeploydKit-Codegen from resources/post/config.json, do not edit.
+//
+
+#import "DKEntity.h"
+
+/**
+ A typed entity of the `post` collection
+ */
+@interface DKTestsPost : DKEntity
+
+/**
+ The `text` string value
+ */
+@property (nonatomic, copy) NSString *text;
+
+/**
+ The `location` array value
+ */
+@property (nonatomic, strong) NSArray *location;
+
+/**
+ The `sharedTo` array value
+ */
+@property (nonatomic, strong) NSArray *sharedTo;
+
+/**
+ The `visits` number value
+ */
+@property (nonatomic, assign) double visits;
+
+/**
+ The `price` number value
+ */
+@property (nonatomic, assign) double price;
+
+/**
+ The `quantity` number value
+ */
+@property (nonatomic, assign) double quantity;
+
+/**
+ Creates a new entity of the `post` collection
+ @return The new entity
+ */
++ (DKTestsPost *)entity;
+
+@end
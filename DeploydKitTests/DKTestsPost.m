@@ -0,0 +1,138 @@
+//
+//  DKTestsPost.m
+//  DeploydKit
+//
+//  Generated by DeploydKit-Codegen from resources/post/config.json, do not edit.
+//
+
+#import "DKTestsPost.h"
+
+#define kDKTestsPostEntityName @"post"
+#define kDKTestsPostTextKey @"text"
+#define kDKTestsPostLocationKey @"location"
+#define kDKTestsPostSharedToKey @"sharedTo"
+#define kDKTestsPostVisitsKey @"visits"
+#define kDKTestsPostPriceKey @"price"
+#define kDKTestsPostQuantityKey @"quantity"
+
+@implementation DKTestsPost {
+@private
+  NSString *text_;
+  NSArray *location_;
+  NSArray *sharedTo_;
+  double visits_;
+  double price_;
+  double quantity_;
+}
+
++ (void)load {
+  [DKEntity registerSubclass:self forEntityName:kDKTestsPostEntityName];
+}
+
++ (DKTestsPost *)entity {
+  return [[self alloc] initWithName:kDKTestsPostEntityName];
+}
+
++ (NSSet *)unvalidatedKeys {
+  static NSSet *keys;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    keys = [NSSet setWithObjects:kDKTestsPostTextKey, kDKTestsPostVisitsKey, kDKTestsPostPriceKey, kDKTestsPostQuantityKey, nil];
+  });
+  return keys;
+}
+
+- (void)decodeObjects {
+  [super decodeObjects];
+  id value = nil;
+  value = [self objectForKey:kDKTestsPostTextKey];
+  text_ = [value isKindOfClass:[NSString class]] ? value : nil;
+  value = [self objectForKey:kDKTestsPostLocationKey];
+  location_ = [value isKindOfClass:[NSArray class]] ? value : nil;
+  value = [self objectForKey:kDKTestsPostSharedToKey];
+  sharedTo_ = [value isKindOfClass:[NSArray class]] ? value : nil;
+  value = [self objectForKey:kDKTestsPostVisitsKey];
+  visits_ = [value isKindOfClass:[NSNumber class]] ? [value doubleValue] : 0.0;
+  value = [self objectForKey:kDKTestsPostPriceKey];
+  price_ = [value isKindOfClass:[NSNumber class]] ? [value doubleValue] : 0.0;
+  value = [self objectForKey:kDKTestsPostQuantityKey];
+  quantity_ = [value isKindOfClass:[NSNumber class]] ? [value doubleValue] : 0.0;
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key {
+  [super setObject:object forKey:key];
+  if ([key isEqualToString:kDKTestsPostTextKey]) {
+    text_ = [object isKindOfClass:[NSString class]] ? object : nil;
+  }
+  else if ([key isEqualToString:kDKTestsPostLocationKey]) {
+    location_ = [object isKindOfClass:[NSArray class]] ? object : nil;
+  }
+  else if ([key isEqualToString:kDKTestsPostSharedToKey]) {
+    sharedTo_ = [object isKindOfClass:[NSArray class]] ? object : nil;
+  }
+  else if ([key isEqualToString:kDKTestsPostVisitsKey]) {
+    visits_ = [object isKindOfClass:[NSNumber class]] ? [object doubleValue] : 0.0;
+  }
+  else if ([key isEqualToString:kDKTestsPostPriceKey]) {
+    price_ = [object isKindOfClass:[NSNumber class]] ? [object doubleValue] : 0.0;
+  }
+  else if ([key isEqualToString:kDKTestsPostQuantityKey]) {
+    quantity_ = [object isKindOfClass:[NSNumber class]] ? [object doubleValue] : 0.0;
+  }
+}
+
+- (NSString *)text {
+  return text_;
+}
+
+- (void)setText:(NSString *)text {
+  [super setObject:(text != nil) ? (id)text : [NSNull null] forKey:kDKTestsPostTextKey];
+  text_ = [text copy];
+}
+
+- (NSArray *)location {
+  return location_;
+}
+
+- (void)setLocation:(NSArray *)location {
+  [super setObject:(location != nil) ? (id)location : [NSNull null] forKey:kDKTestsPostLocationKey];
+  location_ = location;
+}
+
+- (NSArray *)sharedTo {
+  return sharedTo_;
+}
+
+- (void)setSharedTo:(NSArray *)sharedTo {
+  [super setObject:(sharedTo != nil) ? (id)sharedTo : [NSNull null] forKey:kDKTestsPostSharedToKey];
+  sharedTo_ = sharedTo;
+}
+
+- (double)visits {
+  return visits_;
+}
+
+- (void)setVisits:(double)visits {
+  [super setObject:@(visits) forKey:kDKTestsPostVisitsKey];
+  visits_ = visits;
+}
+
+- (double)price {
+  return price_;
+}
+
+- (void)setPrice:(double)price {
+  [super setObject:@(price) forKey:kDKTestsPostPriceKey];
+  price_ = price;
+}
+
+- (double)quantity {
+  return quantity_;
+}
+
+- (void)setQuantity:(double)quantity {
+  [super setObject:@(quantity) forKey:kDKTestsPostQuantityKey];
+  quantity_ = quantity;
+}
+
+@end
@@ -0,0 +1,56 @@
+//
+//  DKTestsQueue.h
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A serial queue without a run loop for tests of background methods, their callbacks are delivered
+ on the queue the method was called from. Callbacks call <signal>, the test waits for the signals.
+ */
+@interface DKTestsQueue : NSObject
+
+/**
+ Creates a new serial queue
+ @return The initialized queue
+ */
++ (DKTestsQueue *)queue;
+
+/**
+ Runs the block on the queue and waits until it returned
+ @param block The block calling the background methods
+ */
+- (void)sync:(dispatch_block_t)block;
+
+/**
+ Signals a waiting test, called by the callbacks
+ */
+- (void)signal;
+
+/**
+ Waits for the signals, then until the callbacks queued until then returned
+ @param count The number of signals to wait for
+ @param timeout The maximum time in seconds to wait for each signal
+ @return `YES` if all signals were received before the timeout
+ */
+- (BOOL)waitForSignals:(NSUInteger)count timeout:(NSTimeInterval)timeout;
+
+/**
+ Runs the block on the queue and waits for the signals of its callbacks, see <waitForSignals:timeout:>
+ @param block The block calling the background methods
+ @param count The number of signals to wait for
+ @param timeout The maximum time in seconds to wait for each signal
+ @return `YES` if all signals were received before the timeout
+ */
+- (BOOL)waitForBlock:(dispatch_block_t)block signals:(NSUInteger)count timeout:(NSTimeInterval)timeout;
+
+/**
+ Waits until the callbacks queued until now returned
+ */
+- (void)drain;
+
+@end
@@ -0,0 +1,61 @@
+//
+//  DKTestsQueue.m
+//  DeploydKit
+//
+//  Created by Denis Berton
+//  Copyright (c) 2012 clooket.com. All rights reserved.
+//
+
+#import "DKTestsQueue.h"
+
+@implementation DKTestsQueue {
+@private
+  dispatch_queue_t      queue_;
+  dispatch_semaphore_t  semaphore_;
+}
+
++ (DKTestsQueue *)queue {
+  return [self new];
+}
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    queue_ = dispatch_queue_create("DeploydKitTests", DISPATCH_QUEUE_SERIAL);
+    semaphore_ = dispatch_semaphore_create(0);
+  }
+  return self;
+}
+
+- (void)dealloc {
+  dispatch_release(queue_);
+  dispatch_release(semaphore_);
+}
+
+- (void)sync:(dispatch_block_t)block {
+  dispatch_sync(queue_, block);
+}
+
+- (void)signal {
+  dispatch_semaphore_signal(semaphore_);
+}
+
+- (BOOL)waitForSignals:(NSUInteger)count timeout:(NSTimeInterval)timeout {
+  BOOL received = YES;
+  for (NSUInteger i = 0; i < count && received; i++) {
+    received = (dispatch_semaphore_wait(semaphore_, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC))) == 0);
+  }
+  [self drain];
+  return received;
+}
+
+- (BOOL)waitForBlock:(dispatch_block_t)block signals:(NSUInteger)count timeout:(NSTimeInterval)timeout {
+  [self sync:block];
+  return [self waitForSignals:count timeout:timeout];
+}
+
+- (void)drain {
+  dispatch_sync(queue_, ^{});
+}
+
+@end
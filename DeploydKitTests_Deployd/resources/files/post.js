@@ -5,4 +5,8 @@ else{
     this.fileName = this.id;
     //this.creatorId = me.id;
     this.uploadedAt = new Date().getTime();
+}
+//Content hashes are only recorded by the server once verified
+if (!internal) {
+    protect('contentHash');
 }
\ No newline at end of file
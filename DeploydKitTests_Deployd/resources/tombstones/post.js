@@ -0,0 +1,6 @@
+//Tombstones are only written by tracked collections once a delete is stored
+if (!internal) {
+    cancel("Tombstones can only be written by the server", 401);
+}
+// Seconds, like the createdAt and updatedAt fields used as sync watermarks
+this.deletedAt = parseInt((new Date().getTime()) / 1000, 10);